@@ -0,0 +1,195 @@
+// adaptive_pwm.h
+// Picks --led-pwm-bits at runtime from what the content needs.
+//
+// Every PWM bit doubles the time a refresh of the wall takes, and most of
+// the extra depth only shows in dark, smooth gradients. Fast,
+// high-contrast content hides the lost depth and gains from the faster
+// refresh. Each frame a sparse grid (every 4th pixel of every 2nd row)
+// gives two numbers, both smoothed over about four frames:
+//   motion     mean absolute luma change since the last frame, 0..255
+//   gradients  share of samples that are dark (brightest channel 1..64)
+//              and within 3 codes of the sample to their right
+// Fast content (motion over 12, gradients under 10%) steps the bits down
+// towards the minimum after 6 such frames in a row. Slow content (motion
+// under 4) or gradient-heavy content (over 25%) steps them up after 30
+// frames in a row. In between the bits stay put, so content near a
+// threshold does not flip the depth back and forth.
+//
+// Every change is logged as a [pwm] line, and every stats interval a
+// summary says how the frames were split across depths.
+
+#pragma once
+
+#include "cli_flags.h"
+#include "mono_clock.h"
+
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <vector>
+
+struct AdaptivePwmOptions {
+  bool enabled = false;
+  int min_bits = 7;
+  int max_bits = 11;
+  int stats_interval_s = 5;  // the tool's --stats-interval; 0: no summary
+};
+
+// --adaptive-pwm=MIN,MAX. Returns 1 if `arg` was it, -1 if its value is
+// bad, 0 if it is not ours.
+static inline int ParseAdaptivePwmFlag(const char *arg,
+                                       AdaptivePwmOptions *opt) {
+  const char *v = FlagValue(arg, "--adaptive-pwm");
+  if (!v) return 0;
+  if (std::sscanf(v, "%d,%d", &opt->min_bits, &opt->max_bits) != 2 ||
+      opt->min_bits < 1 || opt->max_bits > 11 ||
+      opt->min_bits > opt->max_bits) {
+    std::fprintf(stderr, "--adaptive-pwm wants MIN,MAX bits within 1..11\n");
+    return -1;
+  }
+  opt->enabled = true;
+  return 1;
+}
+
+class AdaptivePwm {
+ public:
+  // start_bits: what the matrix was created with; clamped to the range.
+  void Configure(const AdaptivePwmOptions &opt, int start_bits) {
+    opt_ = opt;
+    bits_ = start_bits < opt.min_bits   ? opt.min_bits
+            : start_bits > opt.max_bits ? opt.max_bits
+                                        : start_bits;
+    prev_.clear();
+    motion_ = 0;
+    gradients_ = 0;
+    fast_run_ = slow_run_ = 0;
+    ResetStats();
+    report_interval_us_ = opt.stats_interval_s * 1000000ll;
+    report_us_ = MonoMicros() + report_interval_us_;
+  }
+
+  bool enabled() const { return opt_.enabled; }
+  int bits() const { return bits_; }
+
+  // Look at a new frame of `width` x `height` rgb pixels with
+  // `bytes_per_channel` 1 or 2 (little endian), rows in either order, and
+  // return the PWM bits to show it with.
+  int Update(const uint8_t *frame, int width, int height,
+             int bytes_per_channel) {
+    const int bpc = bytes_per_channel;
+    const int hi = bpc - 1;  // the top byte of a channel
+    const size_t pixel = 3 * bpc;
+    const size_t samples = (size_t)(width / STEP_X) * (height / STEP_Y);
+    if (samples == 0) return bits_;  // too small to say anything
+    const bool first = prev_.size() != samples;
+    if (first) prev_.assign(samples, 0);
+
+    uint64_t diff = 0;
+    uint32_t smooth_dark = 0;
+    size_t i = 0;
+    for (int y = 0; y + STEP_Y <= height; y += STEP_Y) {
+      const uint8_t *row = frame + (size_t)y * width * pixel;
+      int last_max = -1;
+      for (int x = 0; x + STEP_X <= width; x += STEP_X, ++i) {
+        const uint8_t *p = row + x * pixel;
+        const int r = p[hi], g = p[bpc + hi], b = p[2 * bpc + hi];
+        const int luma = (2 * r + 5 * g + b) >> 3;
+        diff += luma > prev_[i] ? luma - prev_[i] : prev_[i] - luma;
+        prev_[i] = (uint8_t)luma;
+        const int mx = r > g ? (r > b ? r : b) : (g > b ? g : b);
+        if (mx >= 1 && mx <= DARK && last_max >= 0 &&
+            (mx > last_max ? mx - last_max : last_max - mx) <= SMOOTH) {
+          smooth_dark++;
+        }
+        last_max = mx;
+      }
+    }
+    if (first) return bits_;
+
+    motion_ += ((double)diff / samples - motion_) / SMOOTHING;
+    gradients_ += ((double)smooth_dark / samples - gradients_) / SMOOTHING;
+
+    const bool fast = motion_ > MOTION_FAST && gradients_ < GRADIENTS_LOW;
+    const bool slow = motion_ < MOTION_SLOW || gradients_ > GRADIENTS_HIGH;
+    fast_run_ = fast ? fast_run_ + 1 : 0;
+    slow_run_ = slow ? slow_run_ + 1 : 0;
+    if (fast_run_ >= DOWN_FRAMES && bits_ > opt_.min_bits) {
+      Change(bits_ - 1);
+    } else if (slow_run_ >= UP_FRAMES && bits_ < opt_.max_bits) {
+      Change(bits_ + 1);
+    }
+
+    frames_++;
+    frames_at_[bits_]++;
+    motion_sum_ += motion_;
+    gradients_sum_ += gradients_;
+    if (report_interval_us_ > 0 && MonoMicros() >= report_us_) {
+      Print(stderr);
+      report_us_ += report_interval_us_;
+    }
+    return bits_;
+  }
+
+  // Where the frames since the last summary went.
+  void Print(FILE *out) {
+    if (frames_ == 0) return;
+    char split[128];
+    int len = 0;
+    for (int b = opt_.min_bits; b <= opt_.max_bits; ++b) {
+      if (frames_at_[b] == 0) continue;
+      len += std::snprintf(split + len, sizeof(split) - len, " %d:%.0f%%", b,
+                           100.0 * frames_at_[b] / frames_);
+    }
+    split[len] = '\0';
+    std::fprintf(out, "[pwm] now %d bits; motion %.1f, gradients %.0f%%; "
+                 "%d changes; frames at bits%s\n", bits_,
+                 motion_sum_ / frames_, 100 * gradients_sum_ / frames_,
+                 changes_, split);
+    ResetStats();
+  }
+
+ private:
+  static const int STEP_X = 4;
+  static const int STEP_Y = 2;
+  static const int DARK = 64;
+  static const int SMOOTH = 3;
+  static const int SMOOTHING = 4;
+  static const int DOWN_FRAMES = 6;
+  static const int UP_FRAMES = 30;
+  static constexpr double MOTION_FAST = 12;
+  static constexpr double MOTION_SLOW = 4;
+  static constexpr double GRADIENTS_LOW = 0.10;
+  static constexpr double GRADIENTS_HIGH = 0.25;
+
+  void Change(int bits) {
+    std::fprintf(stderr, "[pwm] %d -> %d bits (motion %.1f, gradients "
+                 "%.0f%%)\n", bits_, bits, motion_, 100 * gradients_);
+    bits_ = bits;
+    fast_run_ = slow_run_ = 0;
+    changes_++;
+  }
+
+  void ResetStats() {
+    frames_ = 0;
+    changes_ = 0;
+    motion_sum_ = gradients_sum_ = 0;
+    std::memset(frames_at_, 0, sizeof(frames_at_));
+  }
+
+  AdaptivePwmOptions opt_;
+  int bits_ = 11;
+  std::vector<uint8_t> prev_;  // luma of the last frame's samples
+  double motion_ = 0;
+  double gradients_ = 0;
+  int fast_run_ = 0;
+  int slow_run_ = 0;
+
+  uint64_t frames_ = 0;
+  uint64_t frames_at_[12];
+  int changes_ = 0;
+  double motion_sum_ = 0;
+  double gradients_sum_ = 0;
+  int64_t report_interval_us_ = 0;
+  int64_t report_us_ = 0;
+};
@@ -0,0 +1,191 @@
+// bc1_codec.h
+// BC1 (DXT1) block compression of rgb24 frames: every 4x4 block of pixels
+// is 8 bytes, so a 256x192 frame is 24576 bytes instead of 147456, about
+// 11.8 Mbit/s at 60 fps. The rate is fixed, so a block's bytes are always
+// at the same offset. A packet that carries whole blocks decodes on its
+// own, and a lost one costs only its blocks: the UDP receivers show such a
+// frame anyway, with the previous frame's blocks in the gaps
+// (udp_frame_assembly.h).
+//
+// A block is two RGB565 end colors c0, c1 (little endian), then 32 bits of
+// 2-bit indexes, pixel (x, y) of the block at bit 2 * (4 y + x). With
+// c0 > c1 the four colors are c0, c1, (2 c0 + c1) / 3 and (c0 + 2 c1) / 3;
+// otherwise c0, c1, their mean and black. The encoder only writes the
+// first kind.
+//
+// Encoding: the end colors are the block's extremes along its main color
+// axis, found from the covariance by a few power iterations. Each pixel
+// then takes the nearest of the four colors along that line.
+// Decoding: the four colors of a block are worked out once, and each pixel
+// copies one of them.
+
+#pragma once
+
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+
+static const int BC1_BLOCK = 4;
+static const int BC1_BLOCK_BYTES = 8;
+
+namespace bc1_internal {
+
+static inline uint16_t To565(int r, int g, int b) {
+  return (uint16_t)((r * 31 + 127) / 255 << 11 | (g * 63 + 127) / 255 << 5 |
+                    (b * 31 + 127) / 255);
+}
+
+static inline void From565(uint16_t c, uint8_t *rgb) {
+  const int r = c >> 11, g = c >> 5 & 63, b = c & 31;
+  rgb[0] = (uint8_t)(r << 3 | r >> 2);
+  rgb[1] = (uint8_t)(g << 2 | g >> 4);
+  rgb[2] = (uint8_t)(b << 3 | b >> 2);
+}
+
+// The four colors of a block, 3 bytes each.
+static inline void Palette(uint16_t c0, uint16_t c1, uint8_t *p) {
+  From565(c0, p);
+  From565(c1, p + 3);
+  for (int k = 0; k < 3; ++k) {
+    if (c0 > c1) {
+      p[6 + k] = (uint8_t)((2 * p[k] + p[3 + k] + 1) / 3);
+      p[9 + k] = (uint8_t)((p[k] + 2 * p[3 + k] + 1) / 3);
+    } else {
+      p[6 + k] = (uint8_t)((p[k] + p[3 + k] + 1) / 2);
+      p[9 + k] = 0;
+    }
+  }
+}
+
+// One block from the 16 pixels in `px` (r, g, b each).
+static inline void EncodeBlock(const int px[16][3], uint8_t *out) {
+  int mean[3] = {0, 0, 0};
+  for (int i = 0; i < 16; ++i)
+    for (int k = 0; k < 3; ++k) mean[k] += px[i][k];
+  for (int k = 0; k < 3; ++k) mean[k] = (mean[k] + 8) >> 4;
+
+  // Covariance, then the main axis by power iteration (starting from the
+  // luma direction, which most blocks are close to).
+  int cov[6] = {0, 0, 0, 0, 0, 0};  // rr rg rb gg gb bb
+  for (int i = 0; i < 16; ++i) {
+    const int r = px[i][0] - mean[0], g = px[i][1] - mean[1],
+              b = px[i][2] - mean[2];
+    cov[0] += r * r;
+    cov[1] += r * g;
+    cov[2] += r * b;
+    cov[3] += g * g;
+    cov[4] += g * b;
+    cov[5] += b * b;
+  }
+  float axis[3] = {0.30f, 0.59f, 0.11f};
+  for (int it = 0; it < 4; ++it) {
+    const float x = cov[0] * axis[0] + cov[1] * axis[1] + cov[2] * axis[2];
+    const float y = cov[1] * axis[0] + cov[3] * axis[1] + cov[4] * axis[2];
+    const float z = cov[2] * axis[0] + cov[4] * axis[1] + cov[5] * axis[2];
+    const float m = x * x + y * y + z * z;
+    if (m < 1e-6f) break;  // flat block: any axis will do
+    const float s = 1.0f / std::sqrt(m);
+    axis[0] = x * s;
+    axis[1] = y * s;
+    axis[2] = z * s;
+  }
+
+  int lo = 0, hi = 0;
+  float lo_t = 1e9f, hi_t = -1e9f;
+  for (int i = 0; i < 16; ++i) {
+    const float t = px[i][0] * axis[0] + px[i][1] * axis[1] +
+                    px[i][2] * axis[2];
+    if (t < lo_t) {
+      lo_t = t;
+      lo = i;
+    }
+    if (t > hi_t) {
+      hi_t = t;
+      hi = i;
+    }
+  }
+  uint16_t c0 = To565(px[hi][0], px[hi][1], px[hi][2]);
+  uint16_t c1 = To565(px[lo][0], px[lo][1], px[lo][2]);
+  uint32_t indexes = 0;
+  if (c0 != c1) {
+    if (c0 < c1) {
+      const uint16_t t = c0;
+      c0 = c1;
+      c1 = t;
+    }
+    uint8_t p[12];
+    Palette(c0, c1, p);
+    // Project onto c1 -> c0 as decoded, and round to the nearest of the
+    // four steps; index order along the line is 1, 3, 2, 0.
+    static const uint8_t STEP_INDEX[4] = {1, 3, 2, 0};
+    const int d[3] = {p[0] - p[3], p[1] - p[4], p[2] - p[5]};
+    const int dd = d[0] * d[0] + d[1] * d[1] + d[2] * d[2];
+    const float scale = dd ? 3.0f / dd : 0;
+    for (int i = 0; i < 16; ++i) {
+      const int t = (px[i][0] - p[3]) * d[0] + (px[i][1] - p[4]) * d[1] +
+                    (px[i][2] - p[5]) * d[2];
+      int step = (int)(t * scale + 0.5f);
+      step = step < 0 ? 0 : step > 3 ? 3 : step;
+      indexes |= (uint32_t)STEP_INDEX[step] << (2 * i);
+    }
+  }
+  out[0] = (uint8_t)c0;
+  out[1] = (uint8_t)(c0 >> 8);
+  out[2] = (uint8_t)c1;
+  out[3] = (uint8_t)(c1 >> 8);
+  std::memcpy(out + 4, &indexes, 4);  // little endian, as on the Pi and x86
+}
+
+}  // namespace bc1_internal
+
+static inline size_t Bc1FrameBytes(int width, int height) {
+  return (size_t)((width + 3) / 4) * ((height + 3) / 4) * BC1_BLOCK_BYTES;
+}
+
+// Compress a width x height rgb24 frame into Bc1FrameBytes() at `out`,
+// blocks row by row. Blocks over the edge repeat the last row and column.
+static inline void Bc1Encode(const uint8_t *rgb, int width, int height,
+                             uint8_t *out) {
+  for (int by = 0; by < height; by += BC1_BLOCK) {
+    for (int bx = 0; bx < width; bx += BC1_BLOCK, out += BC1_BLOCK_BYTES) {
+      int px[16][3];
+      for (int y = 0; y < BC1_BLOCK; ++y) {
+        const int sy = by + y < height ? by + y : height - 1;
+        for (int x = 0; x < BC1_BLOCK; ++x) {
+          const int sx = bx + x < width ? bx + x : width - 1;
+          const uint8_t *p = rgb + ((size_t)sy * width + sx) * 3;
+          px[4 * y + x][0] = p[0];
+          px[4 * y + x][1] = p[1];
+          px[4 * y + x][2] = p[2];
+        }
+      }
+      bc1_internal::EncodeBlock(px, out);
+    }
+  }
+}
+
+// Expand Bc1FrameBytes() at `in` to a width x height rgb24 frame.
+static inline void Bc1Decode(const uint8_t *in, int width, int height,
+                             uint8_t *rgb) {
+  const size_t stride = (size_t)width * 3;
+  for (int by = 0; by < height; by += BC1_BLOCK) {
+    const int rows = height - by < BC1_BLOCK ? height - by : BC1_BLOCK;
+    for (int bx = 0; bx < width; bx += BC1_BLOCK, in += BC1_BLOCK_BYTES) {
+      const int cols = width - bx < BC1_BLOCK ? width - bx : BC1_BLOCK;
+      uint8_t p[12];
+      bc1_internal::Palette((uint16_t)(in[0] | in[1] << 8),
+                            (uint16_t)(in[2] | in[3] << 8), p);
+      uint32_t indexes;
+      std::memcpy(&indexes, in + 4, 4);
+      uint8_t *row = rgb + (size_t)by * stride + (size_t)bx * 3;
+      for (int y = 0; y < rows; ++y, row += stride) {
+        for (int x = 0; x < cols; ++x) {
+          const uint8_t *c = p + 3 * (indexes >> (2 * (4 * y + x)) & 3);
+          row[3 * x] = c[0];
+          row[3 * x + 1] = c[1];
+          row[3 * x + 2] = c[2];
+        }
+      }
+    }
+  }
+}
@@ -0,0 +1,31 @@
+// block_match.h
+// The pieces of a 16x16 block motion search on luma, shared by the frame
+// interpolator (frame_interpolator.h) and the delta codec (delta_codec.h).
+// Plain byte loops that GCC vectorizes: psadbw on x86, uabal on NEON.
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <cstdlib>
+
+static const int MATCH_BLOCK = 16;
+
+// Sum of absolute differences of two 16x16 blocks. Unrolled, the row
+// loop is no longer recognized as one psadbw / uabal per row.
+static inline uint32_t BlockSad16(const uint8_t *a, const uint8_t *b,
+                                  int stride) {
+  uint32_t s = 0;
+  for (int y = 0; y < MATCH_BLOCK; ++y, a += stride, b += stride) {
+#pragma GCC unroll 1
+    for (int x = 0; x < MATCH_BLOCK; ++x) s += std::abs(a[x] - b[x]);
+  }
+  return s;
+}
+
+// Luma of `pixels` rgb24 pixels, the cheap (2 r + 5 g + b) / 8.
+static inline void LumaPlane(const uint8_t *rgb, size_t pixels,
+                             uint8_t *luma) {
+  for (size_t i = 0; i < pixels; ++i, rgb += 3)
+    luma[i] = (uint8_t)((2 * rgb[0] + 5 * rgb[1] + rgb[2]) >> 3);
+}
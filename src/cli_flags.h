@@ -0,0 +1,22 @@
+// cli_flags.h
+// Tiny helpers for the "--name=value" flags our tools accept on top of the
+// --led-* flags consumed by RGBMatrix::CreateFromFlags().
+
+#pragma once
+
+#include <cstdlib>
+#include <cstring>
+
+// Returns the value part if arg is "--name=value" (name given without the
+// '=' sign), otherwise nullptr.
+static inline const char *FlagValue(const char *arg, const char *name) {
+  size_t len = std::strlen(name);
+  if (std::strncmp(arg, name, len) != 0 || arg[len] != '=')
+    return nullptr;
+  return arg + len + 1;
+}
+
+// True if arg is exactly the boolean flag "--name".
+static inline bool FlagSet(const char *arg, const char *name) {
+  return std::strcmp(arg, name) == 0;
+}
@@ -0,0 +1,176 @@
+// color_lut.h
+// 3D color lookup table (.cube, e.g. 17^3 or 33^3) applied while frames are
+// drawn, so content can be graded per venue on the receiving side.
+//
+// Tetrahedral interpolation in fixed point. The lattice cell of a pixel
+// comes from per-channel tables (index and 0..256 weight for each 8-bit
+// value); the cell is split into six tetrahedra by the order of the three
+// weights, and the result is
+//   c0 + f1 * (c1 - c0) + f2 * (c2 - c1) + f3 * (c3 - c2)
+// for the tetrahedron's vertices c0..c3 and the sorted weights f1 >= f2 >=
+// f3. Lattice points are stored as four int16 lanes (r, g, b, unused) with
+// 4 fractional bits, so each vertex is one 8-byte load and the three
+// channels go through the arithmetic together as one SIMD vector (GCC
+// vector extensions: SSE2 on x86, NEON on the Pi). A 33^3 table is 287 KB.
+//
+// Apply() maps a row at a time into a scratch row that the draw loop then
+// reads, so the LUT shares the pass over the frame with the flip.
+
+#pragma once
+
+#include <time.h>
+
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <vector>
+
+class ColorLut {
+ public:
+  bool enabled() const { return n_ != 0; }
+  int size() const { return n_; }
+
+  // Read an Adobe/Resolve .cube file (LUT_3D_SIZE 2..64, red fastest,
+  // domain 0..1). Prints what went wrong and returns false on error.
+  bool Load(const char *path) {
+    FILE *f = std::fopen(path, "r");
+    if (!f) {
+      perror(path);
+      return false;
+    }
+    int n = 0;
+    std::vector<float> values;
+    char line[256];
+    bool ok = true;
+    while (ok && std::fgets(line, sizeof(line), f)) {
+      float r, g, b;
+      if (line[0] == '#' || line[0] == '\n' || line[0] == '\r' ||
+          std::strncmp(line, "TITLE", 5) == 0) {
+        continue;
+      } else if (std::sscanf(line, "LUT_3D_SIZE %d", &n) == 1) {
+        ok = n >= 2 && n <= 64;
+      } else if (std::sscanf(line, "DOMAIN_MIN %f %f %f", &r, &g, &b) == 3) {
+        ok = r == 0 && g == 0 && b == 0;
+      } else if (std::sscanf(line, "DOMAIN_MAX %f %f %f", &r, &g, &b) == 3) {
+        ok = r == 1 && g == 1 && b == 1;
+      } else if (std::sscanf(line, "%f %f %f", &r, &g, &b) == 3) {
+        values.push_back(r);
+        values.push_back(g);
+        values.push_back(b);
+      } else {
+        ok = false;  // LUT_1D_SIZE and friends
+      }
+    }
+    std::fclose(f);
+    if (!ok || n == 0 || values.size() != (size_t)n * n * n * 3) {
+      std::fprintf(stderr, "%s: not a 3D .cube LUT with domain 0..1 (need "
+                   "LUT_3D_SIZE 2..64 and N^3 entries)\n", path);
+      return false;
+    }
+
+    n_ = n;
+    table_.resize((size_t)n * n * n);
+    for (size_t i = 0; i < table_.size(); ++i) {
+      for (int c = 0; c < 3; ++c) {
+        float v = values[i * 3 + c];
+        v = v < 0 ? 0 : v > 1 ? 1 : v;
+        table_[i][c] = (int16_t)(v * 255 * ONE_OUT + 0.5f);
+      }
+      table_[i][3] = 0;
+    }
+    // Per-channel cell index and weight. 255 lands on the last lattice
+    // point, expressed as the far corner of the last cell (weight 256).
+    for (int v = 0; v < 256; ++v) {
+      int pos = v * (n - 1);
+      int i = pos / 255;
+      int w = ((pos - i * 255) * 256 + 127) / 255;
+      if (i == n - 1) {
+        i = n - 2;
+        w = 256;
+      }
+      cell_[v] = i;
+      weight_[v] = w;
+    }
+    return true;
+  }
+
+  // Map `count` rgb24 pixels from `in` to `out` (which may be `in`).
+  void Apply(const uint8_t *in, uint8_t *out, int count) const {
+    const v4hi *t = table_.data();
+    const int sr = 1, sg = n_, sb = n_ * n_;
+    for (int p = 0; p < count; ++p, in += 3, out += 3) {
+      const int fr = weight_[in[0]], fg = weight_[in[1]], fb = weight_[in[2]];
+      const v4hi *c0 = t + cell_[in[0]] * sr + cell_[in[1]] * sg +
+                       cell_[in[2]] * sb;
+
+      // Walk from c0 to the far corner along the axes in order of weight.
+      // The tetrahedron is picked by table, not branches: on noisy content
+      // the branches mispredicted and doubled the cost.
+      const int f[3] = {fr, fg, fb};
+      const int s[3] = {sr, sg, sb};
+      const uint8_t *o = ORDER[(fr >= fg) << 2 | (fg >= fb) << 1 | (fr >= fb)];
+      const int f1 = f[o[0]], f2 = f[o[1]], f3 = f[o[2]];
+      const int o1 = s[o[0]], o2 = o1 + s[o[1]];
+      const v4si v0 = __builtin_convertvector(c0[0], v4si);
+      const v4si v1 = __builtin_convertvector(c0[o1], v4si);
+      const v4si v2 = __builtin_convertvector(c0[o2], v4si);
+      const v4si v3 = __builtin_convertvector(c0[sr + sg + sb], v4si);
+      const v4si acc = v0 * 256 + (v1 - v0) * f1 + (v2 - v1) * f2 +
+                       (v3 - v2) * f3;
+      const v4si res = (acc + ROUND) >> SHIFT;
+      out[0] = (uint8_t)res[0];
+      out[1] = (uint8_t)res[1];
+      out[2] = (uint8_t)res[2];
+    }
+  }
+
+  // Time Apply() over a whole frame of varied pixels, in microseconds.
+  double MicrosPerFrame(int width, int height) const {
+    std::vector<uint8_t> frame((size_t)width * height * 3);
+    for (size_t i = 0; i < frame.size(); ++i)
+      frame[i] = (uint8_t)(i * 2654435761u >> 13);
+    std::vector<uint8_t> row((size_t)width * 3);
+    const int reps = 20;
+    timespec a, b;
+    clock_gettime(CLOCK_MONOTONIC, &a);
+    for (int k = 0; k < reps; ++k) {
+      for (int y = 0; y < height; ++y)
+        Apply(&frame[(size_t)y * width * 3], row.data(), width);
+    }
+    clock_gettime(CLOCK_MONOTONIC, &b);
+    return ((b.tv_sec - a.tv_sec) * 1e6 + (b.tv_nsec - a.tv_nsec) / 1e3) /
+           reps;
+  }
+
+ private:
+  typedef int16_t v4hi __attribute__((vector_size(8)));
+  typedef int32_t v4si __attribute__((vector_size(16)));
+
+  static const int ONE_OUT = 16;          // table fraction: 8.4 fixed point
+  static const int SHIFT = 8 + 4;         // weights are x256, table x16
+  static const int ROUND = 1 << (SHIFT - 1);
+  // Axes (0 r, 1 g, 2 b) by falling weight, indexed by r>=g, g>=b, r>=b.
+  // Keys 1 and 6 are contradictory and never occur.
+  static constexpr uint8_t ORDER[8][3] = {
+    {2, 1, 0}, {0, 1, 2}, {1, 2, 0}, {1, 0, 2},
+    {2, 0, 1}, {0, 2, 1}, {0, 1, 2}, {0, 1, 2},
+  };
+
+  int n_ = 0;
+  std::vector<v4hi> table_;  // red fastest, then green, then blue
+  uint16_t cell_[256];
+  uint16_t weight_[256];
+};
+
+// --lut=FILE for the tools that draw frames: load it and report what it
+// costs per frame on this machine.
+static inline bool LoadColorLut(const char *path, ColorLut *lut, int width,
+                                int height) {
+  if (!lut->Load(path))
+    return false;
+  std::fprintf(stderr, "Color LUT %s: %d^3, %.2f ms per %dx%d frame\n", path,
+               lut->size(), lut->MicrosPerFrame(width, height) / 1000.0,
+               width, height);
+  return true;
+}
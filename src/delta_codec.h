@@ -0,0 +1,425 @@
+// delta_codec.h
+// Motion-compensated delta frames for content that moves as a whole:
+// tickers, scrolls, pans. A plain delta would resend nearly every pixel,
+// since every pixel changed. Here each 16x16 block says where in the
+// previous frame to copy it from, so most blocks of a scroll cost 3 bytes,
+// and those the new content comes in at a few more.
+//
+// Frame (width and height multiples of 16):
+//   u16 seq, u16 ref      ref == seq: a key frame, all RAW, no reference
+//   then per block, in row order, one of
+//     COPY      u8 0, s8 dx, s8 dy      the previous frame's block moved by
+//                                       (dx, dy); pixels past the edge
+//                                       repeat the edge
+//     RESIDUAL  u8 1, s8 dx, s8 dy, 384 bytes
+//                                       the same plus 2 r for each byte of
+//                                       the block, r a signed nibble (low
+//                                       nibble first)
+//     PATCH     u8 3, s8 dx, s8 dy, u8 x << 4 | (w - 1), u8 y << 4 | (h - 1),
+//               w * h * 3 bytes         the same with a w x h rectangle at
+//                                       (x, y) of the block replaced
+//     RAW       u8 2, 768 bytes         the block's rgb24
+// Frames vary in length; DeltaFrameBytes() is the largest one.
+//
+// The encoder keeps the frame the decoder will reconstruct and predicts
+// from that, not from its input, so errors never add up: RESIDUAL leaves at
+// most 1 per channel, and a block that close counts as a COPY. A decoder
+// that missed a frame has the wrong reference. It keeps showing its last
+// frame until the next key frame, which the encoder sends every
+// keyframe_interval frames.
+//
+// Each block tries its own vector of the frame before, the vectors of the
+// blocks to its left and above, and no motion, and keeps whichever codes
+// smallest (the first of equals, so a flat block keeps the motion going
+// on around it). In a scroll one of them is the scroll. Only when none is
+// a COPY does it search every vector within RANGE pixels, on luma with
+// BlockSad16 (block_match.h), and try the best.
+
+#pragma once
+
+#include "block_match.h"
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <utility>
+#include <vector>
+
+namespace delta_internal {
+
+static const int BLOCK = MATCH_BLOCK;
+static const int ROW = BLOCK * 3;  // bytes of a block row
+static const int BLOCK_BYTES = BLOCK * ROW;
+static const size_t HEADER = 4;
+enum BlockMode { COPY = 0, RESIDUAL = 1, RAW = 2, PATCH = 3 };
+
+static inline void Put16(uint8_t *p, uint16_t v) {
+  p[0] = (uint8_t)(v >> 8);
+  p[1] = (uint8_t)v;
+}
+static inline uint16_t Get16(const uint8_t *p) {
+  return (uint16_t)(p[0] << 8 | p[1]);
+}
+
+// The block at (x, y) of a width x height rgb24 frame, to `out` (ROW bytes
+// a row). Pixels past the edge repeat the edge.
+static inline void Fetch(const uint8_t *frame, int width, int height, int x,
+                         int y, uint8_t *out) {
+  const size_t stride = (size_t)width * 3;
+  if (x >= 0 && y >= 0 && x + BLOCK <= width && y + BLOCK <= height) {
+    frame += (size_t)y * stride + (size_t)x * 3;
+    for (int r = 0; r < BLOCK; ++r, frame += stride, out += ROW)
+      std::memcpy(out, frame, ROW);
+    return;
+  }
+  for (int r = 0; r < BLOCK; ++r) {
+    const int sy = y + r < 0 ? 0 : y + r >= height ? height - 1 : y + r;
+    for (int c = 0; c < BLOCK; ++c, out += 3) {
+      const int sx = x + c < 0 ? 0 : x + c >= width ? width - 1 : x + c;
+      std::memcpy(out, frame + (size_t)sy * stride + (size_t)sx * 3, 3);
+    }
+  }
+}
+
+// Write the block that `mode` and its `payload` make of the prediction
+// `pred` to `out`, in a frame `stride` bytes a row.
+static inline void Apply(BlockMode mode, const uint8_t *pred,
+                         const uint8_t *payload, uint8_t *out,
+                         size_t stride) {
+  if (mode == RESIDUAL) {
+    for (int r = 0; r < BLOCK; ++r, pred += ROW, out += stride) {
+      for (int i = 0; i < ROW; i += 2, ++payload) {
+        const int a = pred[i] + 2 * ((int8_t)(*payload << 4) >> 4);
+        const int b = pred[i + 1] + 2 * ((int8_t)*payload >> 4);
+        out[i] = (uint8_t)(a < 0 ? 0 : a > 255 ? 255 : a);
+        out[i + 1] = (uint8_t)(b < 0 ? 0 : b > 255 ? 255 : b);
+      }
+    }
+    return;
+  }
+  const uint8_t *from = mode == RAW ? payload : pred;
+  for (int r = 0; r < BLOCK; ++r, from += ROW)
+    std::memcpy(out + r * stride, from, ROW);
+  if (mode == PATCH) {
+    const int x = payload[0] >> 4, w = (payload[0] & 15) + 1;
+    const int y = payload[1] >> 4, h = (payload[1] & 15) + 1;
+    payload += 2;
+    for (int r = 0; r < h; ++r, payload += w * 3)
+      std::memcpy(out + (y + r) * stride + x * 3, payload, w * 3);
+  }
+}
+
+}  // namespace delta_internal
+
+static inline size_t DeltaFrameBytes(int width, int height) {
+  const size_t blocks = (size_t)(width / 16) * (height / 16);
+  return delta_internal::HEADER + blocks * (1 + delta_internal::BLOCK_BYTES);
+}
+
+class DeltaEncoder {
+ public:
+  static const int RANGE = 8;  // pixels per axis
+
+  void Configure(int width, int height, int keyframe_interval) {
+    width_ = width;
+    height_ = height;
+    keyframe_interval_ = keyframe_interval;
+    recon_.assign((size_t)width * height * 3, 0);
+    next_.assign(recon_.size(), 0);
+    luma_cur_.assign((size_t)width * height, 0);
+    luma_ref_.assign(luma_cur_.size(), 0);
+    vectors_.assign((size_t)(width / MATCH_BLOCK) * (height / MATCH_BLOCK),
+                    Vector());
+    frames_ = 0;
+  }
+
+  // Encode rgb24 `frame` into `out` (DeltaFrameBytes() of room); returns
+  // the bytes written.
+  size_t Encode(const uint8_t *frame, uint8_t *out) {
+    using namespace delta_internal;
+    const bool key =
+        frames_ == 0 || (keyframe_interval_ > 0 &&
+                         frames_ % keyframe_interval_ == 0);
+    Put16(out, seq_);
+    Put16(out + 2, key ? seq_ : (uint16_t)(seq_ - 1));
+    uint8_t *p = out + HEADER;
+    if (!key) LumaPlane(frame, (size_t)width_ * height_, luma_cur_.data());
+
+    const size_t stride = (size_t)width_ * 3;
+    const int bw = width_ / BLOCK, bh = height_ / BLOCK;
+    for (int by = 0; by < bh; ++by) {
+      for (int bx = 0; bx < bw; ++bx) {
+        const int x0 = bx * BLOCK, y0 = by * BLOCK;
+        Vector *v = &vectors_[(size_t)by * bw + bx];
+        uint8_t cur[BLOCK_BYTES], pred[BLOCK_BYTES];
+        Fetch(frame, width_, height_, x0, y0, cur);
+        Plan plan;
+        if (!key) {
+          const Vector tried[CANDIDATES] = {
+              *v, bx > 0 ? v[-1] : Vector(), by > 0 ? v[-bw] : Vector(),
+              Vector()};
+          plan = Best(cur, x0, y0, tried, pred);
+          if (plan.mode != RAW) *v = plan.v;
+        }
+        const uint8_t *payload = Write(plan, cur, pred, &p);
+        Apply(plan.mode, pred, payload,
+              &next_[(size_t)y0 * stride + (size_t)x0 * 3], stride);
+      }
+    }
+    std::swap(recon_, next_);
+    LumaPlane(recon_.data(), (size_t)width_ * height_, luma_ref_.data());
+    seq_++;
+    frames_++;
+    return (size_t)(p - out);
+  }
+
+ private:
+  struct Vector {
+    int8_t dx = 0, dy = 0;
+    bool operator==(const Vector &o) const {
+      return dx == o.dx && dy == o.dy;
+    }
+  };
+
+  static const int CANDIDATES = 4;
+
+  struct Plan {
+    delta_internal::BlockMode mode = delta_internal::RAW;
+    Vector v;
+    size_t bytes = 1 + delta_internal::BLOCK_BYTES;
+    int x = 0, y = 0, w = 0, h = 0;  // the PATCH rectangle
+  };
+
+  // The smallest plan for block `cur` at (x0, y0) of the CANDIDATES
+  // vectors, and of a searched one if none makes a COPY. Its prediction is
+  // left in `pred`.
+  Plan Best(const uint8_t *cur, int x0, int y0,
+            const Vector (&candidates)[CANDIDATES], uint8_t *pred) const {
+    using namespace delta_internal;
+    Vector tried[CANDIDATES + 1];
+    std::copy(candidates, candidates + CANDIDATES, tried);
+    int count = CANDIDATES;
+    Plan best;
+    for (int i = 0; i < count; ++i) {
+      bool seen = false;
+      for (int j = 0; j < i; ++j) seen = seen || tried[j] == tried[i];
+      if (!seen) {
+        uint8_t p[BLOCK_BYTES];
+        Fetch(recon_.data(), width_, height_, x0 + tried[i].dx,
+              y0 + tried[i].dy, p);
+        const Plan plan = Cost(cur, p, tried[i]);
+        if (plan.bytes < best.bytes) {
+          best = plan;
+          std::memcpy(pred, p, BLOCK_BYTES);
+          if (best.mode == COPY) break;  // nothing is smaller
+        }
+      }
+      if (i == CANDIDATES - 1 && best.mode != COPY) {
+        tried[CANDIDATES] = Search(x0, y0);
+        count = CANDIDATES + 1;
+      }
+    }
+    return best;
+  }
+
+  // The vector within RANGE, and within the frame, of the lowest luma SAD.
+  Vector Search(int x0, int y0) const {
+    const uint8_t *cur = &luma_cur_[(size_t)y0 * width_ + x0];
+    Vector best;
+    uint32_t best_sad = UINT32_MAX;
+    for (int dy = -RANGE; dy <= RANGE; ++dy) {
+      if (y0 + dy < 0 || y0 + dy + MATCH_BLOCK > height_) continue;
+      for (int dx = -RANGE; dx <= RANGE; ++dx) {
+        if (x0 + dx < 0 || x0 + dx + MATCH_BLOCK > width_) continue;
+        const uint32_t s = BlockSad16(
+            cur, &luma_ref_[(size_t)(y0 + dy) * width_ + x0 + dx], width_);
+        if (s < best_sad) {
+          best_sad = s;
+          best.dx = (int8_t)dx;
+          best.dy = (int8_t)dy;
+        }
+      }
+    }
+    return best;
+  }
+
+  // How `cur` codes against `pred`. Bytes off by at most 1 are let be, the
+  // error a RESIDUAL leaves (else a still image would go on sending
+  // residuals). The others make a RESIDUAL if the nibbles carry them, a
+  // PATCH of their bounding rectangle, or RAW, whichever is smallest.
+  static Plan Cost(const uint8_t *cur, const uint8_t *pred, Vector v) {
+    using namespace delta_internal;
+    int lo = 0, hi = 0;  // a plain min / max, which vectorizes
+    for (int i = 0; i < BLOCK_BYTES; ++i) {
+      const int d = cur[i] - pred[i];
+      lo = d < lo ? d : lo;
+      hi = d > hi ? d : hi;
+    }
+    Plan plan;
+    plan.v = v;
+    if (lo >= -1 && hi <= 1) {
+      plan.mode = COPY;
+      plan.bytes = 3;
+      return plan;
+    }
+    int x1 = BLOCK, y1 = BLOCK, x2 = -1, y2 = -1;
+    for (int r = 0; r < BLOCK; ++r, cur += ROW, pred += ROW) {
+      for (int c = 0; c < BLOCK; ++c) {
+        bool far = false;
+        for (int k = 0; k < 3; ++k) {
+          const int d = cur[3 * c + k] - pred[3 * c + k];
+          far = far || d < -1 || d > 1;
+        }
+        if (far) {
+          x1 = c < x1 ? c : x1;
+          x2 = c > x2 ? c : x2;
+          y1 = r < y1 ? r : y1;
+          y2 = r > y2 ? r : y2;
+        }
+      }
+    }
+    plan.x = x1;
+    plan.y = y1;
+    plan.w = x2 - x1 + 1;
+    plan.h = y2 - y1 + 1;
+    const size_t patch = 5 + (size_t)plan.w * plan.h * 3;
+    const size_t residual =
+        lo >= -16 && hi <= 15 ? 3 + BLOCK_BYTES / 2 : SIZE_MAX;
+    if (residual <= patch && residual < plan.bytes) {
+      plan.mode = RESIDUAL;
+      plan.bytes = residual;
+    } else if (patch < plan.bytes) {
+      plan.mode = PATCH;
+      plan.bytes = patch;
+    }
+    return plan;
+  }
+
+  // Write block `cur` as `plan` against `pred` at *p, and move *p past it.
+  // Returns the payload, what follows the mode and vector.
+  static const uint8_t *Write(const Plan &plan, const uint8_t *cur,
+                              const uint8_t *pred, uint8_t **p) {
+    using namespace delta_internal;
+    uint8_t *o = *p;
+    *o++ = (uint8_t)plan.mode;
+    if (plan.mode != RAW) {
+      *o++ = (uint8_t)plan.v.dx;
+      *o++ = (uint8_t)plan.v.dy;
+    }
+    const uint8_t *payload = o;
+    switch (plan.mode) {
+      case RAW:
+        std::memcpy(o, cur, BLOCK_BYTES);
+        o += BLOCK_BYTES;
+        break;
+      case RESIDUAL:
+        // r = round(d / 2), so pred + 2 r is within 1 of cur.
+        for (int i = 0; i < BLOCK_BYTES; i += 2) {
+          const int lo = (cur[i] - pred[i] + 1) >> 1;
+          const int hi = (cur[i + 1] - pred[i + 1] + 1) >> 1;
+          *o++ = (uint8_t)(((lo > 7 ? 7 : lo) & 15) | (hi > 7 ? 7 : hi) << 4);
+        }
+        break;
+      case PATCH:
+        *o++ = (uint8_t)(plan.x << 4 | (plan.w - 1));
+        *o++ = (uint8_t)(plan.y << 4 | (plan.h - 1));
+        for (int r = 0; r < plan.h; ++r, o += plan.w * 3)
+          std::memcpy(o, cur + (plan.y + r) * ROW + plan.x * 3, plan.w * 3);
+        break;
+      default:
+        break;
+    }
+    *p = o;
+    return payload;
+  }
+
+  int width_ = 0, height_ = 0;
+  int keyframe_interval_ = 0;
+  std::vector<uint8_t> recon_, next_;  // what the decoder has / will have
+  std::vector<uint8_t> luma_cur_, luma_ref_;
+  // Each block's vector: this frame's up to the block being coded, the
+  // frame before's from there on.
+  std::vector<Vector> vectors_;
+  uint16_t seq_ = 0;
+  uint64_t frames_ = 0;
+};
+
+class DeltaDecoder {
+ public:
+  // The frame `in` (`len` bytes) decodes to, as width x height rgb24.
+  // Until a key frame arrives, and after a frame was missed until the
+  // next one, that is the last frame decoded (black at first).
+  const uint8_t *Decode(const uint8_t *in, size_t len, int width,
+                        int height) {
+    using namespace delta_internal;
+    if (width != width_ || height != height_) {
+      width_ = width;
+      height_ = height;
+      ref_.assign((size_t)width * height * 3, 0);
+      out_.assign(ref_.size(), 0);
+      have_ref_ = false;
+    }
+    if (len < HEADER || width % BLOCK || height % BLOCK) return ref_.data();
+    const uint16_t seq = Get16(in), ref = Get16(in + 2);
+    if (have_ref_ && seq == seq_) return ref_.data();  // shown again
+    if (ref != seq && (!have_ref_ || ref != seq_)) {
+      if (have_ref_)
+        std::fprintf(stderr, "[delta] frame %u needs frame %u, have %u; "
+                     "waiting for a key frame\n", seq, ref, seq_);
+      have_ref_ = false;
+      return ref_.data();
+    }
+    if (!DecodeBlocks(in + HEADER, in + len, ref == seq)) {
+      std::fprintf(stderr, "[delta] malformed frame %u\n", seq);
+      have_ref_ = false;
+      return ref_.data();
+    }
+    std::swap(ref_, out_);
+    seq_ = seq;
+    have_ref_ = true;
+    return ref_.data();
+  }
+
+ private:
+  bool DecodeBlocks(const uint8_t *p, const uint8_t *end, bool key) {
+    using namespace delta_internal;
+    const size_t stride = (size_t)width_ * 3;
+    const int bw = width_ / BLOCK, bh = height_ / BLOCK;
+    uint8_t pred[BLOCK_BYTES];
+    for (int by = 0; by < bh; ++by) {
+      for (int bx = 0; bx < bw; ++bx) {
+        const int x0 = bx * BLOCK, y0 = by * BLOCK;
+        if (p >= end) return false;
+        const BlockMode mode = (BlockMode)*p++;
+        if (mode != RAW) {
+          if (key || mode > PATCH || end - p < 2) return false;
+          Fetch(ref_.data(), width_, height_, x0 + (int8_t)p[0],
+                y0 + (int8_t)p[1], pred);
+          p += 2;
+        }
+        ptrdiff_t bytes = 0;
+        if (mode == RAW) bytes = BLOCK_BYTES;
+        if (mode == RESIDUAL) bytes = BLOCK_BYTES / 2;
+        if (mode == PATCH) {
+          if (end - p < 2) return false;
+          const int x = p[0] >> 4, w = (p[0] & 15) + 1;
+          const int y = p[1] >> 4, h = (p[1] & 15) + 1;
+          if (x + w > BLOCK || y + h > BLOCK) return false;
+          bytes = 2 + w * h * 3;
+        }
+        if (end - p < bytes) return false;
+        Apply(mode, pred, p, &out_[(size_t)y0 * stride + (size_t)x0 * 3],
+              stride);
+        p += bytes;
+      }
+    }
+    return true;
+  }
+
+  int width_ = 0, height_ = 0;
+  std::vector<uint8_t> ref_, out_;
+  bool have_ref_ = false;
+  uint16_t seq_ = 0;
+};
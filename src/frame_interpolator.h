@@ -0,0 +1,231 @@
+// frame_interpolator.h
+// Frame-rate upconversion: shows frames in between the ones a slow source
+// sends (shader_daemon.py sends 30 fps), so motion looks smooth on a wall
+// that can swap faster.
+//
+// The interpolator keeps the last two frames, A and B. Render() at time t
+// returns the frame at phase w = (t - arrival of B) / source period between
+// them: A when B has just arrived, B one source period later, held after
+// that. So B reaches the wall in full one source frame after it arrived,
+// which bounds the added latency. The period is a running average of the
+// arrival intervals. After a stall the first frame is shown as is.
+//
+//   blend   out = A + w (B - A), per byte
+//   motion  the same blend, but each 16x16 block samples A and B along
+//           its own motion vector, so a moving edge slides instead of
+//           cross-fading. Vectors come from a symmetric block search on
+//           luma once per source frame: A at p - v and B at p + v for |v|
+//           up to 4 pixels, so up to 8 pixels of motion per frame. A block
+//           keeps v = 0 unless a vector is clearly better, and poor
+//           matches fall back to the plain blend.
+//
+// The blend and the block search are plain byte loops that GCC vectorizes
+// (16-bit multiplies for the blend, psadbw / NEON uabal for the sums of
+// absolute differences). Frames are rgb24, with width and height multiples
+// of 16.
+
+#pragma once
+
+#include "block_match.h"
+
+#include <time.h>
+
+#include <cstdint>
+#include <cstring>
+#include <utility>
+#include <vector>
+
+class FrameInterpolator {
+ public:
+  // "blend" or "motion"; false for anything else.
+  bool Configure(const char *mode, int width, int height) {
+    if (std::strcmp(mode, "blend") == 0) {
+      motion_ = false;
+    } else if (std::strcmp(mode, "motion") == 0) {
+      motion_ = true;
+    } else {
+      return false;
+    }
+    enabled_ = true;
+    width_ = width;
+    height_ = height;
+    const size_t bytes = (size_t)width * height * 3;
+    a_.assign(bytes, 0);
+    b_.assign(bytes, 0);
+    out_.assign(bytes, 0);
+    if (motion_) {
+      luma_a_.assign((size_t)width * height, 0);
+      luma_b_.assign((size_t)width * height, 0);
+      vectors_.assign((size_t)(width / BLOCK) * (height / BLOCK), Vector());
+    }
+    return true;
+  }
+
+  bool enabled() const { return enabled_; }
+  bool ready() const { return frames_ > 0; }
+  // The last Render() returned the newest frame as it is, so until the next
+  // Push() there is nothing new to draw.
+  bool settled() const { return settled_; }
+  double period_ms() const { return period_us_ / 1000.0; }
+
+  // A new source frame, arrived at now_us.
+  void Push(const uint8_t *frame, int64_t now_us) {
+    bool fresh = frames_ == 0;
+    if (!fresh) {
+      const int64_t interval = now_us - pushed_us_;
+      if (interval > STALL_US || (period_us_ && interval > 4 * period_us_))
+        fresh = true;  // don't fade in from a frame this old
+      else
+        period_us_ = period_us_ ? period_us_ + (interval - period_us_) / 8
+                                : interval;
+    }
+    std::swap(a_, b_);
+    std::memcpy(b_.data(), frame, b_.size());
+    if (motion_) {
+      std::swap(luma_a_, luma_b_);
+      LumaPlane(b_.data(), (size_t)width_ * height_, luma_b_.data());
+    }
+    paired_ = !fresh;
+    if (paired_ && motion_) EstimateMotion();
+    pushed_us_ = now_us;
+    frames_++;
+    settled_ = false;
+  }
+
+  // The frame to show at now_us; valid until the next Push() or Render().
+  const uint8_t *Render(int64_t now_us) {
+    int64_t w = paired_ && period_us_ ? (now_us - pushed_us_) * 256 / period_us_
+                                      : 256;
+    settled_ = w >= 256;
+    if (settled_) return b_.data();
+    if (w < 0) w = 0;
+    if (motion_)
+      MotionBlend((int)w);
+    else
+      BlendBytes(a_.data(), b_.data(), out_.data(), out_.size(), (int)w);
+    return out_.data();
+  }
+
+  // Time Push() and Render() of varied frames, in microseconds each.
+  void Measure(double *push_us, double *render_us) {
+    std::vector<uint8_t> f(a_.size());
+    for (size_t i = 0; i < f.size(); ++i)
+      f[i] = (uint8_t)(i * 2654435761u >> 13);
+    const int reps = 10;
+    timespec t0, t1, t2;
+    clock_gettime(CLOCK_MONOTONIC, &t0);
+    for (int k = 0; k < reps; ++k) Push(f.data(), k * 33333);
+    clock_gettime(CLOCK_MONOTONIC, &t1);
+    for (int k = 0; k < reps; ++k) Render((reps - 1) * 33333 + k * 3000);
+    clock_gettime(CLOCK_MONOTONIC, &t2);
+    *push_us = Micros(t0, t1) / reps;
+    *render_us = Micros(t1, t2) / reps;
+    frames_ = 0;
+    period_us_ = 0;
+    paired_ = false;
+    settled_ = false;
+  }
+
+ private:
+  static const int BLOCK = MATCH_BLOCK;
+  static const int RANGE = 4;            // |v| per axis, in pixels
+  static const int64_t STALL_US = 250000;
+  static const uint32_t POOR_MATCH = 24 * BLOCK * BLOCK;  // mean |diff| 24
+
+  struct Vector {
+    int8_t x = 0, y = 0;  // half the motion from A to B
+  };
+
+  static double Micros(const timespec &a, const timespec &b) {
+    return (b.tv_sec - a.tv_sec) * 1e6 + (b.tv_nsec - a.tv_nsec) / 1e3;
+  }
+
+  // out = (a (256 - w) + b w) / 256, rounded. The sum fits 16 bits, which
+  // lets the compiler use 16-bit lanes.
+  static void BlendBytes(const uint8_t *a, const uint8_t *b, uint8_t *out,
+                         size_t n, int w) {
+    const uint16_t wb = (uint16_t)w, wa = (uint16_t)(256 - w);
+    for (size_t i = 0; i < n; ++i)
+      out[i] = (uint8_t)((uint16_t)(a[i] * wa + b[i] * wb + 128) >> 8);
+  }
+
+  void EstimateMotion() {
+    const int bw = width_ / BLOCK, bh = height_ / BLOCK;
+    const uint8_t *la = luma_a_.data(), *lb = luma_b_.data();
+    for (int by = 0; by < bh; ++by) {
+      for (int bx = 0; bx < bw; ++bx) {
+        const int x0 = bx * BLOCK, y0 = by * BLOCK;
+        const size_t at = (size_t)y0 * width_ + x0;
+        const uint32_t still = BlockSad16(la + at, lb + at, width_);
+        uint32_t best = still;
+        Vector v;
+        for (int dy = -RANGE; dy <= RANGE; ++dy) {
+          const int ady = dy < 0 ? -dy : dy;
+          if (y0 - ady < 0 || y0 + BLOCK + ady > height_) continue;
+          for (int dx = -RANGE; dx <= RANGE; ++dx) {
+            const int adx = dx < 0 ? -dx : dx;
+            if ((dx == 0 && dy == 0) || x0 - adx < 0 ||
+                x0 + BLOCK + adx > width_) {
+              continue;
+            }
+            const uint32_t s =
+                BlockSad16(la + (size_t)(y0 - dy) * width_ + (x0 - dx),
+                           lb + (size_t)(y0 + dy) * width_ + (x0 + dx),
+                           width_);
+            if (s < best) {
+              best = s;
+              v.x = (int8_t)dx;
+              v.y = (int8_t)dy;
+            }
+          }
+        }
+        // Moving needs to beat standing still clearly, and a poor match is
+        // better cross-faded than dragged along.
+        if (best > still * 7 / 8 || best > POOR_MATCH) v = Vector();
+        vectors_[(size_t)by * bw + bx] = v;
+      }
+    }
+  }
+
+  // Blend with every block's samples moved along its vector: the motion
+  // from A to B is 2v, so at phase w A is sampled at p - w 2v and B at
+  // p + (1 - w) 2v. Sources are clamped to the frame.
+  void MotionBlend(int w) {
+    const int bw = width_ / BLOCK, bh = height_ / BLOCK;
+    const size_t stride = (size_t)width_ * 3;
+    for (int by = 0; by < bh; ++by) {
+      for (int bx = 0; bx < bw; ++bx) {
+        const Vector v = vectors_[(size_t)by * bw + bx];
+        const int x0 = bx * BLOCK, y0 = by * BLOCK;
+        const int ax = -Scale(2 * v.x, w), ay = -Scale(2 * v.y, w);
+        const int xa = Clamp(x0 + ax, width_ - BLOCK);
+        const int ya = Clamp(y0 + ay, height_ - BLOCK);
+        const int xb = Clamp(x0 + 2 * v.x + ax, width_ - BLOCK);
+        const int yb = Clamp(y0 + 2 * v.y + ay, height_ - BLOCK);
+        for (int y = 0; y < BLOCK; ++y) {
+          BlendBytes(&a_[(ya + y) * stride + xa * 3],
+                     &b_[(yb + y) * stride + xb * 3],
+                     &out_[(y0 + y) * stride + x0 * 3], BLOCK * 3, w);
+        }
+      }
+    }
+  }
+
+  // d * w / 256, rounded half away from zero.
+  static int Scale(int d, int w) {
+    return d < 0 ? -((-d * w + 128) >> 8) : (d * w + 128) >> 8;
+  }
+  static int Clamp(int v, int hi) { return v < 0 ? 0 : v > hi ? hi : v; }
+
+  bool enabled_ = false;
+  bool motion_ = false;
+  int width_ = 0, height_ = 0;
+  std::vector<uint8_t> a_, b_, out_;
+  std::vector<uint8_t> luma_a_, luma_b_;
+  std::vector<Vector> vectors_;
+  uint64_t frames_ = 0;
+  bool paired_ = false;  // A and B are consecutive frames
+  bool settled_ = false;
+  int64_t pushed_us_ = 0;
+  int64_t period_us_ = 0;
+};
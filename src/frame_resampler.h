@@ -0,0 +1,141 @@
+// frame_resampler.h
+// Scales rgb24 frames of any size to the wall, one output row at a time, so
+// the draw loop can take resampled rows where it would take frame rows and
+// no scaled copy of the frame is ever made.
+//
+// Each axis gets a table of source indexes and 8-bit weights per output
+// pixel, built once per source size:
+//   smaller output  area average: every source pixel counts by how much of
+//                   the output pixel it covers (128x96 -> 64x48 is a 2x2
+//                   box, 512x384 -> 256x192 too)
+//   larger output   bilinear between the two nearest source pixels, centres
+//                   aligned, edges clamped
+//   same size       one tap of weight 1
+// Row() first adds the source rows of the output row into a 16-bit row
+// (weights sum to 256, so 255 * 256 still fits). That pass reads every
+// source byte and is a plain multiply-add loop over the row, which GCC
+// vectorizes. Then each output pixel sums its few taps of that row.
+
+#pragma once
+
+#include <cmath>
+#include <cstdint>
+#include <utility>
+#include <vector>
+
+class FrameResampler {
+ public:
+  // Scale src_w x src_h onto dst_w x dst_h. Cheap when the sizes are the
+  // ones of the last call.
+  void Configure(int src_w, int src_h, int dst_w, int dst_h) {
+    if (src_w == src_w_ && src_h == src_h_ && dst_w == dst_w_ &&
+        dst_h == dst_h_) {
+      return;
+    }
+    src_w_ = src_w;
+    src_h_ = src_h;
+    dst_w_ = dst_w;
+    dst_h_ = dst_h;
+    BuildAxis(src_w, dst_w, &cols_);
+    BuildAxis(src_h, dst_h, &rows_);
+    acc_.assign((size_t)src_w * 3, 0);
+  }
+
+  // Output row y (in the frame's own row order) of `frame`, as dst_w rgb24
+  // pixels into `out`. `pitch`: bytes from one source row to the next, if
+  // the frame is cut from a wider one.
+  void Row(const uint8_t *frame, int y, uint8_t *out, size_t pitch = 0) {
+    const size_t stride = (size_t)src_w_ * 3;
+    if (pitch == 0) pitch = stride;
+    uint16_t *acc = acc_.data();
+    const int *vi = &rows_.index[(size_t)y * rows_.taps];
+    const uint16_t *vw = &rows_.weight[(size_t)y * rows_.taps];
+    {
+      const uint8_t *src = frame + vi[0] * pitch;
+      const uint16_t w = vw[0];
+      for (size_t i = 0; i < stride; ++i) acc[i] = (uint16_t)(src[i] * w);
+    }
+    for (int k = 1; k < rows_.taps; ++k) {
+      const uint16_t w = vw[k];
+      if (w == 0) continue;
+      const uint8_t *src = frame + vi[k] * pitch;
+      for (size_t i = 0; i < stride; ++i)
+        acc[i] = (uint16_t)(acc[i] + src[i] * w);
+    }
+
+    Horizontal(acc, cols_.index.data(), cols_.weight.data(), cols_.taps,
+               dst_w_, out);
+  }
+
+ private:
+  // Every output pixel has `taps` entries; unused ones have weight 0.
+  struct Axis {
+    int taps = 0;
+    std::vector<int> index;
+    std::vector<uint16_t> weight;  // each output's sum to 256
+  };
+
+  // Sum the taps of every output pixel from the accumulated row. A gather,
+  // so scalar; it is most of the time of Row().
+  static void Horizontal(const uint16_t *acc, const int *hi,
+                         const uint16_t *hw, int taps, int count,
+                         uint8_t *out) {
+    for (int x = 0; x < count; ++x, hi += taps, hw += taps, out += 3) {
+      uint32_t r = 1 << 15, g = 1 << 15, b = 1 << 15;
+      for (int k = 0; k < taps; ++k) {
+        const uint16_t *p = acc + hi[k] * 3;
+        r += (uint32_t)hw[k] * p[0];
+        g += (uint32_t)hw[k] * p[1];
+        b += (uint32_t)hw[k] * p[2];
+      }
+      out[0] = (uint8_t)(r >> 16);
+      out[1] = (uint8_t)(g >> 16);
+      out[2] = (uint8_t)(b >> 16);
+    }
+  }
+
+  static void BuildAxis(int n, int m, Axis *axis) {
+    const double s = (double)n / m;  // source pixels per output pixel
+    std::vector<std::vector<std::pair<int, double>>> taps(m);
+    for (int i = 0; i < m; ++i) {
+      if (m < n) {
+        const double lo = i * s, hi = (i + 1) * s;
+        for (int j = (int)lo; j < hi && j < n; ++j) {
+          const double cover = std::fmin(hi, j + 1) - std::fmax(lo, j);
+          if (cover > 1e-9) taps[i].push_back({j, cover / s});
+        }
+      } else {
+        double x = (i + 0.5) * s - 0.5;
+        x = x < 0 ? 0 : x > n - 1 ? n - 1 : x;
+        const int j = (int)x;
+        const double f = x - j;
+        taps[i].push_back({j, 1 - f});
+        if (f > 1e-9) taps[i].push_back({j + 1, f});
+      }
+    }
+
+    axis->taps = 0;
+    for (const auto &t : taps)
+      if ((int)t.size() > axis->taps) axis->taps = (int)t.size();
+    axis->index.assign((size_t)m * axis->taps, 0);
+    axis->weight.assign((size_t)m * axis->taps, 0);
+    for (int i = 0; i < m; ++i) {
+      int *index = &axis->index[(size_t)i * axis->taps];
+      uint16_t *weight = &axis->weight[(size_t)i * axis->taps];
+      int sum = 0, biggest = 0;
+      for (size_t k = 0; k < taps[i].size(); ++k) {
+        index[k] = taps[i][k].first;
+        weight[k] = (uint16_t)std::lround(taps[i][k].second * 256);
+        sum += weight[k];
+        if (weight[k] > weight[biggest]) biggest = (int)k;
+      }
+      weight[biggest] = (uint16_t)(weight[biggest] + 256 - sum);
+      for (int k = (int)taps[i].size(); k < axis->taps; ++k)
+        index[k] = index[0];  // weight 0, but a valid row to read
+    }
+  }
+
+  int src_w_ = 0, src_h_ = 0, dst_w_ = 0, dst_h_ = 0;
+  Axis cols_, rows_;
+  std::vector<uint16_t> acc_;  // the current output row, 8.8 fixed point
+};
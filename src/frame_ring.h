@@ -0,0 +1,97 @@
+// frame_ring.h
+// Bounded FIFO of frame buffers between one producer thread and the thread
+// that owns the matrix.
+//
+// Unlike the mailbox (latest frame wins) nothing is dropped here: a full
+// ring blocks the producer, which is what a video source wants, since the
+// backpressure reaches the pipe and the program writing it. Slots are page
+// aligned in one anonymous mapping and filled in place, so a frame is
+// written once by read() and read once by the drawing code.
+
+#pragma once
+
+#include <sys/mman.h>
+
+#include <chrono>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+
+class FrameRing {
+ public:
+  FrameRing(size_t slots, size_t frame_bytes) : slots_(slots) {
+    const size_t page = 4096;
+    stride_ = (frame_bytes + page - 1) / page * page;
+    void *p = mmap(nullptr, stride_ * slots_, PROT_READ | PROT_WRITE,
+                   MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    base_ = p == MAP_FAILED ? nullptr : (uint8_t *)p;
+  }
+  ~FrameRing() {
+    if (base_) munmap(base_, stride_ * slots_);
+  }
+  bool ok() const { return base_ != nullptr; }
+
+  // Producer: the slot to fill next, waiting for one to free up. nullptr
+  // once the ring is closed.
+  uint8_t *BeginWrite() {
+    std::unique_lock<std::mutex> lock(mu_);
+    cv_.wait(lock, [this] { return closed_ || count_ < slots_; });
+    if (closed_) return nullptr;
+    return base_ + ((head_ + count_) % slots_) * stride_;
+  }
+  void EndWrite() {
+    {
+      std::lock_guard<std::mutex> lock(mu_);
+      count_++;
+    }
+    cv_.notify_all();
+  }
+
+  // Consumer: the oldest frame, waiting up to timeout_ms for one. nullptr
+  // on timeout, or when the ring is closed and drained.
+  const uint8_t *BeginRead(int timeout_ms) {
+    std::unique_lock<std::mutex> lock(mu_);
+    cv_.wait_for(lock, std::chrono::milliseconds(timeout_ms),
+                 [this] { return closed_ || count_ > 0; });
+    if (count_ == 0) return nullptr;
+    return base_ + head_ * stride_;
+  }
+  void EndRead() {
+    {
+      std::lock_guard<std::mutex> lock(mu_);
+      head_ = (head_ + 1) % slots_;
+      count_--;
+    }
+    cv_.notify_all();
+  }
+
+  // No more frames will come (producer) or be taken (consumer).
+  void Close() {
+    {
+      std::lock_guard<std::mutex> lock(mu_);
+      closed_ = true;
+    }
+    cv_.notify_all();
+  }
+
+  bool drained() {
+    std::lock_guard<std::mutex> lock(mu_);
+    return closed_ && count_ == 0;
+  }
+  size_t depth() {
+    std::lock_guard<std::mutex> lock(mu_);
+    return count_;
+  }
+
+ private:
+  const size_t slots_;
+  size_t stride_ = 0;
+  uint8_t *base_ = nullptr;
+
+  std::mutex mu_;
+  std::condition_variable cv_;
+  size_t head_ = 0;   // oldest full slot
+  size_t count_ = 0;  // full slots
+  bool closed_ = false;
+};
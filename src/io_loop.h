@@ -0,0 +1,583 @@
+// io_loop.h
+// Single-threaded event loop for the ingest paths: UDP sockets, a TCP
+// listener, TCP client streams, plain "fd is readable" callbacks and a
+// periodic tick.
+//
+// Two backends:
+//   - io_uring: multishot recvmsg / accept / recv that draw from a provided
+//     buffer ring (and multishot poll for readable callbacks), so one armed
+//     request keeps delivering packets and each loop iteration is a single
+//     io_uring_enter() no matter how many packets arrived. Needs 6.0+.
+//   - epoll: the fallback on older kernels (or when io_uring is blocked);
+//     drains each ready socket with non-blocking recvmsg until EAGAIN.
+//
+// Callbacks run on the thread that calls Run().
+
+#pragma once
+
+#include "mono_clock.h"
+
+#include <netinet/in.h>
+#include <netinet/udp.h>
+#include <poll.h>
+#include <sys/epoll.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/syscall.h>
+#include <sys/utsname.h>
+#include <time.h>
+#include <unistd.h>
+
+#if __has_include(<linux/io_uring.h>)
+#include <linux/io_uring.h>
+#endif
+
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <functional>
+#include <memory>
+#include <vector>
+
+#ifndef UDP_GRO
+#define UDP_GRO 104  // linux/udp.h, kernel >= 5.0
+#endif
+
+// Datagram: payload, source, GRO segment size (0 if not coalesced),
+// truncated flag.
+typedef std::function<void(const uint8_t *, size_t, const sockaddr_in &,
+                           int, bool)> DatagramFn;
+// A new TCP client fd (blocking mode is left to the callee).
+typedef std::function<void(int)> AcceptFn;
+// Bytes from a TCP stream; len == 0 means the peer closed (fd is closed by
+// the loop afterwards).
+typedef std::function<void(int, const uint8_t *, size_t)> StreamFn;
+// The fd is readable; the callee reads it itself (until EAGAIN).
+typedef std::function<void()> ReadableFn;
+typedef std::function<void()> TickFn;
+
+class IoLoop {
+ public:
+  virtual ~IoLoop() {}
+  virtual const char *name() const = 0;
+  virtual bool AddDatagramSocket(int fd, DatagramFn fn) = 0;
+  virtual bool AddListener(int fd, AcceptFn fn) = 0;
+  virtual bool AddStream(int fd, StreamFn fn) = 0;
+  virtual bool AddReadable(int fd, ReadableFn fn) = 0;
+  // Stop watching a readable fd (e.g. at EOF); the caller closes it. Safe
+  // to call from the fd's own callback.
+  virtual void Remove(int fd) = 0;
+  // The tick runs after every wakeup and at least every `ms` milliseconds
+  // (also how often `stop` is checked); timers must check the clock.
+  void SetTick(int ms, TickFn fn) { tick_ms_ = ms; tick_ = fn; }
+  virtual void Run(volatile bool *stop) = 0;
+
+  // "uring" tries io_uring first and falls back to epoll.
+  static std::unique_ptr<IoLoop> Create(const char *backend);
+
+ protected:
+  int tick_ms_ = 200;
+  TickFn tick_;
+};
+
+static const size_t IO_LOOP_BUF_SIZE = 65536 + 512;  // a full GRO batch + meta
+
+// Parse the GRO segment size out of a control buffer.
+static inline int GroSegmentSize(msghdr *msg) {
+  for (cmsghdr *c = CMSG_FIRSTHDR(msg); c; c = CMSG_NXTHDR(msg, c)) {
+    if (c->cmsg_level == SOL_UDP && c->cmsg_type == UDP_GRO) {
+      int gso_size;
+      std::memcpy(&gso_size, CMSG_DATA(c), sizeof(gso_size));
+      return gso_size;
+    }
+  }
+  return 0;
+}
+
+// --- epoll ----------------------------------------------------------------
+
+class EpollLoop : public IoLoop {
+ public:
+  EpollLoop() : epfd_(epoll_create1(EPOLL_CLOEXEC)), buf_(IO_LOOP_BUF_SIZE) {}
+  ~EpollLoop() override { if (epfd_ >= 0) close(epfd_); }
+
+  const char *name() const override { return "epoll"; }
+
+  bool AddDatagramSocket(int fd, DatagramFn fn) override {
+    return Add(fd, Handler{KIND_DGRAM, fn, nullptr, nullptr, nullptr});
+  }
+  bool AddListener(int fd, AcceptFn fn) override {
+    return Add(fd, Handler{KIND_LISTEN, nullptr, fn, nullptr, nullptr});
+  }
+  bool AddStream(int fd, StreamFn fn) override {
+    return Add(fd, Handler{KIND_STREAM, nullptr, nullptr, fn, nullptr});
+  }
+  bool AddReadable(int fd, ReadableFn fn) override {
+    return Add(fd, Handler{KIND_READABLE, nullptr, nullptr, nullptr, fn});
+  }
+
+  void Remove(int fd) override {
+    if ((size_t)fd >= handlers_.size() || !handlers_[fd]) return;
+    epoll_ctl(epfd_, EPOLL_CTL_DEL, fd, nullptr);
+    // The handler may be running; free it after this round of events.
+    retired_.push_back(std::move(handlers_[fd]));
+  }
+
+  void Run(volatile bool *stop) override {
+    epoll_event events[32];
+    while (!*stop) {
+      int n = epoll_wait(epfd_, events, 32, tick_ms_);
+      for (int i = 0; i < n; ++i) Dispatch(events[i].data.fd);
+      retired_.clear();
+      if (tick_) tick_();
+    }
+  }
+
+ private:
+  enum Kind { KIND_DGRAM, KIND_LISTEN, KIND_STREAM, KIND_READABLE };
+  struct Handler {
+    Kind kind;
+    DatagramFn dgram;
+    AcceptFn accept;
+    StreamFn stream;
+    ReadableFn readable;
+  };
+
+  bool Add(int fd, Handler h) {
+    if ((size_t)fd >= handlers_.size()) handlers_.resize(fd + 1);
+    handlers_[fd].reset(new Handler(h));
+    epoll_event ev;
+    std::memset(&ev, 0, sizeof(ev));
+    ev.events = EPOLLIN;
+    ev.data.fd = fd;
+    return epoll_ctl(epfd_, EPOLL_CTL_ADD, fd, &ev) == 0;
+  }
+
+  void Dispatch(int fd) {
+    Handler *h = handlers_[fd].get();
+    if (!h) return;
+    switch (h->kind) {
+      case KIND_DGRAM:
+        for (;;) {
+          sockaddr_in from;
+          iovec iov = {buf_.data(), buf_.size()};
+          char cbuf[CMSG_SPACE(sizeof(int))];
+          msghdr msg;
+          std::memset(&msg, 0, sizeof(msg));
+          msg.msg_name = &from;
+          msg.msg_namelen = sizeof(from);
+          msg.msg_iov = &iov;
+          msg.msg_iovlen = 1;
+          msg.msg_control = cbuf;
+          msg.msg_controllen = sizeof(cbuf);
+          ssize_t r = recvmsg(fd, &msg, MSG_DONTWAIT);
+          if (r < 0) break;
+          h->dgram(buf_.data(), r, from, GroSegmentSize(&msg),
+                   (msg.msg_flags & MSG_TRUNC) != 0);
+        }
+        break;
+      case KIND_LISTEN: {
+        int client = accept4(fd, nullptr, nullptr, SOCK_CLOEXEC);
+        if (client >= 0) h->accept(client);
+        break;
+      }
+      case KIND_STREAM: {
+        ssize_t r = recv(fd, buf_.data(), buf_.size(), MSG_DONTWAIT);
+        if (r < 0 && (errno == EAGAIN || errno == EINTR)) break;
+        if (r <= 0) {
+          StreamFn fn = h->stream;
+          epoll_ctl(epfd_, EPOLL_CTL_DEL, fd, nullptr);
+          handlers_[fd].reset();
+          fn(fd, nullptr, 0);
+          close(fd);
+          break;
+        }
+        h->stream(fd, buf_.data(), r);
+        break;
+      }
+      case KIND_READABLE:
+        h->readable();
+        break;
+    }
+  }
+
+  int epfd_;
+  std::vector<uint8_t> buf_;
+  std::vector<std::unique_ptr<Handler>> handlers_;
+  std::vector<std::unique_ptr<Handler>> retired_;
+};
+
+// --- io_uring -------------------------------------------------------------
+
+#ifdef IORING_RECV_MULTISHOT
+
+class UringLoop : public IoLoop {
+ public:
+  ~UringLoop() override {
+    if (sq_ring_) munmap(sq_ring_, sq_ring_size_);
+    if (cq_ring_ && cq_ring_ != sq_ring_) munmap(cq_ring_, cq_ring_size_);
+    if (sqes_) munmap(sqes_, sqes_size_);
+    if (buf_ring_) munmap(buf_ring_, buf_ring_size_);
+    if (ring_fd_ >= 0) close(ring_fd_);
+  }
+
+  const char *name() const override { return "io_uring"; }
+
+  // Returns false (leaving the object unusable) if this kernel lacks what
+  // we need; the caller then falls back to epoll.
+  bool Init() {
+    utsname u;
+    int major = 0, minor = 0;
+    if (uname(&u) != 0 || std::sscanf(u.release, "%d.%d", &major, &minor) != 2
+        || major < 6) {
+      return false;  // multishot recv arrived in 6.0
+    }
+
+    io_uring_params p;
+    std::memset(&p, 0, sizeof(p));
+    p.flags = IORING_SETUP_SINGLE_ISSUER | IORING_SETUP_COOP_TASKRUN;
+    ring_fd_ = syscall(__NR_io_uring_setup, 256, &p);
+    if (ring_fd_ < 0) {
+      std::memset(&p, 0, sizeof(p));
+      ring_fd_ = syscall(__NR_io_uring_setup, 256, &p);
+    }
+    if (ring_fd_ < 0)
+      return false;
+
+    sq_ring_size_ = p.sq_off.array + p.sq_entries * sizeof(uint32_t);
+    cq_ring_size_ = p.cq_off.cqes + p.cq_entries * sizeof(io_uring_cqe);
+    if (p.features & IORING_FEAT_SINGLE_MMAP)
+      sq_ring_size_ = cq_ring_size_ = std::max(sq_ring_size_, cq_ring_size_);
+    sq_ring_ = (uint8_t *)mmap(nullptr, sq_ring_size_, PROT_READ | PROT_WRITE,
+                               MAP_SHARED | MAP_POPULATE, ring_fd_,
+                               IORING_OFF_SQ_RING);
+    if (sq_ring_ == MAP_FAILED) { sq_ring_ = nullptr; return false; }
+    if (p.features & IORING_FEAT_SINGLE_MMAP) {
+      cq_ring_ = sq_ring_;
+    } else {
+      cq_ring_ = (uint8_t *)mmap(nullptr, cq_ring_size_,
+                                 PROT_READ | PROT_WRITE,
+                                 MAP_SHARED | MAP_POPULATE, ring_fd_,
+                                 IORING_OFF_CQ_RING);
+      if (cq_ring_ == MAP_FAILED) { cq_ring_ = nullptr; return false; }
+    }
+    sqes_size_ = p.sq_entries * sizeof(io_uring_sqe);
+    sqes_ = (io_uring_sqe *)mmap(nullptr, sqes_size_, PROT_READ | PROT_WRITE,
+                                 MAP_SHARED | MAP_POPULATE, ring_fd_,
+                                 IORING_OFF_SQES);
+    if (sqes_ == MAP_FAILED) { sqes_ = nullptr; return false; }
+
+    sq_head_  = (std::atomic<uint32_t> *)(sq_ring_ + p.sq_off.head);
+    sq_tail_  = (std::atomic<uint32_t> *)(sq_ring_ + p.sq_off.tail);
+    sq_mask_  = *(uint32_t *)(sq_ring_ + p.sq_off.ring_mask);
+    sq_array_ = (uint32_t *)(sq_ring_ + p.sq_off.array);
+    cq_head_  = (std::atomic<uint32_t> *)(cq_ring_ + p.cq_off.head);
+    cq_tail_  = (std::atomic<uint32_t> *)(cq_ring_ + p.cq_off.tail);
+    cq_mask_  = *(uint32_t *)(cq_ring_ + p.cq_off.ring_mask);
+    cqes_     = (io_uring_cqe *)(cq_ring_ + p.cq_off.cqes);
+    sq_entries_ = p.sq_entries;
+    if (!(p.features & IORING_FEAT_EXT_ARG))
+      return false;  // need the wait timeout for our tick
+
+    return SetupBufferRing();
+  }
+
+  bool AddDatagramSocket(int fd, DatagramFn fn) override {
+    Handler *h = NewHandler(KIND_DGRAM, fd);
+    h->dgram = fn;
+    std::memset(&h->msg, 0, sizeof(h->msg));
+    h->msg.msg_namelen = sizeof(sockaddr_in);
+    h->msg.msg_controllen = CMSG_SPACE(sizeof(int));
+    ArmRecv(h);
+    return true;
+  }
+
+  bool AddListener(int fd, AcceptFn fn) override {
+    Handler *h = NewHandler(KIND_LISTEN, fd);
+    h->accept = fn;
+    ArmRecv(h);
+    return true;
+  }
+
+  bool AddStream(int fd, StreamFn fn) override {
+    Handler *h = NewHandler(KIND_STREAM, fd);
+    h->stream = fn;
+    ArmRecv(h);
+    return true;
+  }
+
+  bool AddReadable(int fd, ReadableFn fn) override {
+    Handler *h = NewHandler(KIND_READABLE, fd);
+    h->readable = fn;
+    ArmRecv(h);
+    return true;
+  }
+
+  void Remove(int fd) override {
+    for (auto &h : handlers_) {
+      if (h->fd != fd || h->closed)
+        continue;
+      // Cancel the armed poll; the slot is reused once its last CQE is in.
+      h->closed = true;
+      h->draining = true;
+      io_uring_sqe *sqe = GetSqe();
+      sqe->opcode = IORING_OP_ASYNC_CANCEL;
+      sqe->addr = (uint64_t)(uintptr_t)h.get();
+      sqe->user_data = 0;
+    }
+  }
+
+  void Run(volatile bool *stop) override {
+    while (!*stop) {
+      uint32_t to_submit = pending_submit_;
+      pending_submit_ = 0;
+      __kernel_timespec ts = {tick_ms_ / 1000, (tick_ms_ % 1000) * 1000000ll};
+      io_uring_getevents_arg arg;
+      std::memset(&arg, 0, sizeof(arg));
+      arg.ts = (uint64_t)(uintptr_t)&ts;
+      int r = syscall(__NR_io_uring_enter, ring_fd_, to_submit, 1,
+                      IORING_ENTER_GETEVENTS | IORING_ENTER_EXT_ARG,
+                      &arg, sizeof(arg));
+      if (r < 0 && errno != EINTR && errno != ETIME) {
+        perror("io_uring_enter");
+        return;
+      }
+      ReapCompletions();
+      if (tick_) tick_();
+    }
+  }
+
+ private:
+  enum Kind { KIND_DGRAM, KIND_LISTEN, KIND_STREAM, KIND_READABLE };
+  struct Handler {
+    Kind kind;
+    int fd;
+    bool closed = false;
+    bool draining = false;  // removed, final CQE still to come
+    DatagramFn dgram;
+    AcceptFn accept;
+    StreamFn stream;
+    ReadableFn readable;
+    msghdr msg;  // template for multishot recvmsg (sizes only)
+  };
+
+  static const unsigned BUF_COUNT = 64;  // power of two
+  static const uint16_t BUF_GROUP = 0;
+
+  Handler *NewHandler(Kind kind, int fd) {
+    Handler *h = nullptr;
+    for (auto &old : handlers_) {
+      // A closed stream's multishot recv has ended, so its slot is free.
+      if (old->closed && !old->draining) { h = old.get(); break; }
+    }
+    if (!h) {
+      handlers_.emplace_back(new Handler());
+      h = handlers_.back().get();
+    }
+    *h = Handler();
+    h->kind = kind;
+    h->fd = fd;
+    return h;
+  }
+
+  bool SetupBufferRing() {
+    buf_ring_size_ = BUF_COUNT * sizeof(io_uring_buf);
+    buf_ring_ = (io_uring_buf_ring *)mmap(nullptr, buf_ring_size_,
+                                          PROT_READ | PROT_WRITE,
+                                          MAP_ANONYMOUS | MAP_PRIVATE, -1, 0);
+    if (buf_ring_ == MAP_FAILED) { buf_ring_ = nullptr; return false; }
+
+    io_uring_buf_reg reg;
+    std::memset(&reg, 0, sizeof(reg));
+    reg.ring_addr = (uint64_t)(uintptr_t)buf_ring_;
+    reg.ring_entries = BUF_COUNT;
+    reg.bgid = BUF_GROUP;
+    if (syscall(__NR_io_uring_register, ring_fd_, IORING_REGISTER_PBUF_RING,
+                &reg, 1) < 0) {
+      return false;
+    }
+
+    buffers_.resize((size_t)BUF_COUNT * IO_LOOP_BUF_SIZE);
+    for (unsigned i = 0; i < BUF_COUNT; ++i) RecycleBuffer(i);
+    PublishBuffers();
+    return true;
+  }
+
+  void RecycleBuffer(uint16_t bid) {
+    // Index the ring as a plain array: in C++ the header's flexible `bufs`
+    // member lands at offset 8 instead of overlaying the tail.
+    io_uring_buf *b = reinterpret_cast<io_uring_buf *>(buf_ring_) +
+                      (buf_tail_ & (BUF_COUNT - 1));
+    b->addr = (uint64_t)(uintptr_t)&buffers_[(size_t)bid * IO_LOOP_BUF_SIZE];
+    b->len = IO_LOOP_BUF_SIZE;
+    b->bid = bid;
+    buf_tail_++;
+  }
+
+  void PublishBuffers() {
+    __atomic_store_n(&buf_ring_->tail, buf_tail_, __ATOMIC_RELEASE);
+  }
+
+  io_uring_sqe *GetSqe() {
+    uint32_t tail = sq_tail_->load(std::memory_order_relaxed);
+    uint32_t head = sq_head_->load(std::memory_order_acquire);
+    if (tail - head >= sq_entries_) {
+      // Ring full: flush what we have.
+      syscall(__NR_io_uring_enter, ring_fd_, pending_submit_, 0, 0, nullptr, 0);
+      pending_submit_ = 0;
+    }
+    uint32_t idx = tail & sq_mask_;
+    io_uring_sqe *sqe = &sqes_[idx];
+    std::memset(sqe, 0, sizeof(*sqe));
+    sq_array_[idx] = idx;
+    sq_tail_->store(tail + 1, std::memory_order_release);
+    pending_submit_++;
+    return sqe;
+  }
+
+  // (Re)arm the multishot request for a handler.
+  void ArmRecv(Handler *h) {
+    io_uring_sqe *sqe = GetSqe();
+    sqe->fd = h->fd;
+    sqe->user_data = (uint64_t)(uintptr_t)h;
+    switch (h->kind) {
+      case KIND_DGRAM:
+        sqe->opcode = IORING_OP_RECVMSG;
+        sqe->addr = (uint64_t)(uintptr_t)&h->msg;
+        sqe->ioprio = IORING_RECV_MULTISHOT;
+        sqe->flags = IOSQE_BUFFER_SELECT;
+        sqe->buf_group = BUF_GROUP;
+        break;
+      case KIND_LISTEN:
+        sqe->opcode = IORING_OP_ACCEPT;
+        sqe->ioprio = IORING_ACCEPT_MULTISHOT;
+        sqe->accept_flags = SOCK_CLOEXEC;
+        break;
+      case KIND_STREAM:
+        sqe->opcode = IORING_OP_RECV;
+        sqe->ioprio = IORING_RECV_MULTISHOT;
+        sqe->flags = IOSQE_BUFFER_SELECT;
+        sqe->buf_group = BUF_GROUP;
+        break;
+      case KIND_READABLE:
+        sqe->opcode = IORING_OP_POLL_ADD;
+        sqe->len = IORING_POLL_ADD_MULTI;
+        sqe->poll32_events = POLLIN;
+        break;
+    }
+  }
+
+  void ReapCompletions() {
+    uint32_t head = cq_head_->load(std::memory_order_relaxed);
+    uint32_t tail = cq_tail_->load(std::memory_order_acquire);
+    bool recycled = false;
+    for (; head != tail; ++head) {
+      const io_uring_cqe cqe = cqes_[head & cq_mask_];
+      // Hand the CQE slot back before running callbacks, which may arm
+      // new requests.
+      cq_head_->store(head + 1, std::memory_order_release);
+      Handler *h = (Handler *)(uintptr_t)cqe.user_data;
+      if (h && h->draining && !(cqe.flags & IORING_CQE_F_MORE))
+        h->draining = false;
+      if (!h || h->closed) continue;
+
+      const bool more = cqe.flags & IORING_CQE_F_MORE;
+      const bool has_buf = cqe.flags & IORING_CQE_F_BUFFER;
+      const uint16_t bid = cqe.flags >> IORING_CQE_BUFFER_SHIFT;
+      uint8_t *buf = has_buf ? &buffers_[(size_t)bid * IO_LOOP_BUF_SIZE]
+                             : nullptr;
+
+      switch (h->kind) {
+        case KIND_DGRAM:
+          if (cqe.res > 0 && buf) DeliverDatagram(h, buf, cqe.res);
+          break;
+        case KIND_LISTEN:
+          if (cqe.res >= 0) h->accept(cqe.res);
+          break;
+        case KIND_STREAM:
+          if (cqe.res > 0 && buf) {
+            h->stream(h->fd, buf, cqe.res);
+          } else if (cqe.res == 0 || (cqe.res < 0 && cqe.res != -ENOBUFS)) {
+            h->closed = true;
+            h->stream(h->fd, nullptr, 0);
+            close(h->fd);
+          }
+          break;
+        case KIND_READABLE:
+          if (cqe.res > 0) h->readable();
+          break;
+      }
+      if (has_buf) {
+        RecycleBuffer(bid);
+        recycled = true;
+      }
+      // A multishot request ends on errors such as running out of buffers;
+      // re-arm it (streams end for good at EOF).
+      if (!more && !h->closed)
+        ArmRecv(h);
+    }
+    if (recycled) PublishBuffers();
+  }
+
+  void DeliverDatagram(Handler *h, uint8_t *buf, int len) {
+    io_uring_recvmsg_out *out = (io_uring_recvmsg_out *)buf;
+    const size_t meta = sizeof(*out) + h->msg.msg_namelen +
+                        h->msg.msg_controllen;
+    if ((size_t)len < meta) return;
+
+    sockaddr_in from;
+    std::memset(&from, 0, sizeof(from));
+    std::memcpy(&from, buf + sizeof(*out),
+                std::min<size_t>(out->namelen, sizeof(from)));
+
+    msghdr cm;
+    std::memset(&cm, 0, sizeof(cm));
+    cm.msg_control = buf + sizeof(*out) + h->msg.msg_namelen;
+    cm.msg_controllen = out->controllen;
+    const int gso = GroSegmentSize(&cm);
+
+    const size_t payload = len - meta;
+    const bool truncated = (out->flags & MSG_TRUNC) ||
+                           out->payloadlen > payload;
+    h->dgram(buf + meta, payload, from, gso, truncated);
+  }
+
+  int ring_fd_ = -1;
+  uint8_t *sq_ring_ = nullptr;
+  uint8_t *cq_ring_ = nullptr;
+  size_t sq_ring_size_ = 0, cq_ring_size_ = 0, sqes_size_ = 0;
+  io_uring_sqe *sqes_ = nullptr;
+  std::atomic<uint32_t> *sq_head_, *sq_tail_, *cq_head_, *cq_tail_;
+  uint32_t sq_mask_ = 0, cq_mask_ = 0, sq_entries_ = 0;
+  uint32_t *sq_array_ = nullptr;
+  io_uring_cqe *cqes_ = nullptr;
+  uint32_t pending_submit_ = 0;
+
+  io_uring_buf_ring *buf_ring_ = nullptr;
+  size_t buf_ring_size_ = 0;
+  uint16_t buf_tail_ = 0;
+  std::vector<uint8_t> buffers_;
+
+  std::vector<std::unique_ptr<Handler>> handlers_;
+};
+
+#endif  // IORING_RECV_MULTISHOT
+
+inline std::unique_ptr<IoLoop> IoLoop::Create(const char *backend) {
+#ifdef IORING_RECV_MULTISHOT
+  if (std::strcmp(backend, "uring") == 0) {
+    std::unique_ptr<UringLoop> loop(new UringLoop());
+    if (loop->Init())
+      return std::move(loop);
+    std::fprintf(stderr, "io_uring unavailable, falling back to epoll\n");
+  }
+#else
+  if (std::strcmp(backend, "uring") == 0)
+    std::fprintf(stderr, "built without io_uring, using epoll\n");
+#endif
+  return std::unique_ptr<IoLoop>(new EpollLoop());
+}
@@ -0,0 +1,240 @@
+// jitter_buffer.h
+// Hold completed frames and present each at its sender timestamp (PTS)
+// plus an adaptive delay, so network jitter does not become uneven motion.
+//
+// No clock sync is needed. The transit time (arrival - PTS) is the unknown
+// clock offset plus the network delay; its minimum over the recent window
+// is the offset plus the fastest path, and whatever a frame takes beyond
+// that is jitter. Frames are presented at PTS + min transit + target, where
+// the target follows a high percentile of the recent jitter: it rises as
+// soon as frames start arriving later and decays slowly once the network
+// calms down, clamped to [min, max].
+//
+// A frame that arrives after its presentation time is late and is either
+// dropped (motion stays even, content skips) or shown right away (nothing
+// is lost, motion stutters).
+//
+// Each frame may carry an opaque tag (matrix_daemon --ack uses it to tell
+// the client which frame was shown or skipped).
+//
+// Not thread safe; the thread that owns the matrix pushes and pops.
+
+#pragma once
+
+#include "cli_flags.h"
+
+#include <algorithm>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <deque>
+#include <functional>
+#include <vector>
+
+enum LatePolicy {
+  LATE_DROP,
+  LATE_SHOW,
+};
+
+struct JitterOptions {
+  bool enabled = false;
+  int64_t min_delay_us = 0;
+  int64_t max_delay_us = 100000;
+  LatePolicy late = LATE_DROP;
+  size_t capacity = 16;  // frames held at most
+};
+
+// --jitter-buffer, --jitter-min-ms, --jitter-max-ms and --late. Returns 1 if
+// `arg` was one of them, -1 if its value is bad, 0 if it is not ours.
+static inline int ParseJitterFlag(const char *arg, JitterOptions *opt) {
+  const char *v;
+  if (FlagSet(arg, "--jitter-buffer")) {
+    opt->enabled = true;
+  } else if ((v = FlagValue(arg, "--jitter-min-ms"))) {
+    opt->min_delay_us = std::atoi(v) * 1000ll;
+  } else if ((v = FlagValue(arg, "--jitter-max-ms"))) {
+    opt->max_delay_us = std::atoi(v) * 1000ll;
+  } else if ((v = FlagValue(arg, "--late"))) {
+    if (std::strcmp(v, "drop") == 0) {
+      opt->late = LATE_DROP;
+    } else if (std::strcmp(v, "show") == 0) {
+      opt->late = LATE_SHOW;
+    } else {
+      std::fprintf(stderr, "--late must be drop or show\n");
+      return -1;
+    }
+  } else {
+    return 0;
+  }
+  if (opt->min_delay_us < 0 || opt->max_delay_us < opt->min_delay_us) {
+    std::fprintf(stderr, "Need 0 <= --jitter-min-ms <= --jitter-max-ms\n");
+    return -1;
+  }
+  return 1;
+}
+
+class JitterBuffer {
+ public:
+  JitterBuffer(const JitterOptions &opt, size_t frame_bytes) : opt_(opt) {
+    free_.resize(opt.capacity);
+    for (std::vector<uint8_t> &f : free_) f.assign(frame_bytes, 0);
+    target_us_ = opt.min_delay_us;
+  }
+
+  // Called with the tag of every frame that is dropped instead of shown.
+  void SetDropCallback(std::function<void(uint64_t)> fn) { on_drop_ = fn; }
+
+  // Queue a frame that completed at arrival_us. The pixels are traded for
+  // a free buffer of the same size rather than copied.
+  void Push(std::vector<uint8_t> *pixels, uint64_t pts_us, int64_t arrival_us,
+            uint64_t tag = 0) {
+    if (have_shown_ && (int64_t)(pts_us - last_shown_pts_) <= 0 &&
+        (int64_t)(last_shown_pts_ - pts_us) < RESTART_US) {
+      stale_++;  // older than what is already on the wall
+      Dropped(tag);
+      return;
+    }
+    const int64_t transit = arrival_us - (int64_t)pts_us;
+    if (!transits_.empty() && std::llabs(transit - base_us_) > RESTART_US) {
+      Reset();  // sender restarted, or a different sender
+    }
+    UpdateDelay(transit);
+
+    Entry e;
+    e.pts = pts_us;
+    e.tag = tag;
+    if ((int64_t)pts_us + base_us_ + target_us_ < arrival_us) {
+      if (opt_.late == LATE_DROP) {
+        late_dropped_++;
+        Dropped(tag);
+        return;
+      }
+      late_shown_++;
+      e.show_now = true;
+    }
+    if (free_.empty()) {
+      // Far behind: the frame due soonest goes.
+      Dropped(queue_.front().tag);
+      free_.push_back(std::move(queue_.front().pixels));
+      queue_.pop_front();
+      overflow_++;
+    }
+    e.pixels = std::move(free_.back());
+    free_.pop_back();
+    e.pixels.swap(*pixels);
+
+    auto pos = queue_.end();
+    while (pos != queue_.begin() && (int64_t)((pos - 1)->pts - pts_us) > 0)
+      --pos;
+    queue_.insert(pos, std::move(e));
+  }
+
+  // Local time at which the next frame is due; false if nothing is queued.
+  bool Next(int64_t *present_us) const {
+    if (queue_.empty())
+      return false;
+    const Entry &e = queue_.front();
+    *present_us = e.show_now ? 0 : (int64_t)e.pts + base_us_ + target_us_;
+    return true;
+  }
+
+  // Take the next frame, trading it for the buffer in `*pixels`.
+  void Pop(std::vector<uint8_t> *pixels, uint64_t *tag = nullptr) {
+    Entry &e = queue_.front();
+    e.pixels.swap(*pixels);
+    if (tag) *tag = e.tag;
+    free_.push_back(std::move(e.pixels));
+    last_shown_pts_ = e.pts;
+    have_shown_ = true;
+    queue_.pop_front();
+    shown_++;
+  }
+
+  // How far off the actual swap was from the due time.
+  void RecordError(int64_t err_us) {
+    err_us = std::llabs(err_us);
+    sum_err_us_ += err_us;
+    max_err_us_ = std::max(max_err_us_, err_us);
+  }
+
+  int64_t delay_us() const { return target_us_; }
+  size_t depth() const { return queue_.size(); }
+
+  // One "[jitter]" line; counters restart after each report.
+  void Print(FILE *out) {
+    std::fprintf(out,
+                 "[jitter] delay=%.1fms depth=%zu shown=%llu late-dropped=%llu "
+                 "late-shown=%llu overflow=%llu stale=%llu err avg=%.0fus "
+                 "max=%lldus\n",
+                 target_us_ / 1000.0, queue_.size(),
+                 (unsigned long long)shown_, (unsigned long long)late_dropped_,
+                 (unsigned long long)late_shown_, (unsigned long long)overflow_,
+                 (unsigned long long)stale_,
+                 shown_ ? (double)sum_err_us_ / shown_ : 0.0,
+                 (long long)max_err_us_);
+    shown_ = late_dropped_ = late_shown_ = overflow_ = stale_ = 0;
+    sum_err_us_ = max_err_us_ = 0;
+  }
+
+ private:
+  static const size_t WINDOW = 128;              // frames of transit history
+  static const int64_t RESTART_US = 2000000;     // larger jumps start over
+  static const int64_t MARGIN_US = 1000;         // on top of the percentile
+  static const int DECAY = 64;                   // frames to close the gap
+
+  struct Entry {
+    std::vector<uint8_t> pixels;
+    uint64_t pts = 0;
+    uint64_t tag = 0;
+    bool show_now = false;
+  };
+
+  void Dropped(uint64_t tag) {
+    if (on_drop_) on_drop_(tag);
+  }
+
+  void Reset() {
+    transits_.clear();
+    for (Entry &e : queue_) {
+      Dropped(e.tag);
+      free_.push_back(std::move(e.pixels));
+    }
+    queue_.clear();
+    have_shown_ = false;
+    target_us_ = opt_.min_delay_us;
+  }
+
+  void UpdateDelay(int64_t transit) {
+    transits_.push_back(transit);
+    if (transits_.size() > WINDOW)
+      transits_.pop_front();
+    base_us_ = *std::min_element(transits_.begin(), transits_.end());
+
+    // 99th percentile of the jitter in the window.
+    scratch_.assign(transits_.begin(), transits_.end());
+    auto p99 = scratch_.begin() + (scratch_.size() * 99) / 100;
+    std::nth_element(scratch_.begin(), p99, scratch_.end());
+    int64_t want = *p99 - base_us_ + MARGIN_US;
+    want = std::min(std::max(want, opt_.min_delay_us), opt_.max_delay_us);
+    if (want > target_us_)
+      target_us_ = want;
+    else
+      target_us_ -= (target_us_ - want) / DECAY;
+  }
+
+  JitterOptions opt_;
+  std::function<void(uint64_t)> on_drop_;
+  std::deque<Entry> queue_;                  // by PTS
+  std::vector<std::vector<uint8_t>> free_;
+  std::deque<int64_t> transits_;
+  std::vector<int64_t> scratch_;
+  int64_t base_us_ = 0;
+  int64_t target_us_ = 0;
+  bool have_shown_ = false;
+  uint64_t last_shown_pts_ = 0;
+
+  uint64_t shown_ = 0, late_dropped_ = 0, late_shown_ = 0, overflow_ = 0;
+  uint64_t stale_ = 0;
+  int64_t sum_err_us_ = 0, max_err_us_ = 0;
+};
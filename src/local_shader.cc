@@ -1,8 +1,13 @@
 // local_shader.cc
 // Render simple fragment-style "shaders" locally on the Pi and send directly
 // to the rpi-rgb-led-matrix. No web server, no streaming.
+//
+// Shaders are rendered with 16 bits per channel and temporally dithered
+// down to the panel's PWM depth, so dark gradients don't band.
 
 #include "led-matrix.h"
+#include "local_shaders.h"
+#include "temporal_dither.h"
 
 #include <signal.h>
 #include <unistd.h>
@@ -21,60 +26,6 @@ static void InterruptHandler(int) {
 static const int WIDTH  = 256;  // 4 * 64
 static const int HEIGHT = 192;  // 3 * 64
 
-// Simple “shader” helpers
-
-static void rings_shader(int x, int y, float t, uint8_t &r, uint8_t &g, uint8_t &b) {
-  float u = (float)x / (WIDTH - 1);
-  float v = (float)y / (HEIGHT - 1);
-  // Centered coords
-  float px = (u - 0.5f) * 2.0f;
-  float py = (v - 0.5f) * 2.0f;
-
-  float d = std::sqrt(px * px + py * py);
-  float ring = 0.5f + 0.5f * std::cos(10.0f * d - t * 6.28318f);
-
-  float cr = ring;
-  float cg = 0.5f + 0.5f * std::sin(t + px * 4.0f);
-  float cb = 0.5f + 0.5f * std::sin(t + py * 4.0f);
-
-  // clamp
-  cr = std::fmin(std::fmax(cr, 0.0f), 1.0f);
-  cg = std::fmin(std::fmax(cg, 0.0f), 1.0f);
-  cb = std::fmin(std::fmax(cb, 0.0f), 1.0f);
-
-  r = (uint8_t)(cr * 255.0f);
-  g = (uint8_t)(cg * 255.0f);
-  b = (uint8_t)(cb * 255.0f);
-}
-
-static void plasma_shader(int x, int y, float t, uint8_t &r, uint8_t &g, uint8_t &b) {
-  float u = (float)x / (WIDTH - 1);
-  float v = (float)y / (HEIGHT - 1);
-
-  // map to [-1,1]
-  float px = (u - 0.5f) * 2.0f;
-  float py = (v - 0.5f) * 2.0f;
-
-  float val = 0.0f;
-  val += std::sin(px * 3.0f + t * 0.7f);
-  val += std::sin(py * 4.0f - t * 1.3f);
-  val += std::sin((px + py) * 5.0f + t * 0.5f);
-  val /= 3.0f;
-
-  float angle = 6.28318f * (val + 0.0f);
-  float cr = 0.5f + 0.5f * std::cos(angle);
-  float cg = 0.5f + 0.5f * std::cos(angle + 2.094f);   // +120°
-  float cb = 0.5f + 0.5f * std::cos(angle + 4.188f);   // +240°
-
-  cr = std::fmin(std::fmax(cr, 0.0f), 1.0f);
-  cg = std::fmin(std::fmax(cg, 0.0f), 1.0f);
-  cb = std::fmin(std::fmax(cb, 0.0f), 1.0f);
-
-  r = (uint8_t)(cr * 255.0f);
-  g = (uint8_t)(cg * 255.0f);
-  b = (uint8_t)(cb * 255.0f);
-}
-
 enum ShaderType {
   SHADER_RINGS,
   SHADER_PLASMA
@@ -112,6 +63,10 @@ int main(int argc, char *argv[]) {
 
   FrameCanvas *offscreen = matrix->CreateFrameCanvas();
 
+  TemporalDither dither;
+  dither.Configure(matrix->pwmbits(), matrix->brightness(),
+                   matrix->luminance_correct());
+
   signal(SIGTERM, InterruptHandler);
   signal(SIGINT,  InterruptHandler);
 
@@ -131,20 +86,17 @@ int main(int argc, char *argv[]) {
     float t = (now.tv_sec - start_tv.tv_sec) +
               (now.tv_usec - start_tv.tv_usec) / 1e6f;
 
+    LocalShaderFn fn = (shader == SHADER_RINGS) ? rings_shader : plasma_shader;
+    uint16_t deep[WIDTH * 3];
+    uint8_t row[WIDTH * 3];
     for (int y = 0; y < HEIGHT; ++y) {
+      RenderLocalShaderRow16(fn, t, y, deep);
+      dither.Quantize(deep, row, y, WIDTH);
       for (int x = 0; x < WIDTH; ++x) {
-        uint8_t r, g, b;
-        switch (shader) {
-          case SHADER_RINGS:
-            rings_shader(x, y, t, r, g, b);
-            break;
-          case SHADER_PLASMA:
-            plasma_shader(x, y, t, r, g, b);
-            break;
-        }
-        offscreen->SetPixel(x, y, r, g, b);
+        offscreen->SetPixel(x, y, row[3 * x], row[3 * x + 1], row[3 * x + 2]);
       }
     }
+    dither.NextFrame();
 
     offscreen = matrix->SwapOnVSync(offscreen);
 
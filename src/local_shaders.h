@@ -0,0 +1,98 @@
+// local_shaders.h
+// The CPU "shaders" of local_shader, shared with matrix_host. Each computes
+// one pixel of a 256x192 frame at time t (seconds), as 0..1 floats; the
+// Render functions turn those into rgb24 or 16 bits per channel.
+
+#pragma once
+
+#include <cmath>
+#include <cstdint>
+
+static const int SHADER_WIDTH  = 256;  // 4 * 64
+static const int SHADER_HEIGHT = 192;  // 3 * 64
+
+// Simple “shader” helpers
+
+static void rings_shader(int x, int y, float t, float &r, float &g, float &b) {
+  float u = (float)x / (SHADER_WIDTH - 1);
+  float v = (float)y / (SHADER_HEIGHT - 1);
+  // Centered coords
+  float px = (u - 0.5f) * 2.0f;
+  float py = (v - 0.5f) * 2.0f;
+
+  float d = std::sqrt(px * px + py * py);
+  float ring = 0.5f + 0.5f * std::cos(10.0f * d - t * 6.28318f);
+
+  float cr = ring;
+  float cg = 0.5f + 0.5f * std::sin(t + px * 4.0f);
+  float cb = 0.5f + 0.5f * std::sin(t + py * 4.0f);
+
+  // clamp
+  r = std::fmin(std::fmax(cr, 0.0f), 1.0f);
+  g = std::fmin(std::fmax(cg, 0.0f), 1.0f);
+  b = std::fmin(std::fmax(cb, 0.0f), 1.0f);
+}
+
+static void plasma_shader(int x, int y, float t, float &r, float &g, float &b) {
+  float u = (float)x / (SHADER_WIDTH - 1);
+  float v = (float)y / (SHADER_HEIGHT - 1);
+
+  // map to [-1,1]
+  float px = (u - 0.5f) * 2.0f;
+  float py = (v - 0.5f) * 2.0f;
+
+  float val = 0.0f;
+  val += std::sin(px * 3.0f + t * 0.7f);
+  val += std::sin(py * 4.0f - t * 1.3f);
+  val += std::sin((px + py) * 5.0f + t * 0.5f);
+  val /= 3.0f;
+
+  float angle = 6.28318f * (val + 0.0f);
+  float cr = 0.5f + 0.5f * std::cos(angle);
+  float cg = 0.5f + 0.5f * std::cos(angle + 2.094f);   // +120°
+  float cb = 0.5f + 0.5f * std::cos(angle + 4.188f);   // +240°
+
+  r = std::fmin(std::fmax(cr, 0.0f), 1.0f);
+  g = std::fmin(std::fmax(cg, 0.0f), 1.0f);
+  b = std::fmin(std::fmax(cb, 0.0f), 1.0f);
+}
+
+typedef void (*LocalShaderFn)(int x, int y, float t,
+                              float &r, float &g, float &b);
+
+struct LocalShader {
+  const char *name;
+  LocalShaderFn fn;
+};
+
+static const LocalShader LOCAL_SHADERS[] = {
+  {"rings", rings_shader},
+  {"plasma", plasma_shader},
+};
+
+// Render a whole frame into `rgb` (rgb24, top row first).
+static inline void RenderLocalShader(LocalShaderFn fn, float t, uint8_t *rgb) {
+  for (int y = 0; y < SHADER_HEIGHT; ++y) {
+    for (int x = 0; x < SHADER_WIDTH; ++x) {
+      float r, g, b;
+      fn(x, y, t, r, g, b);
+      rgb[0] = (uint8_t)(r * 255.0f);
+      rgb[1] = (uint8_t)(g * 255.0f);
+      rgb[2] = (uint8_t)(b * 255.0f);
+      rgb += 3;
+    }
+  }
+}
+
+// Render row y into `rgb` with 16 bits per channel, for TemporalDither.
+static inline void RenderLocalShaderRow16(LocalShaderFn fn, float t, int y,
+                                          uint16_t *rgb) {
+  for (int x = 0; x < SHADER_WIDTH; ++x) {
+    float r, g, b;
+    fn(x, y, t, r, g, b);
+    rgb[0] = (uint16_t)(r * 65535.0f + 0.5f);
+    rgb[1] = (uint16_t)(g * 65535.0f + 0.5f);
+    rgb[2] = (uint16_t)(b * 65535.0f + 0.5f);
+    rgb += 3;
+  }
+}
@@ -1,13 +1,36 @@
 #include "led-matrix.h"
+#include "adaptive_pwm.h"
+#include "cli_flags.h"
+#include "color_lut.h"
+#include "frame_interpolator.h"
+#include "frame_ring.h"
+#include "io_loop.h"
+#include "jitter_buffer.h"
+#include "panel_calibration.h"
+#include "pixel_format.h"
+#include "power_limit.h"
+#include "temporal_dither.h"
+#include "udp_frame_protocol.h"
 
 #include <arpa/inet.h>
+#include <fcntl.h>
 #include <netinet/in.h>
+#include <poll.h>
 #include <signal.h>
+#include <sys/mman.h>
+#include <sys/resource.h>
 #include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
 #include <unistd.h>
 
+#include <algorithm>
 #include <cstdio>
+#include <cstdlib>
 #include <cstring>
+#include <map>
+#include <thread>
+#include <vector>
 
 using rgb_matrix::RGBMatrix;
 using rgb_matrix::Canvas;
@@ -40,6 +63,575 @@ static bool ReadNBytes(int fd, uint8_t *buf, size_t n) {
   return true;
 }
 
+static ColorLut color_lut;  // --lut
+static PanelCalibration calibration;  // --calibration
+
+// --depth=16: frames carry 16 bits per channel (little endian) and are
+// dithered to the panel's PWM depth. Between frames the last one is shown
+// again with the next dither phase, every --dither-fps period, so a still
+// image averages out too.
+static int input_depth = 8;
+static TemporalDither dither;
+static std::vector<uint8_t> held_frame;  // last frame drawn, for repaints
+static int64_t held_drawn_us = 0;
+static int64_t repaint_period_us = 0;    // 0: only draw new frames
+
+static PowerLimiter power;  // --current-limit and --panel-current-limit
+static AdaptivePwm adaptive_pwm;  // --adaptive-pwm
+
+// --pixel-format: frames arrive in this layout and are converted to rgb24
+// once, before anything else looks at them.
+static PixelFormat input_format = PIXEL_RGB24;
+
+// --interpolate: new frames go into the interpolator, and what is drawn, on
+// arrival and on every repaint (--interpolate-fps), is its frame for that
+// moment. A frame is fully shown one source period after it arrived.
+static FrameInterpolator interpolator;
+
+// The stages in front of SetPixel for canvas row Y: dither, LUT and
+// calibration. Returns `in` if none is on, else `out`.
+static const uint8_t *GradeRow(const uint8_t *in, uint8_t *out, int Y) {
+  const uint8_t *row = in;
+  if (input_depth == 16) {
+    dither.Quantize((const uint16_t *)row, out, Y, LOGICAL_WIDTH);
+    row = out;
+  }
+  if (color_lut.enabled()) {
+    color_lut.Apply(row, out, LOGICAL_WIDTH);
+    row = out;
+  }
+  if (calibration.enabled()) {
+    calibration.Apply(row, out, Y, LOGICAL_WIDTH);
+    row = out;
+  }
+  return row;
+}
+
+// buffer: row-major, origin at bottom-left (WebGL); nullptr repaints the
+// held or the interpolated frame.
+static void DrawFlipped(FrameCanvas *offscreen, const uint8_t *buffer) {
+  const bool repaint = buffer == nullptr;
+  // The power limit has to see the whole graded frame before any of it is
+  // drawn, so then the rows are graded into `staged` first.
+  static uint8_t staged[LOGICAL_WIDTH * LOGICAL_HEIGHT * 3];
+  const uint8_t *rows[LOGICAL_HEIGHT];
+  uint8_t graded[LOGICAL_WIDTH * 3];
+  const size_t stride = (size_t)LOGICAL_WIDTH * 3 * (input_depth / 8);
+  if (!repaint && input_format != PIXEL_RGB24) {
+    static uint8_t converted[LOGICAL_WIDTH * LOGICAL_HEIGHT * 3];
+    ConvertToRgb24(input_format, buffer, LOGICAL_WIDTH, LOGICAL_HEIGHT,
+                   converted);
+    buffer = converted;
+  }
+  if (adaptive_pwm.enabled()) {
+    if (!repaint)  // a repaint is not new content
+      adaptive_pwm.Update(buffer, LOGICAL_WIDTH, LOGICAL_HEIGHT,
+                          input_depth / 8);
+    if (offscreen->pwmbits() != adaptive_pwm.bits())
+      offscreen->SetPWMBits(adaptive_pwm.bits());
+    if (input_depth == 16) dither.SetPwmBits(adaptive_pwm.bits());
+  }
+  if (interpolator.enabled()) {
+    const int64_t now = MonoMicros();
+    if (!repaint) interpolator.Push(buffer, now);
+    buffer = interpolator.Render(now);
+  } else if (repaint) {
+    buffer = held_frame.data();
+  }
+  if (power.enabled()) {
+    for (int y_buf = 0; y_buf < LOGICAL_HEIGHT; ++y_buf) {
+      int Y = LOGICAL_HEIGHT - 1 - y_buf;
+      rows[Y] = GradeRow(buffer + (size_t)y_buf * stride,
+                         staged + (size_t)Y * LOGICAL_WIDTH * 3, Y);
+      power.Measure(rows[Y], Y, LOGICAL_WIDTH);
+    }
+    power.Finish();
+  }
+  for (int y_buf = 0; y_buf < LOGICAL_HEIGHT; ++y_buf) {
+    int Y = LOGICAL_HEIGHT - 1 - y_buf;  // flip vertically
+    const uint8_t *row =
+        power.enabled() ? rows[Y]
+                        : GradeRow(buffer + (size_t)y_buf * stride, graded, Y);
+    if (power.active()) {
+      power.Apply(row, graded, Y, LOGICAL_WIDTH);
+      row = graded;
+    }
+    size_t idx = 0;
+    for (int X = 0; X < LOGICAL_WIDTH; ++X) {
+      uint8_t r = row[idx++];
+      uint8_t g = row[idx++];
+      uint8_t b = row[idx++];
+      offscreen->SetPixel(X, Y, r, g, b);
+    }
+  }
+  if (input_depth == 16) dither.NextFrame();
+  if (repaint_period_us) {
+    if (!repaint && !interpolator.enabled())
+      held_frame.assign(buffer, buffer + stride * LOGICAL_HEIGHT);
+    held_drawn_us = MonoMicros();
+  }
+}
+
+// Whether there is a frame to repaint: the one held for the dither, or one
+// the interpolator has not finished moving towards.
+static bool CanRepaint() {
+  if (interpolator.enabled())
+    return interpolator.ready() && !interpolator.settled();
+  return !held_frame.empty();
+}
+
+// Whether the held frame is due to be shown again with a new dither phase,
+// or the next interpolated frame is.
+static bool RepaintDue() {
+  return repaint_period_us && CanRepaint() &&
+         MonoMicros() - held_drawn_us >= repaint_period_us;
+}
+
+// Repaints are not new frames: they are not counted, timed or acked.
+static void RepaintHeld(RGBMatrix *matrix, FrameCanvas **offscreen) {
+  DrawFlipped(*offscreen, nullptr);
+  *offscreen = matrix->SwapOnVSync(*offscreen);
+}
+
+struct DaemonOptions {
+  const char *io_backend = "blocking";
+  JitterOptions jitter;
+  int stats_interval_s = 5;
+  bool ack = false;       // DisplayAck to the client after every swap
+  int max_in_flight = 0;  // frames the socket may buffer; 0 = kernel default
+  const char *unix_path = nullptr;  // SOCK_SEQPACKET listener
+  const char *input = nullptr;      // raw frames from a file, FIFO or "-"
+  double fps = 0;                   // --input pacing; 0 = as fast as shown
+};
+
+// --ack: after every swap the client learns how many of its frames have
+// been shown (or skipped), when, and how fast the wall takes frames, so it
+// can keep a frame or two in flight instead of filling the socket buffers.
+struct DisplayClock {
+  int64_t last_swap_us = 0;
+  int64_t period_us = 0;  // smoothed swap-to-swap interval
+  uint64_t swaps = 0;
+
+  void Swapped(int64_t now_us) {
+    swaps++;
+    const int64_t interval = now_us - last_swap_us;
+    if (last_swap_us != 0 && interval < 1000000)  // ignore idle gaps
+      period_us = period_us ? period_us + (interval - period_us) / 8 : interval;
+    last_swap_us = now_us;
+  }
+};
+
+static void SendAck(int fd, uint32_t seq, int64_t display_us,
+                    const DisplayClock &clock) {
+  DisplayAck a;
+  a.seq = seq;
+  a.display_us = display_us;
+  a.refresh_mhz = clock.period_us ? (uint32_t)(1000000000ll / clock.period_us)
+                                  : 0;
+  uint8_t buf[ACK_SIZE];
+  BuildAck(buf, a);
+  // Tiny and at most one per frame, so it never fills the send buffer.
+  send(fd, buf, ACK_SIZE, MSG_DONTWAIT | MSG_NOSIGNAL);
+}
+
+// Swap, then ack frame `seq` to `fd` if acks are on and fd is a client.
+static void SwapAndAck(RGBMatrix *matrix, FrameCanvas **offscreen,
+                       const DaemonOptions &opt, DisplayClock *clock, int fd,
+                       uint32_t seq) {
+  *offscreen = matrix->SwapOnVSync(*offscreen);
+  const int64_t now = MonoMicros();
+  clock->Swapped(now);
+  if (opt.ack && fd >= 0)
+    SendAck(fd, seq, now, *clock);
+}
+
+static void PrintCpuPerFrame(uint64_t frames) {
+  rusage ru;
+  getrusage(RUSAGE_SELF, &ru);
+  double cpu_ms = ru.ru_utime.tv_sec * 1e3 + ru.ru_utime.tv_usec / 1e3 +
+                  ru.ru_stime.tv_sec * 1e3 + ru.ru_stime.tv_usec / 1e3;
+  std::fprintf(stderr, "%llu frames shown, %.0f ms CPU (%.3f ms/frame)\n",
+               (unsigned long long)frames, cpu_ms,
+               frames ? cpu_ms / frames : 0.0);
+}
+
+// --input: raw rgb24 frames in the TCP stream's layout, e.g. from
+// `ffmpeg -vf vflip -f rawvideo -pix_fmt rgb24 -s 256x192 -`. A reader
+// thread fills a FrameRing with whole-frame reads while the main thread
+// draws and swaps, so the only copy before drawing is the kernel's, out of
+// the pipe.
+static const size_t INPUT_RING_FRAMES = 8;
+static const int INPUT_PIPE_BYTES = 1 << 20;  // the default pipe-max-size
+
+// Fill `ring` from `path` until it ends or the daemon is interrupted. A
+// named FIFO is reopened for the next producer when the writer goes away,
+// and a frame cut short by that is discarded.
+static void ReadInputMain(const char *path, FrameRing *ring,
+                          size_t frame_size) {
+  const bool use_stdin = std::strcmp(path, "-") == 0;
+  struct stat st;
+  const bool fifo = !use_stdin && stat(path, &st) == 0 && S_ISFIFO(st.st_mode);
+
+  while (!interrupt_received) {
+    // Non-blocking so a FIFO with no writer yet neither blocks open() nor
+    // reads as EOF; poll() below waits for the writer instead.
+    int fd = use_stdin ? STDIN_FILENO
+                       : open(path, O_RDONLY | O_NONBLOCK | O_CLOEXEC);
+    if (fd < 0) {
+      perror(path);
+      break;
+    }
+    // A bigger pipe lets the producer run several frames ahead while we
+    // wait for vsync, and turns each frame into one or two reads.
+    fcntl(fd, F_SETPIPE_SZ, INPUT_PIPE_BYTES);
+
+    uint8_t *slot = nullptr;
+    size_t have = 0;
+    bool eof = false;
+    while (!interrupt_received && !eof) {
+      pollfd p = {fd, POLLIN, 0};
+      if (poll(&p, 1, 100) <= 0)
+        continue;  // timeout (check for interrupts) or EINTR
+      if (!slot && !(slot = ring->BeginWrite()))
+        break;  // ring closed
+      ssize_t r = read(fd, slot + have, frame_size - have);
+      if (r < 0 && (errno == EAGAIN || errno == EINTR))
+        continue;
+      if (r <= 0) {
+        if (r < 0) perror("read");
+        if (have)
+          std::fprintf(stderr, "Input ended mid-frame; %zu bytes dropped.\n",
+                       have);
+        eof = true;
+        break;
+      }
+      have += r;
+      if (have == frame_size) {
+        ring->EndWrite();
+        slot = nullptr;
+        have = 0;
+      }
+    }
+    if (!use_stdin) close(fd);
+    if (!eof || !fifo)
+      break;
+    std::fprintf(stderr, "Input writer closed; waiting for the next one.\n");
+  }
+  ring->Close();
+}
+
+// Show frames from --input, paced at --fps if given (otherwise as fast as
+// the matrix swaps). A late frame is still shown unless the next one is
+// already waiting, in which case it is skipped to catch up; after a stall
+// of the source the schedule restarts rather than racing to catch up.
+static void RunInput(const DaemonOptions &opt, RGBMatrix *matrix,
+                     FrameCanvas **offscreen, size_t frame_size,
+                     DisplayClock *clock) {
+  FrameRing ring(INPUT_RING_FRAMES, frame_size);
+  if (!ring.ok()) {
+    perror("mmap");
+    return;
+  }
+  std::thread reader(ReadInputMain, opt.input, &ring, frame_size);
+
+  const int64_t period_us = opt.fps > 0 ? (int64_t)(1e6 / opt.fps) : 0;
+  int64_t due_us = 0;
+  uint64_t shown = 0, skipped = 0;
+  int64_t report_us = MonoMicros() + opt.stats_interval_s * 1000000ll;
+
+  const int wait_ms =
+      repaint_period_us ? (int)std::max<int64_t>(1, repaint_period_us / 1000)
+                        : 100;
+  while (!interrupt_received) {
+    const uint8_t *frame = ring.BeginRead(wait_ms);
+    if (!frame) {
+      if (ring.drained()) break;
+      if (RepaintDue()) RepaintHeld(matrix, offscreen);
+      continue;
+    }
+    if (period_us) {
+      const int64_t now = MonoMicros();
+      if (due_us == 0 || now - due_us > period_us) {
+        if (due_us != 0 && ring.depth() > 1) {
+          ring.EndRead();  // behind with more queued: skip this one
+          due_us += period_us;
+          skipped++;
+          continue;
+        }
+        if (due_us == 0 || now - due_us > 4 * period_us)
+          due_us = now;  // first frame, or the source stalled
+      }
+      // Keep dithering or interpolating towards the previous frame until
+      // this one is due, leaving time to draw it (the interpolator draws
+      // it at the due time).
+      const int64_t lead =
+          interpolator.enabled() ? repaint_period_us / 2 : repaint_period_us;
+      while (repaint_period_us && CanRepaint() && !interrupt_received &&
+             held_drawn_us + repaint_period_us + lead <= due_us) {
+        SleepUntilMicros(held_drawn_us + repaint_period_us);
+        RepaintHeld(matrix, offscreen);
+      }
+    }
+    // The interpolator takes a frame's arrival as its due time.
+    if (period_us && interpolator.enabled()) SleepUntilMicros(due_us);
+    DrawFlipped(*offscreen, frame);
+    ring.EndRead();
+    if (period_us) {
+      SleepUntilMicros(due_us);
+      due_us += period_us;
+    }
+    *offscreen = matrix->SwapOnVSync(*offscreen);
+    clock->Swapped(MonoMicros());
+    shown++;
+
+    if (opt.stats_interval_s > 0 && MonoMicros() >= report_us) {
+      std::fprintf(stderr, "[input] shown=%llu skipped=%llu depth=%zu\n",
+                   (unsigned long long)shown, (unsigned long long)skipped,
+                   ring.depth());
+      shown = skipped = 0;
+      report_us += opt.stats_interval_s * 1000000ll;
+    }
+  }
+  ring.Close();  // unblocks the reader if we were interrupted
+  reader.join();
+}
+
+// --io=epoll|uring: accept and read clients from an IoLoop instead of the
+// blocking accept/recv loop. Every client gets its own partial frame, so a
+// second connection cannot tear the first one's frames.
+//
+// --jitter-buffer: every frame is preceded by a PTS record (frame id and the
+// sender's CLOCK_MONOTONIC microseconds, see udp_frame_protocol.h). Frames
+// go into a JitterBuffer and the loop's 1 ms tick presents them when due.
+//
+// With both, acks follow the buffer: one per frame shown, and one with a
+// zero display time per frame it drops.
+//
+// --unix=PATH: local producers connect with SOCK_SEQPACKET instead, where
+// one message is one frame (after the PTS record with --jitter-buffer). It
+// is received straight into the client's frame, with no reassembly. A
+// 4-byte "SHOW" message displays the client's shared buffer instead; if it
+// carries a file descriptor (SCM_RIGHTS: a memfd of at least one frame,
+// sealed with F_SEAL_SHRINK so the producer cannot truncate it under the
+// mapping) that is mapped as the new shared buffer first.
+static void RunEventLoop(const DaemonOptions &opt, int listen_sock,
+                         int unix_sock, RGBMatrix *matrix,
+                         FrameCanvas **offscreen, size_t frame_size,
+                         DisplayClock *display) {
+  std::unique_ptr<IoLoop> loop = IoLoop::Create(opt.io_backend);
+  std::fprintf(stderr, "Ingest loop: %s\n", loop->name());
+
+  struct Client {
+    std::vector<uint8_t> frame;
+    size_t have = 0;
+    uint8_t pts_record[PTS_SIZE];
+    size_t pts_have = 0;
+    uint64_t pts = 0;
+    uint32_t seq = 0;  // frames received
+    uint32_t id = 0;   // tags its queued frames; fds are reused
+    bool bad = false;  // framing lost; ignore the rest
+    const uint8_t *shared = nullptr;  // --unix shared buffer
+    size_t shared_len = 0;
+
+    ~Client() {
+      if (shared) munmap((void *)shared, shared_len);
+    }
+  };
+  std::map<int, Client> clients;
+  uint32_t next_client_id = 0;
+  DisplayClock &clock = *display;
+
+  // The fd of the client a jitter-buffer tag belongs to, or -1 if it has
+  // disconnected since (its fd may be another client's by now).
+  auto client_fd = [&](uint64_t tag) {
+    for (const auto &kv : clients) {
+      if (kv.second.id == (uint32_t)(tag >> 32)) return kv.first;
+    }
+    return -1;
+  };
+
+  const JitterOptions &jitter_opt = opt.jitter;
+  std::unique_ptr<JitterBuffer> jitter;
+  if (jitter_opt.enabled) {
+    jitter.reset(new JitterBuffer(jitter_opt, frame_size));
+    // Tags are client id << 32 | seq, so a dropped frame can be acked too.
+    jitter->SetDropCallback([&](uint64_t tag) {
+      const int fd = client_fd(tag);
+      if (opt.ack && fd >= 0) SendAck(fd, (uint32_t)tag, 0, clock);
+    });
+    std::fprintf(stderr, "Jitter buffer: delay %lld..%lld ms, late frames: "
+                 "%s\n", (long long)jitter_opt.min_delay_us / 1000,
+                 (long long)jitter_opt.max_delay_us / 1000,
+                 jitter_opt.late == LATE_DROP ? "drop" : "show");
+  }
+
+  // A complete frame from client fd: show it, or queue it in the jitter
+  // buffer (which takes c.frame, so `pixels` must be c.frame then).
+  auto on_frame = [&](int fd, Client &c, const uint8_t *pixels) {
+    c.seq++;
+    if (jitter) {
+      jitter->Push(&c.frame, c.pts, MonoMicros(),
+                   (uint64_t)c.id << 32 | c.seq);
+    } else {
+      DrawFlipped(*offscreen, pixels);
+      SwapAndAck(matrix, offscreen, opt, &clock, fd, c.seq);
+    }
+  };
+
+  StreamFn on_data = [&](int fd, const uint8_t *data, size_t len) {
+    if (len == 0) {
+      std::fprintf(stderr, "Client disconnected.\n");
+      clients.erase(fd);
+      return;
+    }
+    Client &c = clients[fd];
+    while (len > 0 && !c.bad) {
+      if (jitter && c.pts_have < PTS_SIZE) {
+        size_t n = std::min(len, PTS_SIZE - c.pts_have);
+        std::memcpy(&c.pts_record[c.pts_have], data, n);
+        c.pts_have += n;
+        data += n;
+        len -= n;
+        uint16_t frame_id;
+        if (c.pts_have == PTS_SIZE &&
+            !ParsePts(c.pts_record, PTS_SIZE, &frame_id, &c.pts)) {
+          std::fprintf(stderr, "Client sent a frame without a PTS record; "
+                       "ignoring it.\n");
+          c.bad = true;
+        }
+        continue;
+      }
+      size_t n = std::min(len, frame_size - c.have);
+      std::memcpy(&c.frame[c.have], data, n);
+      c.have += n;
+      data += n;
+      len -= n;
+      if (c.have == frame_size) {
+        on_frame(fd, c, c.frame.data());
+        c.pts_have = 0;
+        c.have = 0;
+      }
+    }
+  };
+
+  loop->AddListener(listen_sock, [&](int client) {
+    std::fprintf(stderr, "Client connected.\n");
+    clients[client].id = ++next_client_id;
+    clients[client].frame.resize(frame_size);
+    loop->AddStream(client, on_data);
+  });
+
+  const size_t hdr = jitter ? PTS_SIZE : 0;
+  auto read_unix = [&](int fd) {
+    Client &c = clients[fd];
+    for (;;) {
+      iovec iov[2] = {{c.pts_record, hdr}, {c.frame.data(), frame_size}};
+      alignas(cmsghdr) char cbuf[CMSG_SPACE(sizeof(int))];
+      msghdr msg;
+      std::memset(&msg, 0, sizeof(msg));
+      msg.msg_iov = hdr ? iov : iov + 1;
+      msg.msg_iovlen = hdr ? 2 : 1;
+      msg.msg_control = cbuf;
+      msg.msg_controllen = sizeof(cbuf);
+      ssize_t r = recvmsg(fd, &msg, MSG_DONTWAIT | MSG_CMSG_CLOEXEC);
+      if (r < 0 && (errno == EAGAIN || errno == EINTR))
+        return;
+      if (r <= 0) {
+        std::fprintf(stderr, "Local client disconnected.\n");
+        loop->Remove(fd);
+        close(fd);
+        clients.erase(fd);
+        return;
+      }
+
+      for (cmsghdr *cm = CMSG_FIRSTHDR(&msg); cm; cm = CMSG_NXTHDR(&msg, cm)) {
+        if (cm->cmsg_level != SOL_SOCKET || cm->cmsg_type != SCM_RIGHTS)
+          continue;
+        int buf_fd;
+        std::memcpy(&buf_fd, CMSG_DATA(cm), sizeof(buf_fd));
+        struct stat st;
+        void *map = MAP_FAILED;
+        const int seals = fcntl(buf_fd, F_GET_SEALS);
+        if (seals >= 0 && (seals & F_SEAL_SHRINK) &&
+            fstat(buf_fd, &st) == 0 && (size_t)st.st_size >= frame_size)
+          map = mmap(nullptr, frame_size, PROT_READ, MAP_SHARED, buf_fd, 0);
+        close(buf_fd);
+        if (map == MAP_FAILED) {
+          std::fprintf(stderr, "Local client passed an unusable buffer.\n");
+          continue;
+        }
+        if (c.shared) munmap((void *)c.shared, c.shared_len);
+        c.shared = (const uint8_t *)map;
+        c.shared_len = frame_size;
+      }
+
+      uint16_t frame_id;
+      if ((size_t)r < hdr || (hdr && !ParsePts(c.pts_record, hdr, &frame_id,
+                                                &c.pts))) {
+        continue;  // no timestamp, nothing to schedule
+      }
+      const size_t body = r - hdr;
+      if (body == frame_size && !(msg.msg_flags & MSG_TRUNC)) {
+        on_frame(fd, c, c.frame.data());
+      } else if (body == 4 && std::memcmp(c.frame.data(), "SHOW", 4) == 0 &&
+                 c.shared) {
+        // The jitter buffer keeps frames, so it needs its own copy.
+        if (jitter) std::memcpy(c.frame.data(), c.shared, frame_size);
+        on_frame(fd, c, jitter ? c.frame.data() : c.shared);
+      } else if (!c.bad) {
+        std::fprintf(stderr, "Local client sent a %zd-byte message; frames "
+                     "are %zu bytes.\n", r, hdr + frame_size);
+        c.bad = true;  // say it once
+      }
+    }
+  };
+
+  if (unix_sock >= 0) {
+    loop->AddListener(unix_sock, [&](int client) {
+      std::fprintf(stderr, "Local client connected.\n");
+      clients[client].id = ++next_client_id;
+      clients[client].frame.resize(frame_size);
+      loop->AddReadable(client, [&read_unix, client]() { read_unix(client); });
+    });
+  }
+
+  // Draw a little ahead of the due time, then sleep for the exact swap.
+  const int64_t DRAW_LEAD_US = 2000;
+  std::vector<uint8_t> show(jitter ? frame_size : 0);
+  const int stats_interval_s = opt.stats_interval_s;
+  int64_t report_us = MonoMicros() + stats_interval_s * 1000000ll;
+  if (jitter) {
+    loop->SetTick(1, [&]() {
+      int64_t due;
+      const bool queued = jitter->Next(&due);
+      if (queued && due <= MonoMicros() + DRAW_LEAD_US) {
+        uint64_t tag;
+        jitter->Pop(&show, &tag);
+        DrawFlipped(*offscreen, show.data());
+        if (due > 0) SleepUntilMicros(due);
+        SwapAndAck(matrix, offscreen, opt, &clock, client_fd(tag),
+                   (uint32_t)tag);
+        if (due > 0) jitter->RecordError(MonoMicros() - due);
+      } else if ((!queued || due > MonoMicros() + repaint_period_us) &&
+                 RepaintDue()) {
+        RepaintHeld(matrix, offscreen);
+      }
+      if (stats_interval_s > 0 && MonoMicros() >= report_us) {
+        jitter->Print(stderr);
+        report_us += stats_interval_s * 1000000ll;
+      }
+    });
+  } else if (repaint_period_us) {
+    loop->SetTick(1, [&]() {
+      if (RepaintDue()) RepaintHeld(matrix, offscreen);
+    });
+  }
+  loop->Run(&interrupt_received);
+  if (jitter) jitter->Print(stderr);
+
+  for (auto &kv : clients) close(kv.first);
+}
+
 int main(int argc, char *argv[]) {
   // Matrix config: 3 parallel chains of 4 panels
   RGBMatrix::Options defaults;
@@ -56,6 +648,141 @@ int main(int argc, char *argv[]) {
     return 1;
   }
 
+  DaemonOptions dopt;
+  double dither_fps = 120;
+  const char *interpolate = nullptr;
+  double interpolate_fps = 120;
+  PowerOptions power_opt;
+  AdaptivePwmOptions pwm_opt;
+  for (int i = 1; i < argc; ++i) {
+    if (int r = ParseJitterFlag(argv[i], &dopt.jitter)) {
+      if (r < 0) {
+        delete matrix;
+        return 1;
+      }
+    } else if (int r = ParsePowerFlag(argv[i], &power_opt)) {
+      if (r < 0) {
+        delete matrix;
+        return 1;
+      }
+    } else if (int r = ParseAdaptivePwmFlag(argv[i], &pwm_opt)) {
+      if (r < 0) {
+        delete matrix;
+        return 1;
+      }
+    } else if (const char *v = FlagValue(argv[i], "--io")) {
+      dopt.io_backend = v;
+    } else if (const char *v = FlagValue(argv[i], "--stats-interval")) {
+      dopt.stats_interval_s = std::atoi(v);
+    } else if (FlagSet(argv[i], "--ack")) {
+      dopt.ack = true;
+    } else if (const char *v = FlagValue(argv[i], "--max-in-flight")) {
+      dopt.max_in_flight = std::atoi(v);
+    } else if (const char *v = FlagValue(argv[i], "--unix")) {
+      dopt.unix_path = v;
+    } else if (const char *v = FlagValue(argv[i], "--input")) {
+      dopt.input = v;
+    } else if (const char *v = FlagValue(argv[i], "--fps")) {
+      dopt.fps = std::atof(v);
+    } else if (const char *v = FlagValue(argv[i], "--lut")) {
+      if (!LoadColorLut(v, &color_lut, LOGICAL_WIDTH, LOGICAL_HEIGHT)) {
+        delete matrix;
+        return 1;
+      }
+    } else if (const char *v = FlagValue(argv[i], "--calibration")) {
+      if (!calibration.Load(v)) {
+        delete matrix;
+        return 1;
+      }
+    } else if (const char *v = FlagValue(argv[i], "--depth")) {
+      input_depth = std::atoi(v);
+    } else if (const char *v = FlagValue(argv[i], "--pixel-format")) {
+      if (!ParsePixelFormat(v, &input_format)) {
+        std::fprintf(stderr, "Unknown --pixel-format %s\n", v);
+        delete matrix;
+        return 1;
+      }
+      if (input_format == PIXEL_DELTA) {
+        std::fprintf(stderr, "--pixel-format=delta is for UDP senders\n");
+        delete matrix;
+        return 1;
+      }
+    } else if (const char *v = FlagValue(argv[i], "--dither-fps")) {
+      dither_fps = std::atof(v);
+    } else if (const char *v = FlagValue(argv[i], "--interpolate")) {
+      interpolate = v;
+    } else if (const char *v = FlagValue(argv[i], "--interpolate-fps")) {
+      interpolate_fps = std::atof(v);
+    } else {
+      std::fprintf(stderr, "Unknown option: %s\n", argv[i]);
+      delete matrix;
+      return 1;
+    }
+  }
+
+  if (input_depth != 8 && input_depth != 16) {
+    std::fprintf(stderr, "--depth must be 8 or 16\n");
+    delete matrix;
+    return 1;
+  }
+  if (input_depth == 16 && input_format != PIXEL_RGB24) {
+    std::fprintf(stderr, "--depth=16 frames are rgb48; --pixel-format "
+                 "is for 8-bit frames\n");
+    delete matrix;
+    return 1;
+  }
+  if (input_depth == 16) {
+    // The LUT and the calibration work on 8-bit values, which the dither
+    // has already settled.
+    if (color_lut.enabled() || calibration.enabled()) {
+      std::fprintf(stderr, "--depth=16 does not combine with --lut or "
+                   "--calibration\n");
+      delete matrix;
+      return 1;
+    }
+    dither.Configure(matrix->pwmbits(), matrix->brightness(),
+                     matrix->luminance_correct());
+    repaint_period_us = dither_fps > 0 ? (int64_t)(1e6 / dither_fps) : 0;
+    std::fprintf(stderr, "16-bit input: %d levels per channel at %d PWM "
+                 "bits, dither %.2f ms per frame, repaint at %.0f fps\n",
+                 dither.levels(), matrix->pwmbits(),
+                 dither.MicrosPerFrame(LOGICAL_WIDTH, LOGICAL_HEIGHT) / 1000.0,
+                 repaint_period_us ? dither_fps : 0.0);
+  }
+  if (interpolate) {
+    if (input_depth == 16) {
+      std::fprintf(stderr, "--interpolate works on 8-bit frames only\n");
+      delete matrix;
+      return 1;
+    }
+    if (!interpolator.Configure(interpolate, LOGICAL_WIDTH, LOGICAL_HEIGHT)) {
+      std::fprintf(stderr, "--interpolate must be blend or motion\n");
+      delete matrix;
+      return 1;
+    }
+    if (!(interpolate_fps > 0)) {
+      std::fprintf(stderr, "--interpolate-fps must be positive\n");
+      delete matrix;
+      return 1;
+    }
+    repaint_period_us = (int64_t)(1e6 / interpolate_fps);
+    double push_us, render_us;
+    interpolator.Measure(&push_us, &render_us);
+    std::fprintf(stderr, "Interpolating (%s) at %.0f fps: %.2f ms per new "
+                 "frame, %.2f ms per frame in between\n", interpolate,
+                 interpolate_fps, push_us / 1000.0, render_us / 1000.0);
+  }
+
+  if (power_opt.enabled) {
+    power_opt.stats_interval_s = dopt.stats_interval_s;
+    power.Configure(power_opt, matrix->brightness(),
+                    matrix->luminance_correct());
+  }
+  if (pwm_opt.enabled) {
+    pwm_opt.stats_interval_s = dopt.stats_interval_s;
+    adaptive_pwm.Configure(pwm_opt, matrix->pwmbits());
+  }
+
   Canvas *canvas = matrix;
   if (canvas->width() != LOGICAL_WIDTH || canvas->height() != LOGICAL_HEIGHT) {
     std::fprintf(stderr, "Unexpected canvas size: %dx%d (expected %dx%d)\n",
@@ -68,6 +795,23 @@ int main(int argc, char *argv[]) {
   signal(SIGTERM, InterruptHandler);
   signal(SIGINT,  InterruptHandler);
 
+  const size_t expected_size =
+      input_depth == 16
+          ? (size_t)LOGICAL_WIDTH * LOGICAL_HEIGHT * 6
+          : PixelFrameBytes(input_format, LOGICAL_WIDTH, LOGICAL_HEIGHT);
+  DisplayClock clock;
+
+  if (dopt.input) {
+    // Play the input instead of serving sockets.
+    RunInput(dopt, matrix, &offscreen, expected_size, &clock);
+    PrintCpuPerFrame(clock.swaps);
+    if (power.enabled()) power.Print(stderr);
+    if (adaptive_pwm.enabled()) adaptive_pwm.Print(stderr);
+    matrix->Clear();
+    delete matrix;
+    return 0;
+  }
+
   // TCP listen socket
   int listen_sock = socket(AF_INET, SOCK_STREAM, 0);
   if (listen_sock < 0) {
@@ -79,6 +823,17 @@ int main(int argc, char *argv[]) {
   int opt = 1;
   setsockopt(listen_sock, SOL_SOCKET, SO_REUSEADDR, &opt, sizeof(opt));
 
+  if (dopt.max_in_flight > 0) {
+    // Accepted sockets inherit this, and it has to be set before listen()
+    // to size the TCP window. The kernel doubles it for bookkeeping; about
+    // half of that is left for data, so ask for N frames.
+    int rcvbuf = dopt.max_in_flight * (expected_size + PTS_SIZE);
+    if (setsockopt(listen_sock, SOL_SOCKET, SO_RCVBUF, &rcvbuf,
+                   sizeof(rcvbuf)) < 0) {
+      perror("setsockopt(SO_RCVBUF)");
+    }
+  }
+
   sockaddr_in addr;
   std::memset(&addr, 0, sizeof(addr));
   addr.sin_family      = AF_INET;
@@ -103,8 +858,45 @@ int main(int argc, char *argv[]) {
           "matrix_daemon listening on TCP 127.0.0.1:%d (logical %dx%d, panels %dx%d)\n",
           PORT, LOGICAL_WIDTH, LOGICAL_HEIGHT, GRID_COLS, GRID_ROWS);
 
-  const size_t expected_size = LOGICAL_WIDTH * LOGICAL_HEIGHT * 3;
-  static uint8_t buffer[LOGICAL_WIDTH * LOGICAL_HEIGHT * 3];
+  // Local producers: one SOCK_SEQPACKET message per frame.
+  int unix_sock = -1;
+  if (dopt.unix_path) {
+    sockaddr_un uaddr;
+    std::memset(&uaddr, 0, sizeof(uaddr));
+    uaddr.sun_family = AF_UNIX;
+    if (std::strlen(dopt.unix_path) >= sizeof(uaddr.sun_path)) {
+      std::fprintf(stderr, "--unix path is too long\n");
+      close(listen_sock);
+      delete matrix;
+      return 1;
+    }
+    std::strcpy(uaddr.sun_path, dopt.unix_path);
+    unlink(dopt.unix_path);  // left over from an earlier run
+    unix_sock = socket(AF_UNIX, SOCK_SEQPACKET, 0);
+    if (unix_sock < 0 ||
+        bind(unix_sock, (struct sockaddr *)&uaddr, sizeof(uaddr)) < 0 ||
+        listen(unix_sock, 4) < 0) {
+      perror(dopt.unix_path);
+      close(listen_sock);
+      delete matrix;
+      return 1;
+    }
+    chmod(dopt.unix_path, 0666);  // producers need not run as root
+    std::fprintf(stderr, "matrix_daemon listening on %s (SOCK_SEQPACKET)\n",
+                 dopt.unix_path);
+  }
+
+  alignas(8) static uint8_t buffer[LOGICAL_WIDTH * LOGICAL_HEIGHT * 6];
+
+  // Presenting from the jitter buffer, serving more than one socket and
+  // repainting between frames need the event loop.
+  if ((dopt.jitter.enabled || unix_sock >= 0 || repaint_period_us) &&
+      std::strcmp(dopt.io_backend, "blocking") == 0)
+    dopt.io_backend = "epoll";
+  if (std::strcmp(dopt.io_backend, "blocking") != 0) {
+    RunEventLoop(dopt, listen_sock, unix_sock, matrix, &offscreen,
+                 expected_size, &clock);
+  }
 
   while (!interrupt_received) {
     std::fprintf(stderr, "Waiting for connection from server.py...\n");
@@ -117,6 +909,7 @@ int main(int argc, char *argv[]) {
 
     std::fprintf(stderr, "Client connected.\n");
 
+    uint32_t seq = 0;
     while (!interrupt_received) {
       if (!ReadNBytes(client, buffer, expected_size)) {
         std::fprintf(stderr, "Client disconnected.\n");
@@ -124,23 +917,21 @@ int main(int argc, char *argv[]) {
         break;
       }
 
-      // buffer: row-major, origin at bottom-left (WebGL)
-      size_t idx = 0;
-      for (int y_buf = 0; y_buf < LOGICAL_HEIGHT; ++y_buf) {
-        int Y = LOGICAL_HEIGHT - 1 - y_buf;  // flip vertically
-        for (int X = 0; X < LOGICAL_WIDTH; ++X) {
-          uint8_t r = buffer[idx++];
-          uint8_t g = buffer[idx++];
-          uint8_t b = buffer[idx++];
-          offscreen->SetPixel(X, Y, r, g, b);
-        }
-      }
-
-      offscreen = matrix->SwapOnVSync(offscreen);
+      DrawFlipped(offscreen, buffer);
+      SwapAndAck(matrix, &offscreen, dopt, &clock, client, ++seq);
     }
   }
 
   close(listen_sock);
+  if (unix_sock >= 0) {
+    close(unix_sock);
+    unlink(dopt.unix_path);
+  }
+
+  PrintCpuPerFrame(clock.swaps);
+  if (power.enabled()) power.Print(stderr);
+  if (adaptive_pwm.enabled()) adaptive_pwm.Print(stderr);
+
   matrix->Clear();
   delete matrix;
   return 0;
@@ -1,8 +1,12 @@
 #include "led-matrix.h"
+#include "cli_flags.h"
+#include "panel_calibration.h"
 
+#include <sys/stat.h>
 #include <unistd.h>
 #include <signal.h>
 #include <cstdio>
+#include <cstring>
 
 using rgb_matrix::RGBMatrix;
 using rgb_matrix::Canvas;
@@ -66,6 +70,101 @@ static void DrawPanels(Canvas *canvas) {
   }
 }
 
+// --calibrate: every panel shows the same pattern, so differences between
+// panels stand out, with the calibration file applied. The file is re-read
+// whenever it changes, so it can be tuned while watching the wall.
+static const char *const PATTERN_NAMES = "bars, ramp, white, gray, red, green or blue";
+
+struct SolidPattern {
+  const char *name;
+  uint8_t r, g, b;
+};
+static const SolidPattern SOLIDS[] = {
+  {"white", 255, 255, 255}, {"gray", 128, 128, 128},
+  {"red", 255, 0, 0}, {"green", 0, 255, 0}, {"blue", 0, 0, 255},
+};
+
+static bool KnownPattern(const char *pattern) {
+  if (std::strcmp(pattern, "bars") == 0 || std::strcmp(pattern, "ramp") == 0)
+    return true;
+  for (const SolidPattern &s : SOLIDS)
+    if (std::strcmp(pattern, s.name) == 0) return true;
+  return false;
+}
+
+// Pixel (x, y) of a 64x64 panel.
+static void PatternPixel(const char *pattern, int x, int y,
+                         uint8_t &r, uint8_t &g, uint8_t &b) {
+  static const uint8_t BARS[8][3] = {
+    {255, 255, 255}, {192, 192, 192}, {128, 128, 128}, {64, 64, 64},
+    {255, 0, 0}, {0, 255, 0}, {0, 0, 255}, {255, 200, 160},  // skin tone
+  };
+  const bool ramp = std::strcmp(pattern, "ramp") == 0;
+  if (std::strcmp(pattern, "bars") == 0 && y < 40) {
+    r = BARS[x / 8][0]; g = BARS[x / 8][1]; b = BARS[x / 8][2];
+  } else if (ramp || std::strcmp(pattern, "bars") == 0) {
+    r = g = b = (uint8_t)(x * 255 / 63);  // gray ramp
+  } else {
+    r = g = b = 0;
+    for (const SolidPattern &s : SOLIDS) {
+      if (std::strcmp(pattern, s.name) == 0) {
+        r = s.r; g = s.g; b = s.b;
+      }
+    }
+  }
+}
+
+static void DrawCalibration(Canvas *canvas, const char *pattern,
+                            const PanelCalibration &cal) {
+  const int panel_w = PanelCalibration::PANEL_W;
+  const int panel_h = PanelCalibration::PANEL_H;
+  const int width = canvas->width();
+  uint8_t row[256 * 3];
+  if (width > 256) return;
+
+  for (int y = 0; y < canvas->height(); ++y) {
+    for (int x = 0; x < width; ++x) {
+      // Panel number as dots in the top-left corner: 1 + row * 4 + col.
+      const int idx = (y / panel_h) * PanelCalibration::GRID_COLS +
+                      x / panel_w;
+      const int px = x % panel_w, py = y % panel_h;
+      uint8_t *p = &row[x * 3];
+      if (px / 4 <= idx && px % 4 < 2 && py >= 58 && py < 62) {
+        p[0] = p[1] = p[2] = py < 60 ? 255 : 0;  // white over black
+      } else {
+        PatternPixel(pattern, px, py, p[0], p[1], p[2]);
+      }
+    }
+    cal.Apply(row, row, y, width);
+    for (int x = 0; x < width; ++x)
+      canvas->SetPixel(x, y, row[x * 3], row[x * 3 + 1], row[x * 3 + 2]);
+  }
+}
+
+static void RunCalibration(Canvas *canvas, const char *path,
+                           const char *pattern) {
+  PanelCalibration cal;
+  struct timespec seen = {0, 0};
+  bool drawn = false;
+  while (!interrupt_received) {
+    struct stat st;
+    if (path && stat(path, &st) == 0 &&
+        (st.st_mtim.tv_sec != seen.tv_sec ||
+         st.st_mtim.tv_nsec != seen.tv_nsec)) {
+      seen = st.st_mtim;
+      if (cal.Load(path)) {
+        std::fprintf(stderr, "Loaded %s\n", path);
+        drawn = false;
+      }
+    }
+    if (!drawn) {
+      DrawCalibration(canvas, pattern, cal);
+      drawn = true;
+    }
+    usleep(200 * 1000);
+  }
+}
+
 int main(int argc, char *argv[]) {
   RGBMatrix::Options defaults;
   defaults.hardware_mapping = "regular";
@@ -79,10 +178,35 @@ int main(int argc, char *argv[]) {
   if (canvas == nullptr)
     return 1;
 
+  const char *calibration = nullptr;
+  const char *pattern = nullptr;
+  for (int i = 1; i < argc; ++i) {
+    if (const char *v = FlagValue(argv[i], "--calibrate")) {
+      calibration = v;
+    } else if (FlagSet(argv[i], "--calibrate")) {
+      pattern = pattern ? pattern : "bars";
+    } else if (const char *v = FlagValue(argv[i], "--pattern")) {
+      pattern = v;
+    } else {
+      std::fprintf(stderr, "Unknown option: %s\n", argv[i]);
+      delete canvas;
+      return 1;
+    }
+  }
+  if (calibration && !pattern) pattern = "bars";
+  if (pattern && !KnownPattern(pattern)) {
+    std::fprintf(stderr, "--pattern must be %s\n", PATTERN_NAMES);
+    delete canvas;
+    return 1;
+  }
+
   signal(SIGTERM, InterruptHandler);
   signal(SIGINT,  InterruptHandler);
 
-  DrawPanels(canvas);
+  if (pattern)
+    RunCalibration(canvas, calibration, pattern);
+  else
+    DrawPanels(canvas);
 
   canvas->Clear();
   delete canvas;
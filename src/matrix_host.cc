@@ -0,0 +1,657 @@
+// matrix_host.cc
+// One long-lived process that owns the matrix and hosts every content
+// source, so switching content never re-initializes the panels:
+//   tcp     matrix_daemon's stream: raw 256x192 frames (rgb24, or
+//           --pixel-format), bottom row first, on 127.0.0.1:9999
+//   udp     udp_matrix_receiver's formats: 6-byte header on 5005, 12-byte
+//           udp_led_receiver.py header on 9999
+//   rings, plasma
+//           local_shader's shaders, rendered here
+//
+// Threads:
+//   - ingest: one IoLoop serves every socket (TCP clients, both UDP ports,
+//     the control socket). Callbacks only do non-blocking I/O and hand off
+//     finished frames, so a slow or stuck client holds nothing but its own
+//     partial frame.
+//   - shader: renders the active shader, paced at --shader-fps; idle when
+//     the active source is not a shader.
+//   - main: owns the matrix and only ever waits for the active source.
+// Every source publishes into its own FrameMailbox (latest frame wins), so
+// no source can queue up behind or block another. Network sources keep
+// receiving while inactive; switching to one shows its newest frame right
+// away, and switching to a shader shows its first frame one render later.
+//
+// Switch with a datagram naming the source on the control socket, e.g.
+//   s = socket.socket(socket.AF_UNIX, socket.SOCK_DGRAM)
+//   s.sendto(b"plasma", "/tmp/matrix_host.sock")
+
+#include "led-matrix.h"
+#include "adaptive_pwm.h"
+#include "cli_flags.h"
+#include "color_lut.h"
+#include "frame_resampler.h"
+#include "io_loop.h"
+#include "local_shaders.h"
+#include "panel_calibration.h"
+#include "power_limit.h"
+#include "udp_frame_assembly.h"
+#include "udp_frame_mailbox.h"
+#include "udp_frame_protocol.h"
+#include "udp_stream_stats.h"
+
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <signal.h>
+#include <sys/eventfd.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include <atomic>
+#include <condition_variable>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+using rgb_matrix::RGBMatrix;
+using rgb_matrix::FrameCanvas;
+
+static volatile bool interrupt_received = false;
+static void InterruptHandler(int) { interrupt_received = true; }
+
+static const int WIDTH  = 256;  // 4 * 64
+static const int HEIGHT = 192;  // 3 * 64
+static const size_t FRAME_BYTES = WIDTH * HEIGHT * 3;
+
+static const int TCP_PORT = 9999;           // matrix_daemon
+static const int UDP_PORT = 5005;           // compact 6-byte header
+static const int UDP_GEOMETRY_PORT = 9999;  // 12-byte header
+static const size_t CHUNK_SIZE = 1024;      // compact payload stride
+
+struct HostOptions {
+  const char *io_backend = "epoll";
+  const char *control_path = "/tmp/matrix_host.sock";
+  const char *initial = "tcp";
+  int udp_port = UDP_PORT;                    // 0 disables
+  int geometry_port = UDP_GEOMETRY_PORT;      // 0 disables
+  size_t chunk_size = CHUNK_SIZE;
+  double shader_fps = 60;
+  int stats_interval_s = 5;
+  PixelFormat tcp_format = PIXEL_RGB24;       // --pixel-format
+};
+
+// One content source. Its producer thread fills `spare` and publishes it;
+// the main thread takes frames out of the mailbox.
+struct Source {
+  std::string name;
+  bool flip = false;               // bottom row first (WebGL readback)
+  LocalShaderFn shader = nullptr;  // rendered by the shader thread
+  std::unique_ptr<FrameMailbox> mailbox;
+  MailboxFrame *spare = nullptr;   // producer side
+  std::atomic<uint64_t> frames{0};
+
+  void Publish() {
+    spare = mailbox->Publish(spare);
+    frames.fetch_add(1, std::memory_order_relaxed);
+  }
+};
+
+class Host {
+ public:
+  Host() : switch_fd_(eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK)) {}
+  ~Host() { close(switch_fd_); }
+
+  Source *Add(const std::string &name, bool flip, LocalShaderFn shader) {
+    sources_.emplace_back(new Source());
+    Source *s = sources_.back().get();
+    s->name = name;
+    s->flip = flip;
+    s->shader = shader;
+    s->mailbox.reset(new FrameMailbox(1, WIDTH, HEIGHT));
+    s->spare = s->mailbox->TakeSpare();
+    return s;
+  }
+
+  Source *Find(const char *name) {
+    for (auto &s : sources_)
+      if (s->name == name) return s.get();
+    return nullptr;
+  }
+
+  // Any thread. Wakes the main thread (to wait on the new source) and the
+  // shader thread (in case it is a shader).
+  bool SwitchTo(const char *name) {
+    Source *s = Find(name);
+    if (!s) return false;
+    {
+      std::lock_guard<std::mutex> lock(mu_);
+      switched_us_ = MonoMicros();
+      active_.store(s, std::memory_order_release);
+    }
+    cv_.notify_all();
+    uint64_t one = 1;
+    ssize_t r = write(switch_fd_, &one, sizeof(one));
+    (void)r;
+    return true;
+  }
+
+  Source *active() const { return active_.load(std::memory_order_acquire); }
+  int switch_fd() const { return switch_fd_; }
+  const std::vector<std::unique_ptr<Source>> &sources() const {
+    return sources_;
+  }
+
+  // When the switch to `shown` happened, the first time a frame of it is
+  // on the wall; otherwise 0.
+  int64_t TakeSwitchTime(const Source *shown) {
+    std::lock_guard<std::mutex> lock(mu_);
+    if (shown != active()) return 0;
+    int64_t t = switched_us_;
+    switched_us_ = 0;
+    return t;
+  }
+
+  // Shader thread: the active shader source, waiting up to timeout_ms for
+  // one to become active.
+  Source *WaitForShader(int timeout_ms) {
+    std::unique_lock<std::mutex> lock(mu_);
+    cv_.wait_for(lock, std::chrono::milliseconds(timeout_ms),
+                 [this] { return active()->shader != nullptr; });
+    Source *s = active();
+    return s->shader ? s : nullptr;
+  }
+
+ private:
+  std::vector<std::unique_ptr<Source>> sources_;
+  std::atomic<Source *> active_{nullptr};
+  const int switch_fd_;
+  std::mutex mu_;
+  std::condition_variable cv_;
+  int64_t switched_us_ = 0;
+};
+
+static int OpenTcpListener(int port) {
+  int sock = socket(AF_INET, SOCK_STREAM, 0);
+  if (sock < 0) {
+    perror("socket");
+    return -1;
+  }
+  int reuse = 1;
+  setsockopt(sock, SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof(reuse));
+
+  sockaddr_in addr;
+  std::memset(&addr, 0, sizeof(addr));
+  addr.sin_family = AF_INET;
+  addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);  // 127.0.0.1
+  addr.sin_port = htons(port);
+  if (bind(sock, (struct sockaddr *)&addr, sizeof(addr)) < 0 ||
+      listen(sock, 4) < 0) {
+    perror("TCP bind/listen");
+    close(sock);
+    return -1;
+  }
+  return sock;
+}
+
+static int OpenUdpSocket(int port) {
+  int sock = socket(AF_INET, SOCK_DGRAM, 0);
+  if (sock < 0) {
+    perror("socket");
+    return -1;
+  }
+  int reuse = 1;
+  setsockopt(sock, SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof(reuse));
+  int rcvbuf = 4 * FRAME_BYTES;
+  setsockopt(sock, SOL_SOCKET, SO_RCVBUF, &rcvbuf, sizeof(rcvbuf));
+
+  sockaddr_in addr;
+  std::memset(&addr, 0, sizeof(addr));
+  addr.sin_family = AF_INET;
+  addr.sin_addr.s_addr = htonl(INADDR_ANY);
+  addr.sin_port = htons(port);
+  if (bind(sock, (struct sockaddr *)&addr, sizeof(addr)) < 0) {
+    perror("UDP bind");
+    close(sock);
+    return -1;
+  }
+  return sock;
+}
+
+static int OpenControlSocket(const char *path) {
+  sockaddr_un addr;
+  std::memset(&addr, 0, sizeof(addr));
+  addr.sun_family = AF_UNIX;
+  if (std::strlen(path) >= sizeof(addr.sun_path)) {
+    std::fprintf(stderr, "--control path is too long\n");
+    return -1;
+  }
+  std::strcpy(addr.sun_path, path);
+  unlink(path);  // left over from an earlier run
+  int sock = socket(AF_UNIX, SOCK_DGRAM, 0);
+  if (sock < 0 || bind(sock, (struct sockaddr *)&addr, sizeof(addr)) < 0) {
+    perror(path);
+    if (sock >= 0) close(sock);
+    return -1;
+  }
+  chmod(path, 0666);
+  return sock;
+}
+
+// Ingest thread: every socket on one loop. The loop is created on the
+// thread that runs it (io_uring rings are single issuer).
+struct Ingest {
+  std::unique_ptr<IoLoop> loop;
+  FrameAssembly assemblies[2];
+  UdpStreamStats stats[2];
+
+  struct TcpClient {
+    std::vector<uint8_t> frame;
+    size_t have = 0;
+  };
+  std::map<int, TcpClient> clients;
+};
+
+// Open the UDP sockets, so a port in use fails before any thread starts,
+// and report their [stats] every --stats-interval.
+static bool OpenIngest(Ingest *in, const HostOptions &opt) {
+  const int ports[2] = {opt.udp_port, opt.geometry_port};
+  for (int k = 0; k < 2; ++k) {
+    if (ports[k] == 0) continue;
+    FrameAssembly *a = &in->assemblies[k];
+    a->fmt = k == 0 ? WIRE_COMPACT : WIRE_GEOMETRY;
+    a->port = ports[k];
+    a->chunk_size = opt.chunk_size;
+    a->Init(WIDTH, HEIGHT);
+    if ((a->sock = OpenUdpSocket(a->port)) < 0) return false;
+  }
+  for (int k = 0; k < 2; ++k) {
+    if (in->assemblies[k].sock < 0) continue;
+    char label[16];
+    std::snprintf(label, sizeof(label), "udp %d", in->assemblies[k].port);
+    in->stats[k].SetLabel(label);
+    in->stats[k].StartReporter(opt.stats_interval_s);
+  }
+  return true;
+}
+
+static void IngestThreadMain(Ingest *in, const HostOptions &opt, Host *host,
+                             int tcp_sock, int control_sock) {
+  in->loop = IoLoop::Create(opt.io_backend);
+  std::fprintf(stderr, "Ingest loop: %s\n", in->loop->name());
+  IoLoop *loop = in->loop.get();
+
+  Source *tcp = host->Find("tcp");
+  const PixelFormat tcp_format = opt.tcp_format;
+  const size_t tcp_bytes = PixelFrameBytes(tcp_format, WIDTH, HEIGHT);
+  loop->AddListener(tcp_sock, [=](int fd) {
+    in->clients[fd].frame.resize(tcp_bytes);
+    loop->AddStream(fd, [=](int fd, const uint8_t *data, size_t len) {
+      if (len == 0) {
+        in->clients.erase(fd);
+        return;
+      }
+      Ingest::TcpClient &c = in->clients[fd];
+      while (len > 0) {
+        size_t n = std::min(len, tcp_bytes - c.have);
+        std::memcpy(&c.frame[c.have], data, n);
+        c.have += n;
+        data += n;
+        len -= n;
+        if (c.have == tcp_bytes) {
+          c.frame.swap(tcp->spare->pixels);  // trade, don't copy
+          tcp->spare->format = tcp_format;
+          tcp->Publish();
+          c.have = 0;
+          if (c.frame.size() < tcp_bytes) c.frame.resize(tcp_bytes);
+        }
+      }
+    });
+  });
+
+  Source *udp = host->Find("udp");
+  for (int k = 0; k < 2; ++k) {
+    FrameAssembly *a = &in->assemblies[k];
+    if (a->sock < 0) continue;
+    UdpStreamStats *stats = &in->stats[k];
+    loop->AddDatagramSocket(a->sock, [a, stats, udp](
+        const uint8_t *data, size_t n, const sockaddr_in &from,
+        int gso_size, bool truncated) {
+      UdpSourceStats *src = stats->Lookup(from);
+      StatAdd(src->reads);
+      StatAdd(src->packets);
+      StatAdd(src->bytes, n);
+      FramePacket pkt;
+      if (truncated || !ParseFramePacket(a->fmt, data, n, a->chunk_size,
+                                         &pkt) ||
+          (a->fmt == WIRE_GEOMETRY && !GeometrySizeOk(pkt))) {
+        StatAdd(src->malformed);
+        return;
+      }
+      FrameSlot *done = AddPacket(a, pkt, src, from, MonoMicros());
+      if (done) {
+        done->buf.swap(udp->spare->pixels);  // the slot is reset on reuse
+        udp->spare->width = done->width;
+        udp->spare->height = done->height;
+        udp->spare->format = done->format;
+        udp->Publish();
+      }
+    });
+  }
+
+  loop->AddReadable(control_sock, [control_sock, host]() {
+    char msg[64];
+    sockaddr_un from;
+    socklen_t from_len;
+    for (;;) {
+      from_len = sizeof(from);
+      ssize_t r = recvfrom(control_sock, msg, sizeof(msg) - 1, MSG_DONTWAIT,
+                           (struct sockaddr *)&from, &from_len);
+      if (r < 0) return;
+      while (r > 0 && (msg[r - 1] == '\n' || msg[r - 1] == ' ')) r--;
+      msg[r] = '\0';
+      bool ok = host->SwitchTo(msg);
+      std::fprintf(stderr, ok ? "Switching to %s\n" : "Unknown source %s\n",
+                   msg);
+      // Answer senders that bound an address of their own.
+      if (from_len > sizeof(sa_family_t)) {
+        const char *reply = ok ? "ok" : "unknown source";
+        sendto(control_sock, reply, std::strlen(reply), MSG_DONTWAIT,
+               (struct sockaddr *)&from, from_len);
+      }
+    }
+  });
+  loop->Run(&interrupt_received);
+}
+
+static void ShaderThreadMain(Host *host, double fps) {
+  const int64_t start_us = MonoMicros();
+  const int64_t period_us = (int64_t)(1e6 / fps);
+  int64_t due_us = 0;
+  while (!interrupt_received) {
+    Source *s = host->WaitForShader(100);
+    if (!s) {
+      due_us = 0;
+      continue;
+    }
+    const int64_t now = MonoMicros();
+    if (due_us == 0 || now - due_us > period_us)
+      due_us = now;  // just switched in, or running behind
+    RenderLocalShader(s->shader, (now - start_us) / 1e6f,
+                      s->spare->pixels.data());
+    s->Publish();
+    due_us += period_us;
+    SleepUntilMicros(due_us);
+  }
+}
+
+static ColorLut color_lut;  // --lut, for every source
+static PanelCalibration calibration;  // --calibration
+static PowerLimiter power;  // --current-limit and --panel-current-limit
+static AdaptivePwm adaptive_pwm;  // --adaptive-pwm
+static FrameResampler resampler;  // UDP geometry frames of other sizes
+
+// The LUT and the calibration for canvas row Y. Returns `in` if neither is
+// on, else `out`.
+static const uint8_t *GradeRow(const uint8_t *in, uint8_t *out, int Y) {
+  const uint8_t *p = in;
+  if (color_lut.enabled()) {
+    color_lut.Apply(p, out, WIDTH);
+    p = out;
+  }
+  if (calibration.enabled()) {
+    calibration.Apply(p, out, Y, WIDTH);
+    p = out;
+  }
+  return p;
+}
+
+// Row y, in the frame's own order, of a frame that is `resample`d or
+// already wall-sized. A resampled row goes to `scratch`, where grading can
+// carry on in place.
+static const uint8_t *SourceRow(const uint8_t *frame, bool resample, int y,
+                                uint8_t *scratch) {
+  if (!resample) return frame + (size_t)y * WIDTH * 3;
+  resampler.Row(frame, y, scratch);
+  return scratch;
+}
+
+static void DrawFrame(FrameCanvas *canvas, const MailboxFrame &f, bool flip) {
+  // The power limit has to see the whole graded frame before any of it is
+  // drawn, so then the rows are graded into `staged` first.
+  static uint8_t staged[WIDTH * HEIGHT * 3];
+  static std::vector<uint8_t> converted;  // frames not in rgb24
+  const uint8_t *rows[HEIGHT];
+  uint8_t graded[WIDTH * 3];
+  const uint8_t *frame = f.pixels.data();
+  if (f.format != PIXEL_RGB24) {
+    converted.resize((size_t)f.width * f.height * 3);
+    ConvertToRgb24(f.format, frame, f.width, f.height, converted.data());
+    frame = converted.data();
+  }
+  const bool resample = f.width != WIDTH || f.height != HEIGHT;
+  if (resample) resampler.Configure(f.width, f.height, WIDTH, HEIGHT);
+  if (adaptive_pwm.enabled()) {
+    const int bits = adaptive_pwm.Update(frame, f.width, f.height, 1);
+    if (canvas->pwmbits() != bits) canvas->SetPWMBits(bits);
+  }
+  if (power.enabled()) {
+    for (int y = 0; y < HEIGHT; ++y) {
+      const int Y = flip ? HEIGHT - 1 - y : y;
+      uint8_t *row = staged + (size_t)Y * WIDTH * 3;
+      rows[Y] = GradeRow(SourceRow(frame, resample, y, row), row, Y);
+      power.Measure(rows[Y], Y, WIDTH);
+    }
+    power.Finish();
+  }
+  for (int y = 0; y < HEIGHT; ++y) {
+    const int Y = flip ? HEIGHT - 1 - y : y;
+    const uint8_t *p = power.enabled()
+        ? rows[Y]
+        : GradeRow(SourceRow(frame, resample, y, graded), graded, Y);
+    if (power.active()) {
+      power.Apply(p, graded, Y, WIDTH);
+      p = graded;
+    }
+    for (int x = 0; x < WIDTH; ++x) {
+      canvas->SetPixel(x, Y, p[0], p[1], p[2]);
+      p += 3;
+    }
+  }
+}
+
+int main(int argc, char *argv[]) {
+  RGBMatrix::Options defaults;
+  defaults.hardware_mapping = "regular";
+  defaults.rows         = 64;  // per panel
+  defaults.cols         = 64;  // per panel
+  defaults.chain_length = 4;   // 4 panels per chain
+  defaults.parallel     = 3;   // 3 chains in parallel
+  defaults.show_refresh_rate = true;
+
+  RGBMatrix *matrix = RGBMatrix::CreateFromFlags(&argc, &argv, &defaults);
+  if (matrix == nullptr) {
+    std::fprintf(stderr, "Could not create RGBMatrix\n");
+    return 1;
+  }
+
+  HostOptions opt;
+  PowerOptions power_opt;
+  AdaptivePwmOptions pwm_opt;
+  for (int i = 1; i < argc; ++i) {
+    const char *v;
+    if ((v = FlagValue(argv[i], "--source"))) {
+      opt.initial = v;
+    } else if ((v = FlagValue(argv[i], "--control"))) {
+      opt.control_path = v;
+    } else if ((v = FlagValue(argv[i], "--io"))) {
+      opt.io_backend = v;
+    } else if ((v = FlagValue(argv[i], "--udp-port"))) {
+      opt.udp_port = std::atoi(v);
+    } else if ((v = FlagValue(argv[i], "--udp12-port"))) {
+      opt.geometry_port = std::atoi(v);
+    } else if ((v = FlagValue(argv[i], "--chunk-size"))) {
+      opt.chunk_size = std::strtoul(v, nullptr, 10);
+    } else if ((v = FlagValue(argv[i], "--shader-fps"))) {
+      opt.shader_fps = std::atof(v);
+    } else if ((v = FlagValue(argv[i], "--stats-interval"))) {
+      opt.stats_interval_s = std::atoi(v);
+    } else if ((v = FlagValue(argv[i], "--pixel-format"))) {
+      if (!ParsePixelFormat(v, &opt.tcp_format)) {
+        std::fprintf(stderr, "Unknown --pixel-format %s\n", v);
+        delete matrix;
+        return 1;
+      }
+      if (opt.tcp_format == PIXEL_DELTA) {
+        std::fprintf(stderr, "--pixel-format=delta is for UDP senders\n");
+        delete matrix;
+        return 1;
+      }
+    } else if ((v = FlagValue(argv[i], "--lut"))) {
+      if (!LoadColorLut(v, &color_lut, WIDTH, HEIGHT)) {
+        delete matrix;
+        return 1;
+      }
+    } else if ((v = FlagValue(argv[i], "--calibration"))) {
+      if (!calibration.Load(v)) {
+        delete matrix;
+        return 1;
+      }
+    } else if (int r = ParsePowerFlag(argv[i], &power_opt)) {
+      if (r < 0) {
+        delete matrix;
+        return 1;
+      }
+    } else if (int r = ParseAdaptivePwmFlag(argv[i], &pwm_opt)) {
+      if (r < 0) {
+        delete matrix;
+        return 1;
+      }
+    } else {
+      std::fprintf(stderr, "Unknown option: %s\n", argv[i]);
+      delete matrix;
+      return 1;
+    }
+  }
+  if (power_opt.enabled) {
+    power_opt.stats_interval_s = opt.stats_interval_s;
+    power.Configure(power_opt, matrix->brightness(),
+                    matrix->luminance_correct());
+  }
+  if (pwm_opt.enabled) {
+    pwm_opt.stats_interval_s = opt.stats_interval_s;
+    adaptive_pwm.Configure(pwm_opt, matrix->pwmbits());
+  }
+  if (opt.shader_fps <= 0 || opt.chunk_size == 0) {
+    std::fprintf(stderr, "--shader-fps and --chunk-size must be positive\n");
+    delete matrix;
+    return 1;
+  }
+
+  Host host;
+  host.Add("tcp", true, nullptr);
+  host.Add("udp", false, nullptr);
+  for (const LocalShader &s : LOCAL_SHADERS)
+    host.Add(s.name, false, s.fn);
+  if (!host.SwitchTo(opt.initial)) {
+    std::fprintf(stderr, "Unknown --source %s\n", opt.initial);
+    delete matrix;
+    return 1;
+  }
+  host.TakeSwitchTime(host.active());
+
+  signal(SIGTERM, InterruptHandler);
+  signal(SIGINT,  InterruptHandler);
+
+  int tcp_sock = OpenTcpListener(TCP_PORT);
+  int control_sock = OpenControlSocket(opt.control_path);
+  Ingest ingest;
+  if (tcp_sock < 0 || control_sock < 0 ||
+      !OpenIngest(&ingest, opt)) {
+    delete matrix;
+    return 1;
+  }
+  std::fprintf(stderr, "matrix_host: tcp 127.0.0.1:%d, udp %d/%d, control "
+               "%s, showing %s\n", TCP_PORT, opt.udp_port, opt.geometry_port,
+               opt.control_path, opt.initial);
+
+  // The main thread's buffers, one per source.
+  std::map<Source *, MailboxFrame *> mine;
+  for (auto &s : host.sources()) mine[s.get()] = s->mailbox->TakeSpare();
+
+  std::thread ingest_thread([&]() {
+    IngestThreadMain(&ingest, opt, &host, tcp_sock, control_sock);
+  });
+  std::thread shader_thread(ShaderThreadMain, &host, opt.shader_fps);
+
+  FrameCanvas *offscreen = matrix->CreateFrameCanvas();
+  uint64_t shown = 0;
+  int64_t report_us = MonoMicros() + opt.stats_interval_s * 1000000ll;
+  std::map<Source *, uint64_t> last_frames;
+
+  while (!interrupt_received) {
+    Source *s = host.active();
+    pollfd p[2] = {{s->mailbox->fd(), POLLIN, 0},
+                   {host.switch_fd(), POLLIN, 0}};
+    if (poll(p, 2, 100) > 0) {
+      if (p[1].revents & POLLIN) {
+        uint64_t n;
+        ssize_t r = read(host.switch_fd(), &n, sizeof(n));
+        (void)r;
+      }
+      // Always look at the source that is active now: after a switch its
+      // newest frame may already be waiting.
+      s = host.active();
+      if (s->mailbox->Wait(&mine[s], 0)) {
+        DrawFrame(offscreen, *mine[s], s->flip);
+        offscreen = matrix->SwapOnVSync(offscreen);
+        shown++;
+        if (int64_t t = host.TakeSwitchTime(s)) {
+          std::fprintf(stderr, "[host] %s on the wall %.1f ms after the "
+                       "switch\n", s->name.c_str(),
+                       (MonoMicros() - t) / 1000.0);
+        }
+      }
+    }
+
+    if (opt.stats_interval_s > 0 && MonoMicros() >= report_us) {
+      std::string line;
+      for (auto &src : host.sources()) {
+        uint64_t f = src->frames.load(std::memory_order_relaxed);
+        char part[64];
+        std::snprintf(part, sizeof(part), " %s=%llu", src->name.c_str(),
+                      (unsigned long long)(f - last_frames[src.get()]));
+        line += part;
+        last_frames[src.get()] = f;
+      }
+      std::fprintf(stderr, "[host] active=%s shown=%llu received:%s\n",
+                   host.active()->name.c_str(), (unsigned long long)shown,
+                   line.c_str());
+      shown = 0;
+      report_us += opt.stats_interval_s * 1000000ll;
+    }
+  }
+
+  shader_thread.join();
+  ingest_thread.join();
+  for (int k = 0; k < 2; ++k) {
+    if (ingest.assemblies[k].sock < 0) continue;
+    ingest.stats[k].StopReporter();
+    ingest.stats[k].Print(stderr);
+    close(ingest.assemblies[k].sock);
+  }
+  close(tcp_sock);
+  close(control_sock);
+  unlink(opt.control_path);
+  if (power.enabled()) power.Print(stderr);
+  if (adaptive_pwm.enabled()) adaptive_pwm.Print(stderr);
+  matrix->Clear();
+  delete matrix;
+  return 0;
+}
@@ -0,0 +1,21 @@
+// mono_clock.h
+// The one clock the daemons time things by: CLOCK_MONOTONIC microseconds,
+// for loop timers, presentation times and stats intervals alike.
+
+#pragma once
+
+#include <time.h>
+
+#include <cstdint>
+
+static inline int64_t MonoMicros() {
+  timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (int64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+// Sleep until a MonoMicros() time; returns early if a signal arrives.
+static inline void SleepUntilMicros(int64_t t_us) {
+  timespec ts = {(time_t)(t_us / 1000000), (long)(t_us % 1000000) * 1000};
+  clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, nullptr);
+}
@@ -0,0 +1,146 @@
+// panel_calibration.h
+// Per-panel color correction for the 4x3 grid of 64x64 panels, so panels
+// from different batches show the same RGB value the same way.
+//
+// Each panel gets a 3x3 color matrix and per-channel gains, folded into one
+// fixed-point matrix (12 fractional bits):
+//   out = clamp(gain * (M * in))
+// Calibration file, one line per panel that needs it (others stay as they
+// are); panels are numbered row by row from the top left, as in matrix_demo:
+//   # panel  gain_r gain_g gain_b  [m00 m01 m02 m10 m11 m12 m20 m21 m22]
+//   3        1.00   0.94   0.90
+//   7        1      1      1       0.97 0.03 0  0 1 0  0 0.04 0.96
+//
+// Apply() corrects one canvas row. The per-pixel loop has no branches or
+// lookups and the coefficients are hoisted out of it, so GCC vectorizes it
+// across pixels: vld3/vst3 plus multiply-accumulate on NEON, and on x86
+// from SSE4.1 up (plain SSE2 has no cheap stride-3 loads and stays scalar).
+// Panels left at identity are skipped.
+
+#pragma once
+
+#include "panel_grid.h"
+
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+
+class PanelCalibration : public PanelGrid {
+ public:
+  PanelCalibration() { Reset(); }
+
+  bool enabled() const { return enabled_; }
+
+  // Read a calibration file (format above). On error prints the line and
+  // returns false, leaving the previous calibration in place.
+  bool Load(const char *path) {
+    FILE *f = std::fopen(path, "r");
+    if (!f) {
+      perror(path);
+      return false;
+    }
+    Coefs next[PANELS];
+    for (Coefs &c : next) c = Identity();
+    bool any = false;
+    char line[256];
+    int lineno = 0;
+    while (std::fgets(line, sizeof(line), f)) {
+      lineno++;
+      const char *p = line + std::strspn(line, " \t");
+      if (*p == '#' || *p == '\n' || *p == '\r' || *p == '\0')
+        continue;
+      int panel;
+      float g[3];
+      float m[9] = {1, 0, 0, 0, 1, 0, 0, 0, 1};
+      int n = std::sscanf(p, "%d %f %f %f %f %f %f %f %f %f %f %f %f", &panel,
+                          &g[0], &g[1], &g[2], &m[0], &m[1], &m[2], &m[3],
+                          &m[4], &m[5], &m[6], &m[7], &m[8]);
+      if ((n != 4 && n != 13) || panel < 0 || panel >= PANELS ||
+          !Fold(g, m, &next[panel])) {
+        std::fprintf(stderr, "%s:%d: want \"panel gain_r gain_g gain_b "
+                     "[9 matrix entries]\", panel 0..%d, values within "
+                     "+/-%d\n", path, lineno, PANELS - 1, MAX_COEF);
+        std::fclose(f);
+        return false;
+      }
+      any = true;
+    }
+    std::fclose(f);
+    std::memcpy(coefs_, next, sizeof(coefs_));
+    enabled_ = any;
+    return true;
+  }
+
+  void Reset() {
+    for (Coefs &c : coefs_) c = Identity();
+    enabled_ = false;
+  }
+
+  // Correct canvas row y (0 = top): `width` rgb24 pixels from `in` to `out`
+  // (which may be `in`).
+  void Apply(const uint8_t *in, uint8_t *out, int y, int width) const {
+    const Coefs *row = &coefs_[(y / PANEL_H) * GRID_COLS];
+    for (int x0 = 0; x0 < width; x0 += PANEL_W) {
+      const Coefs &c = row[x0 / PANEL_W];
+      const int n = width - x0 < PANEL_W ? width - x0 : PANEL_W;
+      if (c.identity) {
+        if (out != in) std::memcpy(out + x0 * 3, in + x0 * 3, n * 3);
+        continue;
+      }
+      ApplyPanel(c, in + x0 * 3, out + x0 * 3, n);
+    }
+  }
+
+ private:
+  static const int SHIFT = 12;
+  static const int MAX_COEF = 4;
+
+  struct Coefs {
+    int32_t m[9];
+    bool identity;
+  };
+
+  static Coefs Identity() {
+    Coefs c;
+    for (int i = 0; i < 9; ++i) c.m[i] = i % 4 == 0 ? 1 << SHIFT : 0;
+    c.identity = true;
+    return c;
+  }
+
+  // Gains scale the rows of the matrix.
+  static bool Fold(const float g[3], const float m[9], Coefs *out) {
+    Coefs c;
+    c.identity = true;
+    for (int i = 0; i < 9; ++i) {
+      float v = g[i / 3] * m[i];
+      if (!(v >= -MAX_COEF && v <= MAX_COEF)) return false;  // and NaN
+      c.m[i] = (int32_t)(v * (1 << SHIFT) + (v < 0 ? -0.5f : 0.5f));
+      if (c.m[i] != (i % 4 == 0 ? 1 << SHIFT : 0)) c.identity = false;
+    }
+    *out = c;
+    return true;
+  }
+
+  static void ApplyPanel(const Coefs &c, const uint8_t *in, uint8_t *out,
+                         int n) {
+    const int32_t m0 = c.m[0], m1 = c.m[1], m2 = c.m[2];
+    const int32_t m3 = c.m[3], m4 = c.m[4], m5 = c.m[5];
+    const int32_t m6 = c.m[6], m7 = c.m[7], m8 = c.m[8];
+    const int32_t round = 1 << (SHIFT - 1);
+    for (int i = 0; i < n; ++i) {
+      const int32_t r = in[3 * i], g = in[3 * i + 1], b = in[3 * i + 2];
+      int32_t R = (m0 * r + m1 * g + m2 * b + round) >> SHIFT;
+      int32_t G = (m3 * r + m4 * g + m5 * b + round) >> SHIFT;
+      int32_t B = (m6 * r + m7 * g + m8 * b + round) >> SHIFT;
+      R = R < 0 ? 0 : R > 255 ? 255 : R;
+      G = G < 0 ? 0 : G > 255 ? 255 : G;
+      B = B < 0 ? 0 : B > 255 ? 255 : B;
+      out[3 * i] = (uint8_t)R;
+      out[3 * i + 1] = (uint8_t)G;
+      out[3 * i + 2] = (uint8_t)B;
+    }
+  }
+
+  Coefs coefs_[PANELS];
+  bool enabled_ = false;
+};
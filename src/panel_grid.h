@@ -0,0 +1,13 @@
+// panel_grid.h
+// The wall's panel layout: a 4x3 grid of 64x64 panels, numbered row by row
+// from the top left. Per-panel stages take their geometry from here.
+
+#pragma once
+
+struct PanelGrid {
+  static const int PANEL_W = 64;
+  static const int PANEL_H = 64;
+  static const int GRID_COLS = 4;
+  static const int GRID_ROWS = 3;
+  static const int PANELS = GRID_COLS * GRID_ROWS;
+};
@@ -0,0 +1,29 @@
+// panel_luminance.h
+// The mapping rpi-rgb-led-matrix applies to the 8-bit values we draw
+// (framebuffer.cc). Each value becomes an 11-bit luminance, through
+// CIE 1931 unless luminance correction is off, scaled by the brightness
+// percentage. The panel shows the top --led-pwm-bits of it, and a LED's
+// on-time is proportional to it.
+
+#pragma once
+
+#include <cmath>
+
+static const int PANEL_BIT_PLANES = 11;  // the library's kBitPlanes
+
+// Luminance of a (possibly fractional) 8-bit value, without the library's
+// rounding.
+static inline double PanelLuminance(double c, int brightness, bool cie) {
+  if (!cie)
+    return c * brightness / 100 * (1 << (PANEL_BIT_PLANES - 8));
+  const double v = c * brightness / 255.0;  // L*, 0..100
+  const double y = v <= 8 ? v / 902.3 : std::pow((v + 16) / 116.0, 3);
+  return ((1 << PANEL_BIT_PLANES) - 1) * y;
+}
+
+// The luminance the library computes for an 8-bit value.
+static inline int PanelLuminanceLevel(int c, int brightness, bool cie) {
+  if (!cie)
+    return (c * brightness / 100) << (PANEL_BIT_PLANES - 8);
+  return (int)std::lround(PanelLuminance(c, brightness, true));
+}
@@ -0,0 +1,271 @@
+// pixel_format.h
+// Pixel layouts the tools take besides packed rgb24, and converters to and
+// from rgb24:
+//   rgb24    r, g, b
+//   rgba     r, g, b, a (canvas readback); alpha is dropped
+//   bgr24    b, g, r (OpenCV)
+//   gray     one byte per pixel, shown as white at that level
+//   yuv420   I420: the Y plane, then U and V at half width and height
+//   nv12     the Y plane, then interleaved U, V at half width and height
+//   bc1      4x4 blocks of 8 bytes (bc1_codec.h), row by row
+//   delta    a motion-compensated delta on the frame before (delta_codec.h)
+// The YUV formats use BT.601 limited range, what video decoders hand out,
+// and take 1.5 bytes per pixel, half of rgb24, so they double as a cheaper
+// wire format. bc1 takes half a byte per pixel at a fixed rate. delta frames
+// vary in length and only decode in order, with a DeltaDecoder; the
+// converters leave them alone, and only the UDP geometry format carries them.
+//
+// Each converter is a template on the format, chosen once per frame, so
+// the pixel loops have no branches on the layout. Rows keep the frame's own
+// order; a bottom-up source (WebGL) stays bottom-up, and the caller picks
+// rows as it did for rgb24.
+
+#pragma once
+
+#include "bc1_codec.h"
+#include "delta_codec.h"
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+
+enum PixelFormat {
+  PIXEL_RGB24,
+  PIXEL_RGBA,
+  PIXEL_BGR24,
+  PIXEL_GRAY,
+  PIXEL_YUV420,
+  PIXEL_NV12,
+  PIXEL_BC1,
+  PIXEL_DELTA,
+  PIXEL_FORMAT_COUNT,
+};
+
+static const char *const PIXEL_FORMAT_NAMES[PIXEL_FORMAT_COUNT] = {
+  "rgb24", "rgba", "bgr24", "gray", "yuv420", "nv12", "bc1", "delta",
+};
+
+static inline const char *PixelFormatName(PixelFormat fmt) {
+  return PIXEL_FORMAT_NAMES[fmt];
+}
+
+// False if `name` is none of the above.
+static inline bool ParsePixelFormat(const char *name, PixelFormat *fmt) {
+  for (int i = 0; i < PIXEL_FORMAT_COUNT; ++i) {
+    if (std::strcmp(name, PIXEL_FORMAT_NAMES[i]) == 0) {
+      *fmt = (PixelFormat)i;
+      return true;
+    }
+  }
+  return false;
+}
+
+// Bytes of one width x height frame, the most a delta frame can take. Odd
+// sizes round the chroma planes up.
+static inline size_t PixelFrameBytes(PixelFormat fmt, int width,
+                                     int height) {
+  const size_t pixels = (size_t)width * height;
+  const size_t chroma = (size_t)((width + 1) / 2) * ((height + 1) / 2);
+  switch (fmt) {
+    case PIXEL_RGB24:
+    case PIXEL_BGR24: return pixels * 3;
+    case PIXEL_RGBA: return pixels * 4;
+    case PIXEL_GRAY: return pixels;
+    case PIXEL_YUV420:
+    case PIXEL_NV12: return pixels + 2 * chroma;
+    case PIXEL_BC1: return Bc1FrameBytes(width, height);
+    case PIXEL_DELTA: return DeltaFrameBytes(width, height);
+    default: return 0;
+  }
+}
+
+namespace pixel_format_internal {
+
+static inline uint8_t Clamp255(int v) {
+  return (uint8_t)(v < 0 ? 0 : v > 255 ? 255 : v);
+}
+
+// BT.601 limited range, 8.8 fixed point.
+static inline void YuvToRgb(int c, int d, int e, uint8_t *out) {
+  out[0] = Clamp255((c + 409 * e + 128) >> 8);
+  out[1] = Clamp255((c - 100 * d - 208 * e + 128) >> 8);
+  out[2] = Clamp255((c + 516 * d + 128) >> 8);
+}
+
+static inline uint8_t RgbToY(int r, int g, int b) {
+  return (uint8_t)(((66 * r + 129 * g + 25 * b + 128) >> 8) + 16);
+}
+static inline uint8_t RgbToU(int r, int g, int b) {
+  return (uint8_t)(((-38 * r - 74 * g + 112 * b + 128) >> 8) + 128);
+}
+static inline uint8_t RgbToV(int r, int g, int b) {
+  return (uint8_t)(((112 * r - 94 * g - 18 * b + 128) >> 8) + 128);
+}
+
+// Row y of a packed frame with `bytes` per pixel; R, G and B are the byte
+// offsets of the channels within a pixel.
+template <int BYTES, int R, int G, int B>
+static void PackedRow(const uint8_t *in, int width, uint8_t *out) {
+  for (int x = 0; x < width; ++x, in += BYTES, out += 3) {
+    out[0] = in[R];
+    out[1] = in[G];
+    out[2] = in[B];
+  }
+}
+
+// A row of luma with its chroma row; U and V of pixel x are at u[x / 2 *
+// step] and v[x / 2 * step].
+template <int STEP>
+static void YuvRow(const uint8_t *luma, const uint8_t *u, const uint8_t *v,
+                   int width, uint8_t *out) {
+  int x = 0;
+  for (; x + 1 < width; x += 2, u += STEP, v += STEP, out += 6) {
+    const int d = u[0] - 128, e = v[0] - 128;
+    YuvToRgb(298 * (luma[x] - 16), d, e, out);
+    YuvToRgb(298 * (luma[x + 1] - 16), d, e, out + 3);
+  }
+  if (x < width) YuvToRgb(298 * (luma[x] - 16), u[0] - 128, v[0] - 128, out);
+}
+
+template <PixelFormat F>
+static void ToRgb24(const uint8_t *frame, int width, int height,
+                    uint8_t *out) {
+  if (F == PIXEL_BC1) {
+    Bc1Decode(frame, width, height, out);
+    return;
+  }
+  const size_t row_bytes = (size_t)width * 3;
+  const size_t luma = (size_t)width * height;
+  const size_t chroma_w = (width + 1) / 2;
+  const size_t chroma = chroma_w * ((height + 1) / 2);
+  for (int y = 0; y < height; ++y, out += row_bytes) {
+    switch (F) {
+      case PIXEL_RGB24:
+        std::memcpy(out, frame + y * row_bytes, row_bytes);
+        break;
+      case PIXEL_RGBA:
+        PackedRow<4, 0, 1, 2>(frame + (size_t)y * width * 4, width, out);
+        break;
+      case PIXEL_BGR24:
+        PackedRow<3, 2, 1, 0>(frame + y * row_bytes, width, out);
+        break;
+      case PIXEL_GRAY:
+        PackedRow<1, 0, 0, 0>(frame + (size_t)y * width, width, out);
+        break;
+      case PIXEL_YUV420: {
+        const uint8_t *u = frame + luma + (y / 2) * chroma_w;
+        YuvRow<1>(frame + (size_t)y * width, u, u + chroma, width, out);
+        break;
+      }
+      case PIXEL_NV12: {
+        const uint8_t *uv = frame + luma + (y / 2) * chroma_w * 2;
+        YuvRow<2>(frame + (size_t)y * width, uv, uv + 1, width, out);
+        break;
+      }
+      default:
+        break;
+    }
+  }
+}
+
+// The mean of the up to 2x2 rgb24 pixels at chroma position (cx, cy).
+static inline void Mean2x2(const uint8_t *rgb, int width, int height,
+                           int cx, int cy, int *r, int *g, int *b) {
+  const int x1 = 2 * cx + 1 < width ? 2 * cx + 1 : 2 * cx;
+  const int y1 = 2 * cy + 1 < height ? 2 * cy + 1 : 2 * cy;
+  const uint8_t *p[4] = {
+    rgb + ((size_t)2 * cy * width + 2 * cx) * 3,
+    rgb + ((size_t)2 * cy * width + x1) * 3,
+    rgb + ((size_t)y1 * width + 2 * cx) * 3,
+    rgb + ((size_t)y1 * width + x1) * 3,
+  };
+  *r = (p[0][0] + p[1][0] + p[2][0] + p[3][0] + 2) >> 2;
+  *g = (p[0][1] + p[1][1] + p[2][1] + p[3][1] + 2) >> 2;
+  *b = (p[0][2] + p[1][2] + p[2][2] + p[3][2] + 2) >> 2;
+}
+
+template <PixelFormat F>
+static void FromRgb24(const uint8_t *rgb, int width, int height,
+                      uint8_t *out) {
+  const size_t pixels = (size_t)width * height;
+  switch (F) {
+    case PIXEL_RGB24:
+      std::memcpy(out, rgb, pixels * 3);
+      return;
+    case PIXEL_RGBA:
+      for (size_t i = 0; i < pixels; ++i, rgb += 3, out += 4) {
+        out[0] = rgb[0];
+        out[1] = rgb[1];
+        out[2] = rgb[2];
+        out[3] = 255;
+      }
+      return;
+    case PIXEL_BGR24:
+      PackedRow<3, 2, 1, 0>(rgb, (int)pixels, out);
+      return;
+    case PIXEL_GRAY:
+      for (size_t i = 0; i < pixels; ++i, rgb += 3)
+        out[i] = (uint8_t)((2 * rgb[0] + 5 * rgb[1] + rgb[2]) >> 3);
+      return;
+    case PIXEL_YUV420:
+    case PIXEL_NV12: {
+      for (size_t i = 0; i < pixels; ++i)
+        out[i] = RgbToY(rgb[3 * i], rgb[3 * i + 1], rgb[3 * i + 2]);
+      const int cw = (width + 1) / 2, ch = (height + 1) / 2;
+      uint8_t *u = out + pixels;
+      uint8_t *v = F == PIXEL_NV12 ? u + 1 : u + (size_t)cw * ch;
+      const int step = F == PIXEL_NV12 ? 2 : 1;
+      for (int cy = 0; cy < ch; ++cy) {
+        for (int cx = 0; cx < cw; ++cx, u += step, v += step) {
+          int r, g, b;
+          Mean2x2(rgb, width, height, cx, cy, &r, &g, &b);
+          *u = RgbToU(r, g, b);
+          *v = RgbToV(r, g, b);
+        }
+      }
+      return;
+    }
+    case PIXEL_BC1:
+      Bc1Encode(rgb, width, height, out);
+      return;
+    default:
+      return;
+  }
+}
+
+}  // namespace pixel_format_internal
+
+// Convert a width x height frame in `fmt` to rgb24 `out`.
+static inline void ConvertToRgb24(PixelFormat fmt, const uint8_t *frame,
+                                  int width, int height, uint8_t *out) {
+  using namespace pixel_format_internal;
+  switch (fmt) {
+    case PIXEL_RGB24: ToRgb24<PIXEL_RGB24>(frame, width, height, out); break;
+    case PIXEL_RGBA: ToRgb24<PIXEL_RGBA>(frame, width, height, out); break;
+    case PIXEL_BGR24: ToRgb24<PIXEL_BGR24>(frame, width, height, out); break;
+    case PIXEL_GRAY: ToRgb24<PIXEL_GRAY>(frame, width, height, out); break;
+    case PIXEL_YUV420: ToRgb24<PIXEL_YUV420>(frame, width, height, out); break;
+    case PIXEL_NV12: ToRgb24<PIXEL_NV12>(frame, width, height, out); break;
+    case PIXEL_BC1: ToRgb24<PIXEL_BC1>(frame, width, height, out); break;
+    default: break;
+  }
+}
+
+// Convert a width x height rgb24 frame to `fmt`, PixelFrameBytes() long.
+// YUV chroma is the mean of each 2x2 block.
+static inline void ConvertFromRgb24(PixelFormat fmt, const uint8_t *rgb,
+                                    int width, int height, uint8_t *out) {
+  using namespace pixel_format_internal;
+  switch (fmt) {
+    case PIXEL_RGB24: FromRgb24<PIXEL_RGB24>(rgb, width, height, out); break;
+    case PIXEL_RGBA: FromRgb24<PIXEL_RGBA>(rgb, width, height, out); break;
+    case PIXEL_BGR24: FromRgb24<PIXEL_BGR24>(rgb, width, height, out); break;
+    case PIXEL_GRAY: FromRgb24<PIXEL_GRAY>(rgb, width, height, out); break;
+    case PIXEL_YUV420:
+      FromRgb24<PIXEL_YUV420>(rgb, width, height, out);
+      break;
+    case PIXEL_NV12: FromRgb24<PIXEL_NV12>(rgb, width, height, out); break;
+    case PIXEL_BC1: FromRgb24<PIXEL_BC1>(rgb, width, height, out); break;
+    default: break;
+  }
+}
@@ -0,0 +1,225 @@
+// power_limit.h
+// Estimates the supply current of every frame, for the wall and for each
+// 64x64 panel, and scales down the frames that would go over budget.
+//
+// A LED's average current is its peak current times its PWM on-time, and
+// the on-time follows the library's luminance of the 8-bit value
+// (panel_luminance.h), not the value itself. So the current of a frame is
+// a sum of per-channel table lookups over its pixels. --led-ma gives what
+// one LED of each colour draws at full on-time, averaged over the scan.
+//
+// A frame over budget is scaled at once, so the supply never sees it.
+// The scale then recovers by 1/16 of the remaining gap per frame, about a
+// third of a second at 60 fps, so content that hovers around the limit
+// does not make the brightness pump. Scaling a panel remaps its codes
+// through a table so their on-time drops by the scale, rounding down.
+//
+// Per frame: Measure() every row, Finish(), then Apply() every row. Every
+// stats interval Finish() also prints a [power] line, for sizing supplies.
+
+#pragma once
+
+#include "cli_flags.h"
+#include "mono_clock.h"
+#include "panel_grid.h"
+#include "panel_luminance.h"
+
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+
+struct PowerOptions {
+  bool enabled = false;      // any of the flags below
+  double wall_limit_a = 0;   // 0: no limit, only measure
+  double panel_limit_a = 0;
+  double led_ma[3] = {0.36, 0.31, 0.31};  // ~4 A for a white 64x64 panel
+  int stats_interval_s = 5;  // the tool's --stats-interval; 0: no reports
+};
+
+// --current-limit, --panel-current-limit and --led-ma. Returns 1 if `arg`
+// was one of them, -1 if its value is bad, 0 if it is not ours.
+static inline int ParsePowerFlag(const char *arg, PowerOptions *opt) {
+  const char *v;
+  if ((v = FlagValue(arg, "--current-limit"))) {
+    opt->wall_limit_a = std::atof(v);
+  } else if ((v = FlagValue(arg, "--panel-current-limit"))) {
+    opt->panel_limit_a = std::atof(v);
+  } else if ((v = FlagValue(arg, "--led-ma"))) {
+    double *m = opt->led_ma;
+    if (std::sscanf(v, "%lf,%lf,%lf", &m[0], &m[1], &m[2]) != 3 ||
+        !(m[0] >= 0 && m[1] >= 0 && m[2] >= 0 && m[0] + m[1] + m[2] < 60)) {
+      std::fprintf(stderr, "--led-ma wants R,G,B milliamps per LED\n");
+      return -1;
+    }
+  } else {
+    return 0;
+  }
+  if (opt->wall_limit_a < 0 || opt->panel_limit_a < 0) {
+    std::fprintf(stderr, "Current limits must be positive amps\n");
+    return -1;
+  }
+  opt->enabled = true;
+  return 1;
+}
+
+class PowerLimiter : public PanelGrid {
+ public:
+  // brightness and luminance correction as the matrix has them.
+  void Configure(const PowerOptions &opt, int brightness,
+                 bool luminance_correct) {
+    enabled_ = opt.enabled;
+    wall_limit_ua_ = opt.wall_limit_a * 1e6;
+    panel_limit_ua_ = opt.panel_limit_a * 1e6;
+    for (int c = 0; c < 256; ++c) {
+      level_[c] = PanelLuminanceLevel(c, brightness, luminance_correct);
+      const double on = (double)level_[c] / ((1 << PANEL_BIT_PLANES) - 1);
+      for (int ch = 0; ch < 3; ++ch)
+        ua_[ch][c] = (uint16_t)(opt.led_ma[ch] * 1000 * on + 0.5);
+    }
+    for (int p = 0; p < PANELS; ++p) {
+      scale_[p] = 1;
+      for (int c = 0; c < 256; ++c) remap_[p][c] = (uint8_t)c;
+    }
+    std::memset(sum_ua_, 0, sizeof(sum_ua_));
+    ResetStats();
+    report_interval_us_ = opt.stats_interval_s * 1000000ll;
+    report_us_ = MonoMicros() + report_interval_us_;
+  }
+
+  bool enabled() const { return enabled_; }
+
+  // Add canvas row y (0 = top), `width` rgb24 pixels, to this frame.
+  void Measure(const uint8_t *row, int y, int width) {
+    uint32_t *sum = &sum_ua_[(y / PANEL_H) * GRID_COLS];
+    for (int x0 = 0; x0 < width; x0 += PANEL_W) {
+      const int n = width - x0 < PANEL_W ? width - x0 : PANEL_W;
+      const uint8_t *p = row + x0 * 3;
+      uint32_t s = 0;
+      for (int i = 0; i < n; ++i, p += 3)
+        s += ua_[0][p[0]] + ua_[1][p[1]] + ua_[2][p[2]];
+      sum[x0 / PANEL_W] += s;
+    }
+  }
+
+  // Settle the scales for the frame measured since the last call.
+  void Finish() {
+    double total = 0;
+    for (uint32_t s : sum_ua_) total += s;
+    const double wall_need =
+        wall_limit_ua_ > 0 && total > wall_limit_ua_ ? wall_limit_ua_ / total
+                                                     : 1;
+    double shown = 0;
+    bool limited = false;
+    int busiest = 0;
+    for (int p = 0; p < PANELS; ++p) {
+      double need = wall_need;
+      if (panel_limit_ua_ > 0 && sum_ua_[p] > panel_limit_ua_ &&
+          panel_limit_ua_ / sum_ua_[p] < need) {
+        need = panel_limit_ua_ / sum_ua_[p];
+      }
+      double s = scale_[p] + (1 - scale_[p]) / RECOVERY;
+      if (s > 0.999) s = 1;
+      if (s > need) s = need;
+      if (s != scale_[p]) {
+        scale_[p] = s;
+        BuildRemap(p);
+      }
+      limited |= s < 1;
+      shown += sum_ua_[p] * s;
+      if (sum_ua_[p] > sum_ua_[busiest]) busiest = p;
+      if (s < min_scale_) min_scale_ = s;
+    }
+
+    frames_++;
+    limited_frames_ += limited;
+    active_ = limited;
+    demand_sum_ += total;
+    if (total > demand_peak_) demand_peak_ = total;
+    if (shown > shown_peak_) shown_peak_ = shown;
+    if (sum_ua_[busiest] > panel_peak_) {
+      panel_peak_ = sum_ua_[busiest];
+      panel_peak_index_ = busiest;
+    }
+    std::memset(sum_ua_, 0, sizeof(sum_ua_));
+
+    if (report_interval_us_ > 0 && MonoMicros() >= report_us_) {
+      Print(stderr);
+      report_us_ += report_interval_us_;
+    }
+  }
+
+  // Whether Apply() changes anything this frame.
+  bool active() const { return active_; }
+
+  // Scale canvas row y: `width` rgb24 pixels from `in` to `out` (which may
+  // be `in`).
+  void Apply(const uint8_t *in, uint8_t *out, int y, int width) const {
+    const int first = (y / PANEL_H) * GRID_COLS;
+    for (int x0 = 0; x0 < width; x0 += PANEL_W) {
+      const int p = first + x0 / PANEL_W;
+      const int n = (width - x0 < PANEL_W ? width - x0 : PANEL_W) * 3;
+      if (scale_[p] == 1) {
+        if (out != in) std::memcpy(out + x0 * 3, in + x0 * 3, n);
+        continue;
+      }
+      const uint8_t *map = remap_[p];
+      for (int i = x0 * 3; i < x0 * 3 + n; ++i) out[i] = map[in[i]];
+    }
+  }
+
+  // One line about the frames since the last report: what they asked of
+  // the supply (mean and peak), what was shown after limiting, the busiest
+  // panel, and how much limiting it took.
+  void Print(FILE *out) {
+    if (frames_ == 0) return;
+    const double mean = demand_sum_ / frames_ / 1e6;
+    std::fprintf(out, "[power] demand mean %.1f A, peak %.1f A (%.0f W at "
+                 "%.0f V); shown peak %.1f A; busiest panel %d at %.2f A; "
+                 "limited %.0f%% of frames, lowest scale %.2f\n", mean,
+                 demand_peak_ / 1e6, demand_peak_ / 1e6 * SUPPLY_VOLTS,
+                 SUPPLY_VOLTS, shown_peak_ / 1e6, panel_peak_index_,
+                 panel_peak_ / 1e6, 100.0 * limited_frames_ / frames_,
+                 min_scale_);
+    ResetStats();
+  }
+
+ private:
+  static const int RECOVERY = 16;       // frames to close 63% of the gap
+  static constexpr double SUPPLY_VOLTS = 5.0;
+
+  // Codes of panel p whose on-time is at most scale times the original.
+  void BuildRemap(int p) {
+    const double s = scale_[p];
+    int k = 0;
+    for (int c = 0; c < 256; ++c) {
+      const double want = s * level_[c];
+      while (k < 255 && level_[k + 1] <= want) k++;
+      remap_[p][c] = (uint8_t)k;
+    }
+  }
+
+  void ResetStats() {
+    frames_ = limited_frames_ = 0;
+    demand_sum_ = demand_peak_ = shown_peak_ = panel_peak_ = 0;
+    panel_peak_index_ = 0;
+    min_scale_ = 1;
+  }
+
+  bool enabled_ = false;
+  bool active_ = false;
+  double wall_limit_ua_ = 0;
+  double panel_limit_ua_ = 0;
+  int level_[256];
+  uint16_t ua_[3][256];       // microamps per LED and code
+  uint32_t sum_ua_[PANELS];   // this frame, so far
+  double scale_[PANELS];
+  uint8_t remap_[PANELS][256];
+
+  uint64_t frames_, limited_frames_;
+  double demand_sum_, demand_peak_, shown_peak_, panel_peak_;
+  int panel_peak_index_;
+  double min_scale_;
+  int64_t report_interval_us_ = 0;
+  int64_t report_us_ = 0;
+};
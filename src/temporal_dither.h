@@ -0,0 +1,143 @@
+// temporal_dither.h
+// Quantizes 16-bit-per-channel frames to what the panels can actually show.
+// The dither pattern moves every frame, so smooth dark gradients survive
+// low --led-pwm-bits.
+//
+// rpi-rgb-led-matrix maps 8-bit values to 11-bit luminance and shows only
+// the top pwm-bits of that (panel_luminance.h). Below 11 bits many dark
+// 8-bit codes land on the same level; at 8 bits, codes 0..8 are all black.
+// A gradient then bands however fine its source was. Configure() uses the
+// library's mapping. For each 16-bit input value it finds the neighbouring 8-bit
+// codes whose displayed levels bracket the light the value asks for, and
+// where between them it lies. Quantize() picks one of the two per pixel
+// against a 4x4 ordered-dither threshold. NextFrame() rotates the
+// thresholds, so over 16 frames every pixel averages to the right light.
+//
+// Per channel that is one lookup in an 8 KB table (the top 12 input bits),
+// a compare and an add.
+
+#pragma once
+
+#include "panel_luminance.h"
+
+#include <time.h>
+
+#include <cstdint>
+#include <vector>
+
+class TemporalDither {
+ public:
+  // pwm_bits, brightness (percent) and luminance correction as the matrix
+  // has them.
+  void Configure(int pwm_bits, int brightness, bool luminance_correct) {
+    pwm_bits_ = pwm_bits;
+    brightness_ = brightness;
+    luminance_correct_ = luminance_correct;
+    const int drop = PANEL_BIT_PLANES - pwm_bits;  // planes not shown
+    int level[256];
+    for (int c = 0; c < 256; ++c) {
+      level[c] =
+          PanelLuminanceLevel(c, brightness, luminance_correct) >> drop;
+    }
+    levels_ = 1;
+    for (int c = 1; c < 256; ++c) levels_ += level[c] != level[c - 1];
+
+    // t rises with i, so the first code showing more than t only moves up.
+    int k = 0;
+    for (int i = 0; i < TABLE_SIZE; ++i) {
+      const double x = (i * 16 + 8) / 257.0;  // bin centre in 8-bit units
+      const double t = PanelLuminance(x, brightness, luminance_correct) /
+                       (1 << drop);
+      while (k < 256 && level[k] <= t) k++;
+      Entry &e = table_[i];
+      if (k == 0 || k == 256) {
+        e.lo = (uint8_t)(k == 0 ? 0 : 255);
+        e.frac = 0;
+        continue;
+      }
+      e.lo = (uint8_t)(k - 1);
+      const double f = (t - level[k - 1]) / (level[k] - level[k - 1]);
+      const int frac = (int)(f * 256 + 0.5);
+      e.frac = (uint8_t)(frac > 255 ? 255 : frac);
+    }
+    SetThresholds();
+  }
+
+  // Follow a change of the panel's PWM bits (see adaptive_pwm.h).
+  void SetPwmBits(int pwm_bits) {
+    if (pwm_bits != pwm_bits_)
+      Configure(pwm_bits, brightness_, luminance_correct_);
+  }
+
+  // Distinct levels a channel can show at this configuration.
+  int levels() const { return levels_; }
+
+  // Quantize canvas row y: `count` pixels of 16-bit r, g, b from `in` to
+  // rgb24 `out`.
+  void Quantize(const uint16_t *in, uint8_t *out, int y, int count) const {
+    const uint8_t *th = threshold_[y & 3];
+    for (int x = 0; x < count; ++x, in += 3, out += 3) {
+      const int t = th[x & 3];
+      const Entry r = table_[in[0] >> 4];
+      const Entry g = table_[in[1] >> 4];
+      const Entry b = table_[in[2] >> 4];
+      out[0] = (uint8_t)(r.lo + (r.frac > t));
+      out[1] = (uint8_t)(g.lo + (g.frac > t));
+      out[2] = (uint8_t)(b.lo + (b.frac > t));
+    }
+  }
+
+  // Move the pattern on; call once per frame shown.
+  void NextFrame() {
+    phase_ = (phase_ + PHASE_STEP) & 15;
+    SetThresholds();
+  }
+
+  // Time Quantize() over a whole frame of varied pixels, in microseconds.
+  double MicrosPerFrame(int width, int height) const {
+    std::vector<uint16_t> frame((size_t)width * height * 3);
+    for (size_t i = 0; i < frame.size(); ++i)
+      frame[i] = (uint16_t)(i * 2654435761u >> 11);
+    std::vector<uint8_t> row((size_t)width * 3);
+    const int reps = 20;
+    timespec a, b;
+    clock_gettime(CLOCK_MONOTONIC, &a);
+    for (int k = 0; k < reps; ++k) {
+      for (int y = 0; y < height; ++y)
+        Quantize(&frame[(size_t)y * width * 3], row.data(), y, width);
+    }
+    clock_gettime(CLOCK_MONOTONIC, &b);
+    return ((b.tv_sec - a.tv_sec) * 1e6 + (b.tv_nsec - a.tv_nsec) / 1e3) /
+           reps;
+  }
+
+ private:
+  // The code to show is lo, or lo + 1 when frac is above the threshold.
+  struct Entry {
+    uint8_t lo;    // code below the wanted light
+    uint8_t frac;  // how far towards lo + 1, 0..255
+  };
+
+  static const int TABLE_SIZE = 4096;
+  static const int PHASE_STEP = 7;  // odd: visits all 16 phases
+
+  // 4x4 Bayer thresholds, all shifted by the phase, in the middle of each
+  // sixteenth so a frac of n/16 shows lo + 1 on exactly n of them.
+  void SetThresholds() {
+    static const uint8_t BAYER[4][4] = {
+      {0, 8, 2, 10}, {12, 4, 14, 6}, {3, 11, 1, 9}, {15, 7, 13, 5},
+    };
+    for (int y = 0; y < 4; ++y) {
+      for (int x = 0; x < 4; ++x)
+        threshold_[y][x] = (uint8_t)(((BAYER[y][x] + phase_) & 15) * 16 + 8);
+    }
+  }
+
+  Entry table_[TABLE_SIZE];
+  uint8_t threshold_[4][4];
+  int phase_ = 0;
+  int levels_ = 0;
+  int pwm_bits_ = 0;
+  int brightness_ = 100;
+  bool luminance_correct_ = true;
+};
@@ -0,0 +1,177 @@
+// udp_clock_sync.h
+// Receiver side of synchronized presentation (see udp_frame_protocol.h).
+//
+// Listens on the sync port for the sender's per-frame presentation
+// timestamps, and probes the sender's clock NTP style a few times a
+// second. Of the last few probes the one with the smallest round trip
+// wins (NTP's clock filter): queueing delay only ever adds to the round
+// trip, so the fastest exchange has the least asymmetric error.
+//
+// Probes go out from their own ephemeral socket, so replies reach this
+// receiver even when several share the sync port on one host.
+//
+// Runs its own thread; PresentTime() may be called from any thread.
+
+#pragma once
+
+#include "io_loop.h"
+#include "udp_frame_protocol.h"
+
+#include <netinet/in.h>
+#include <sys/socket.h>
+
+#include <atomic>
+#include <cstdint>
+#include <cstdio>
+#include <mutex>
+#include <thread>
+
+class ClockSync {
+ public:
+  ~ClockSync() { Stop(); }
+
+  // Take over `sock` (bound to the sync port) and start the thread.
+  bool Start(int sock, const char *io_backend, int probe_ms = 250) {
+    sock_ = sock;
+    probe_sock_ = socket(AF_INET, SOCK_DGRAM, 0);
+    if (probe_sock_ < 0) {
+      perror("socket");
+      return false;
+    }
+    probe_us_ = probe_ms * 1000ll;
+    thread_ = std::thread([this, io_backend, probe_ms]() {
+      std::unique_ptr<IoLoop> loop = IoLoop::Create(io_backend);
+      DatagramFn fn = [this](const uint8_t *data, size_t n,
+                             const sockaddr_in &from, int, bool) {
+        OnDatagram(data, n, from);
+      };
+      loop->AddDatagramSocket(sock_, fn);
+      loop->AddDatagramSocket(probe_sock_, fn);
+      loop->SetTick(probe_ms, [this]() {
+        const int64_t now = MonoMicros();
+        if (now >= next_probe_us_) {
+          next_probe_us_ = now + probe_us_;
+          SendProbe();
+        }
+      });
+      loop->Run(&stop_);
+    });
+    return true;
+  }
+
+  void Stop() {
+    stop_ = true;
+    if (thread_.joinable()) thread_.join();
+    if (sock_ >= 0) close(sock_);
+    if (probe_sock_ >= 0) close(probe_sock_);
+    sock_ = probe_sock_ = -1;
+  }
+
+  // Local time at which frame_id should be on the wall, if we have both
+  // its timestamp and a clock offset.
+  bool PresentTime(uint16_t frame_id, int64_t *local_us) {
+    if (!synced_.load(std::memory_order_acquire))
+      return false;
+    std::lock_guard<std::mutex> l(mu_);
+    const PtsEntry &e = pts_[frame_id % PTS_TABLE];
+    if (!e.valid || e.frame_id != frame_id)
+      return false;
+    *local_us = (int64_t)e.pts - offset_us_.load(std::memory_order_relaxed);
+    return true;
+  }
+
+  // The sender's timestamp for frame_id, clock offset or not (for the
+  // jitter buffer, which needs no offset).
+  bool Pts(uint16_t frame_id, uint64_t *pts) {
+    std::lock_guard<std::mutex> l(mu_);
+    const PtsEntry &e = pts_[frame_id % PTS_TABLE];
+    if (!e.valid || e.frame_id != frame_id)
+      return false;
+    *pts = e.pts;
+    return true;
+  }
+
+  bool synced() const { return synced_.load(std::memory_order_acquire); }
+  int64_t offset_us() const { return offset_us_.load(std::memory_order_relaxed); }
+  int64_t rtt_us() const { return rtt_us_.load(std::memory_order_relaxed); }
+
+ private:
+  static const int PTS_TABLE = 256;
+  static const int FILTER = 8;  // probes the clock filter looks at
+
+  struct PtsEntry {
+    bool valid = false;
+    uint16_t frame_id = 0;
+    uint64_t pts = 0;
+  };
+  struct Sample {
+    int64_t offset = 0;
+    int64_t rtt = INT64_MAX;
+  };
+
+  void OnDatagram(const uint8_t *data, size_t n, const sockaddr_in &from) {
+    uint16_t frame_id;
+    uint64_t pts;
+    ClockProbe p;
+    if (ParsePts(data, n, &frame_id, &pts)) {
+      // The sender's data socket sends the timestamps and answers probes.
+      if (!have_sender_ || from.sin_addr.s_addr != sender_.sin_addr.s_addr ||
+          from.sin_port != sender_.sin_port) {
+        sender_ = from;
+        have_sender_ = true;
+        for (Sample &s : samples_) s = Sample();
+      }
+      std::lock_guard<std::mutex> l(mu_);
+      PtsEntry &e = pts_[frame_id % PTS_TABLE];
+      e.valid = true;
+      e.frame_id = frame_id;
+      e.pts = pts;
+    } else if (ParseClockProbe(data, n, true, &p) && p.seq <= seq_ &&
+               seq_ - p.seq < FILTER) {
+      const int64_t t4 = MonoMicros();
+      Sample s;
+      s.offset = ((int64_t)(p.t2 - p.t1) + (int64_t)(p.t3 - t4)) / 2;
+      s.rtt = (t4 - (int64_t)p.t1) - (int64_t)(p.t3 - p.t2);
+      samples_[p.seq % FILTER] = s;
+      const Sample *best = &samples_[0];
+      for (const Sample &c : samples_) {
+        if (c.rtt < best->rtt) best = &c;
+      }
+      offset_us_.store(best->offset, std::memory_order_relaxed);
+      rtt_us_.store(best->rtt, std::memory_order_relaxed);
+      synced_.store(true, std::memory_order_release);
+    }
+  }
+
+  void SendProbe() {
+    if (!have_sender_)
+      return;
+    ClockProbe p;
+    p.seq = ++seq_;
+    p.t1 = MonoMicros();
+    samples_[p.seq % FILTER] = Sample();  // unanswered until the reply
+    uint8_t buf[CLKQ_SIZE];
+    size_t len = BuildClockProbe(buf, false, p);
+    sendto(probe_sock_, buf, len, 0, (const sockaddr *)&sender_,
+           sizeof(sender_));
+  }
+
+  int sock_ = -1;
+  int probe_sock_ = -1;
+  std::thread thread_;
+  volatile bool stop_ = false;
+
+  // Sync thread only.
+  sockaddr_in sender_;
+  bool have_sender_ = false;
+  uint32_t seq_ = 0;
+  int64_t probe_us_ = 0;
+  int64_t next_probe_us_ = 0;
+  Sample samples_[FILTER];
+
+  std::mutex mu_;
+  PtsEntry pts_[PTS_TABLE];
+  std::atomic<bool> synced_{false};
+  std::atomic<int64_t> offset_us_{0};  // sender clock minus ours
+  std::atomic<int64_t> rtt_us_{0};
+};
@@ -0,0 +1,425 @@
+// udp_frame_assembly.h
+// Reassemble frames from UDP packets (see udp_frame_protocol.h) and keep the
+// per-source counters in udp_stream_stats.h up to date.
+//
+// Each assembly has two frame slots. Normally only the current one is used
+// and a new frame id simply replaces it. With NACKs enabled an incomplete
+// frame is parked in the pending slot when the next frame starts, so
+// retransmissions can still complete it until its deadline.
+//
+// Delta frames are decoded to rgb24 here, as each completes, so the queues
+// after the assembly (which may drop frames) only ever carry frames that
+// stand on their own.
+//
+// An incomplete bc1 frame is shown anyway when the next frame starts: its
+// blocks sit at fixed offsets, and each new bc1 frame starts out as a copy
+// of the last one shown, so the blocks of lost packets show what was there
+// before.
+
+#pragma once
+
+#include "delta_codec.h"
+#include "udp_frame_protocol.h"
+#include "udp_stream_stats.h"
+
+#include <netinet/in.h>
+#include <sys/socket.h>
+
+#include <algorithm>
+#include <cstring>
+#include <vector>
+
+// A packet whose frame_id is at most this many frames behind the current one
+// is a late straggler and is dropped; anything further back is taken as a
+// sender restart.
+static const int STALE_FRAME_WINDOW = 8;
+
+struct FrameSlot {
+  bool active = false;
+  bool complete = false;
+  uint16_t frame_id = 0;
+  uint16_t expected_packets = 0;
+  uint16_t width = 0;             // this frame's size and layout
+  uint16_t height = 0;
+  PixelFormat format = PIXEL_RGB24;
+  size_t bytes = 0;
+  std::vector<uint8_t> buf;       // at least `bytes`
+  std::vector<bool> got_packet;
+  std::vector<uint32_t> offsets;  // of the packets in got_packet
+  std::vector<bool> nacked;
+  size_t received_packets = 0;
+  int highest_index = -1;
+  int last_index = -1;
+  uint32_t next_offset = 0;       // where the packet after last_index lands
+  UdpSourceStats *src = nullptr;
+  sockaddr_in from;               // NACKs go back here
+  uint64_t start_us = 0;
+  uint64_t last_packet_us = 0;
+  uint64_t last_nack_us = 0;
+};
+
+// Reassembly state for one listening socket. Each wire format gets its own,
+// so a compact and a geometry sender never clobber each other's frames.
+struct FrameAssembly {
+  WireFormat fmt = WIRE_COMPACT;
+  int port = 0;
+  int sock = -1;
+  size_t chunk_size = 1024;       // compact payload stride
+  int width = 0;                  // of compact frames; geometry frames
+  int height = 0;                 // carry their own
+  // With --rx-threads=N each assembly only sees every Nth frame id.
+  int id_stride = 1;
+
+  // NACK mode (compact format only): ask for holes once the frame is
+  // nack_delay_us old, repeat every nack_delay_us, give up at the deadline.
+  bool nack = false;
+  uint64_t nack_delay_us = 3000;
+  uint64_t nack_deadline_us = 50000;
+
+  FrameSlot slots[2];
+  int cur = 0;
+  std::vector<uint8_t> shown;     // the last bc1 frame handed out
+  DeltaDecoder delta;             // the reference for delta frames
+
+  void Init(int w, int h) {
+    width = w;
+    height = h;
+    for (FrameSlot &s : slots) s.buf.assign((size_t)w * h * 3, 0);
+  }
+  FrameSlot &Current() { return slots[cur]; }
+  FrameSlot &Pending() { return slots[cur ^ 1]; }
+};
+
+// Drop a slot, accounting for what never arrived.
+static inline void FinishSlot(FrameSlot *s) {
+  if (s->active && !s->complete && s->src) {
+    StatAdd(s->src->frames_incomplete);
+    StatAdd(s->src->lost, s->expected_packets - s->received_packets);
+  }
+  s->active = false;
+}
+
+static inline void StartSlot(const FrameAssembly &a, FrameSlot *s,
+                             const FramePacket &pkt,
+                             UdpSourceStats *src, const sockaddr_in &from,
+                             uint64_t now_us) {
+  // No timestamp on the wire: jitter tracks variation of the frame period.
+  if (src->last_frame_start_us != 0)
+    UdpStreamStats::UpdateJitter(src, now_us - src->last_frame_start_us);
+  src->last_frame_start_us = now_us;
+
+  s->active = true;
+  s->complete = false;
+  s->frame_id = pkt.frame_id;
+  s->expected_packets = pkt.count;
+  s->width = a.fmt == WIRE_GEOMETRY ? pkt.width : (uint16_t)a.width;
+  s->height = a.fmt == WIRE_GEOMETRY ? pkt.height : (uint16_t)a.height;
+  s->format = pkt.format;
+  s->bytes = PixelFrameBytes(s->format, s->width, s->height);
+  if (s->buf.size() < s->bytes)
+    s->buf.resize(s->bytes);  // a bigger geometry frame than before
+  s->got_packet.assign(pkt.count, false);
+  s->offsets.assign(pkt.count, 0);
+  s->nacked.assign(pkt.count, false);
+  s->received_packets = 0;
+  s->highest_index = -1;
+  s->last_index = -1;
+  s->next_offset = 0;
+  s->src = src;
+  s->from = from;
+  s->start_us = now_us;
+  s->last_packet_us = now_us;
+  s->last_nack_us = 0;
+  if (s->format == PIXEL_BC1 && a.shown.size() == s->bytes)
+    std::memcpy(s->buf.data(), a.shown.data(), s->bytes);
+  else
+    std::fill(s->buf.begin(), s->buf.begin() + s->bytes, 0);
+}
+
+// Make way for a new frame in the current slot. An incomplete bc1 frame
+// with any packets is still worth showing, so it moves to the pending slot
+// and is returned in *partial; other incomplete frames are dropped.
+static inline void RetireCurrent(FrameAssembly *a, FrameSlot **partial) {
+  FrameSlot &cur = a->Current();
+  const bool show = cur.active && !cur.complete &&
+                    cur.format == PIXEL_BC1 && cur.received_packets > 0;
+  FinishSlot(&cur);
+  if (show) {
+    FinishSlot(&a->Pending());
+    *partial = &cur;
+    a->cur ^= 1;
+  }
+}
+
+// Geometry packets carry no frame id, so (like udp_led_receiver.py) we infer
+// a new frame: a changed chunk count, size or format, or a chunk we already
+// hold arriving again after other chunks (senders emit chunks in order, so
+// that is the next frame rather than a duplicate). Frames of one packet,
+// as small delta frames are, have no other chunks: any packet after one
+// completed starts the next. A duplicate then shows its frame again.
+static inline bool GeometryStartsNewFrame(const FrameSlot &s,
+                                          const FramePacket &pkt) {
+  if (!s.active || pkt.count != s.expected_packets ||
+      pkt.width != s.width || pkt.height != s.height ||
+      pkt.format != s.format) {
+    return true;
+  }
+  if (s.expected_packets == 1) return s.complete;
+  return pkt.index < s.expected_packets && s.got_packet[pkt.index] &&
+         (int)pkt.index != s.last_index;
+}
+
+// Pick the slot a packet belongs to, starting a new frame if needed.
+// Returns nullptr for stragglers of frames we already gave up on. A partial
+// frame the new one replaced is left in *partial.
+static inline FrameSlot *RouteToSlot(FrameAssembly *a, const FramePacket &pkt,
+                                     UdpSourceStats *src,
+                                     const sockaddr_in &from, uint64_t now_us,
+                                     FrameSlot **partial) {
+  FrameSlot &cur = a->Current();
+  if (!pkt.has_frame_id) {
+    if (GeometryStartsNewFrame(cur, pkt)) {
+      RetireCurrent(a, partial);
+      StartSlot(*a, &a->Current(), pkt, src, from, now_us);
+    }
+    return &a->Current();
+  }
+
+  if (cur.active && pkt.frame_id == cur.frame_id)
+    return &cur;
+  FrameSlot &pend = a->Pending();
+  if (pend.active && pkt.frame_id == pend.frame_id)
+    return &pend;
+
+  if (cur.active) {
+    int16_t ahead = (int16_t)(pkt.frame_id - cur.frame_id);
+    if (ahead < 0 && ahead >= -STALE_FRAME_WINDOW * a->id_stride) {
+      StatAdd(src->reordered);  // straggler from a frame we moved past
+      return nullptr;
+    }
+    if (ahead > a->id_stride)
+      StatAdd(src->frames_skipped, ahead / a->id_stride - 1);
+  }
+
+  if (a->nack && cur.active && !cur.complete &&
+      now_us < cur.start_us + a->nack_deadline_us) {
+    // Park the incomplete frame so retransmissions can still finish it.
+    FinishSlot(&pend);
+    a->cur ^= 1;
+  } else {
+    RetireCurrent(a, partial);
+  }
+  FrameSlot *slot = &a->Current();
+  StartSlot(*a, slot, pkt, src, from, now_us);
+  return slot;
+}
+
+// Copy one packet into slot s. Returns the slot if this packet completed a
+// frame that should be shown, else nullptr.
+static inline FrameSlot *CopyPacket(FrameAssembly *a, FrameSlot *s,
+                                    const FramePacket &pkt,
+                                    UdpSourceStats *src, uint64_t now_us) {
+
+  if (pkt.index >= s->expected_packets || (size_t)pkt.offset >= s->bytes) {
+    StatAdd(src->out_of_range);
+    return nullptr;
+  }
+
+  if (s->got_packet[pkt.index]) {
+    StatAdd(src->duplicate);
+    return nullptr;
+  }
+  if ((int)pkt.index < s->highest_index)
+    StatAdd(src->reordered);
+  else
+    s->highest_index = pkt.index;
+
+  size_t copy_len = pkt.payload_len;
+  if (pkt.offset + copy_len > s->bytes) {
+    if (a->fmt == WIRE_GEOMETRY) {
+      // Explicit offsets must fit; a compact tail is simply clipped.
+      StatAdd(src->out_of_range);
+      return nullptr;
+    }
+    copy_len = s->bytes - pkt.offset;
+  }
+
+  // A scatter read (see PredictPacket) may have landed it in place already.
+  if (pkt.payload != &s->buf[pkt.offset]) {
+    std::memcpy(&s->buf[pkt.offset], pkt.payload, copy_len);
+    StatAdd(src->payload_copied, copy_len);
+  } else {
+    StatAdd(src->payload_in_place, copy_len);
+  }
+
+  s->got_packet[pkt.index] = true;
+  s->offsets[pkt.index] = pkt.offset;
+  s->last_index = pkt.index;
+  s->next_offset = pkt.offset + copy_len;
+  s->last_packet_us = now_us;
+  s->received_packets++;
+  if (s->nacked[pkt.index])
+    StatAdd(src->recovered);
+
+  if (s->received_packets < s->expected_packets)
+    return nullptr;
+
+  s->complete = true;
+  StatAdd(src->frames_complete);
+  if (s->last_nack_us != 0)
+    StatAdd(src->frames_recovered);
+
+  if (s == &a->Pending()) {
+    // An older frame finished late. Show it, unless the newer one already
+    // completed, in which case it is obsolete.
+    bool newer_shown = a->Current().complete;
+    s->active = false;
+    return newer_shown ? nullptr : s;
+  }
+  // The newer frame is complete, so a parked older one no longer matters.
+  FinishSlot(&a->Pending());
+  return s;
+}
+
+// Add one packet to its frame. Returns the slot of a frame that should be
+// shown now, else nullptr: the frame this packet completed or, failing
+// that, a partial bc1 frame it replaced.
+static inline FrameSlot *AddPacket(FrameAssembly *a, const FramePacket &pkt,
+                                   UdpSourceStats *src,
+                                   const sockaddr_in &from, uint64_t now_us) {
+  FrameSlot *partial = nullptr;
+  FrameSlot *s = RouteToSlot(a, pkt, src, from, now_us, &partial);
+  FrameSlot *done = s ? CopyPacket(a, s, pkt, src, now_us) : nullptr;
+  if (!done)
+    done = partial;
+  if (!done)
+    return nullptr;
+  if (done->format == PIXEL_DELTA) {
+    // Every delta frame needs the one before it, so decode them all.
+    const uint8_t *rgb = a->delta.Decode(done->buf.data(), done->bytes,
+                                         done->width, done->height);
+    done->format = PIXEL_RGB24;
+    done->bytes = (size_t)done->width * done->height * 3;  // < DeltaFrameBytes
+    std::memcpy(done->buf.data(), rgb, done->bytes);
+  }
+  // Callers may take the slot's buffer, so keep the copy the next bc1
+  // frame starts from now.
+  if (done->format == PIXEL_BC1)
+    a->shown.assign(done->buf.begin(), done->buf.begin() + done->bytes);
+  else
+    a->shown.clear();
+  return done;
+}
+
+// Scatter receive: guess where the next packet goes so the caller can read
+// its payload straight into the frame. Only the packet after the last one
+// of the current, unfinished frame is predicted; a new frame would be
+// reset by StartSlot, so its first packet always goes via scratch.
+struct PacketPrediction {
+  FrameSlot *slot = nullptr;
+  uint16_t index = 0;
+  uint32_t offset = 0;
+  size_t max_len = 0;   // room in the frame at offset
+};
+
+static inline bool PredictPacket(FrameAssembly *a, PacketPrediction *p) {
+  FrameSlot &s = a->Current();
+  if (!s.active || s.complete || s.last_index < 0)
+    return false;
+  const int next = s.last_index + 1;
+  if (next >= s.expected_packets || s.got_packet[next])
+    return false;
+  const size_t offset = a->fmt == WIRE_COMPACT ? next * a->chunk_size
+                                               : s.next_offset;
+  if (offset >= s.bytes)
+    return false;
+  p->slot = &s;
+  p->index = next;
+  p->offset = offset;
+  p->max_len = s.bytes - offset;
+  if (a->fmt == WIRE_COMPACT) {
+    p->max_len = std::min(p->max_len, a->chunk_size);
+  } else {
+    // After reordering, packets past `next` may be held already; the read
+    // must end where the first of them starts, or it would overwrite it.
+    for (int i = next + 1; i <= s.highest_index; ++i) {
+      if (!s.got_packet[i]) continue;
+      if (s.offsets[i] <= offset) return false;
+      p->max_len = std::min<size_t>(p->max_len, s.offsets[i] - offset);
+      break;
+    }
+  }
+  return true;
+}
+
+// Undo a predicted read that turned out to be another packet: the hole
+// gets back what StartSlot put there, which a partial bc1 frame shows.
+static inline void RefillHole(const FrameAssembly &a,
+                              const PacketPrediction &p, size_t len) {
+  FrameSlot &s = *p.slot;
+  if (s.format == PIXEL_BC1 && a.shown.size() == s.bytes)
+    std::memcpy(&s.buf[p.offset], &a.shown[p.offset], len);
+  else
+    std::memset(&s.buf[p.offset], 0, len);
+}
+
+// Whether a packet parsed from a predicted read is the one we predicted,
+// i.e. AddPacket will route it to p.slot at p.offset.
+static inline bool PredictionHolds(const FrameAssembly *a,
+                                   const PacketPrediction &p,
+                                   const FramePacket &pkt) {
+  const FrameSlot &s = *p.slot;
+  if (!s.active || pkt.index != p.index || pkt.offset != p.offset ||
+      pkt.count != s.expected_packets) {
+    return false;
+  }
+  if (pkt.has_frame_id)
+    return pkt.frame_id == s.frame_id;
+  return !GeometryStartsNewFrame(s, pkt);
+}
+
+// Send NACKs for holes in incomplete frames and expire parked frames. Call
+// after every wakeup of the receive loop when NACKs are enabled.
+static inline void ServiceNacks(FrameAssembly *a, uint64_t now_us) {
+  if (!a->nack || a->fmt != WIRE_COMPACT)
+    return;
+
+  uint8_t nack[NACK_HEADER_SIZE + MAX_NACK_BITMAP];
+  for (int k = 0; k < 2; ++k) {
+    FrameSlot *s = &a->slots[k];
+    if (!s->active || s->complete)
+      continue;
+    if (now_us >= s->start_us + a->nack_deadline_us) {
+      if (s == &a->Pending())
+        FinishSlot(s);
+      continue;
+    }
+    if (now_us < s->start_us + a->nack_delay_us ||
+        now_us < s->last_nack_us + a->nack_delay_us) {
+      continue;
+    }
+
+    // Holes below the highest index are surely missing. Past it we only
+    // know once the next frame started (the slot is parked) or the sender
+    // went quiet, as it does after a single slide. Paced senders leave gaps
+    // between batches, so "quiet" means half the deadline.
+    bool tail_known = s == &a->Pending() ||
+                      now_us >= s->last_packet_us + a->nack_deadline_us / 2;
+    int last = tail_known ? s->expected_packets - 1 : s->highest_index - 1;
+    int first = 0;
+    while (first <= last && s->got_packet[first]) first++;
+    if (first > last)
+      continue;
+
+    size_t len = BuildNack(nack, s->frame_id, first, last, [s](size_t i) {
+      return !s->got_packet[i];
+    });
+    for (int i = first; i <= last; ++i) {
+      if (!s->got_packet[i]) s->nacked[i] = true;
+    }
+    sendto(a->sock, nack, len, 0, (const sockaddr *)&s->from,
+           sizeof(s->from));
+    s->last_nack_us = now_us;
+    StatAdd(s->src->nacks_sent);
+  }
+}
@@ -0,0 +1,102 @@
+// udp_frame_mailbox.h
+// Hand completed frames from several receive threads to the one thread that
+// owns the matrix.
+//
+// Lock-free "latest frame" exchange: the mailbox always holds exactly one
+// frame buffer. A producer swaps its finished frame in and gets back the
+// previous occupant as its next spare (an unread frame it displaces is
+// simply dropped). The consumer swaps its already-shown buffer in the same
+// way and draws what it got if that was fresh. An eventfd wakes the
+// consumer. Buffers only ever change hands through the atomic exchange, so
+// no frame is copied.
+
+#pragma once
+
+#include "pixel_format.h"
+
+#include <poll.h>
+#include <sys/eventfd.h>
+#include <unistd.h>
+
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+struct MailboxFrame {
+  std::vector<uint8_t> pixels;  // at least one width x height frame
+  uint16_t width = 0;
+  uint16_t height = 0;
+  PixelFormat format = PIXEL_RGB24;
+  bool fresh = false;          // published and not yet taken
+  bool has_frame_id = false;
+  uint16_t frame_id = 0;
+  int64_t present_us = 0;      // CLOCK_MONOTONIC target, 0 = right away
+  bool has_pts = false;        // sender timestamp, for the jitter buffer
+  uint64_t pts = 0;
+  int64_t arrival_us = 0;      // when the frame completed
+};
+
+class FrameMailbox {
+ public:
+  // Buffers of width x height rgb24 pixels for `producers` threads, the
+  // mailbox itself and the consumer. Producers that publish other sizes or
+  // pixel formats set the frame's width, height and format.
+  FrameMailbox(int producers, int width, int height)
+      : efd_(eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK)) {
+    for (int i = 0; i < producers + 2; ++i) {
+      frames_.emplace_back(new MailboxFrame());
+      frames_.back()->pixels.assign((size_t)width * height * 3, 0);
+      frames_.back()->width = (uint16_t)width;
+      frames_.back()->height = (uint16_t)height;
+    }
+    slot_.store(frames_[0].get());
+    next_spare_ = 1;
+  }
+  ~FrameMailbox() { if (efd_ >= 0) close(efd_); }
+
+  // A private buffer for a producer or the consumer. Call once per thread
+  // before the threads start.
+  MailboxFrame *TakeSpare() { return frames_[next_spare_++].get(); }
+
+  // Producer: publish `f`; returns the buffer to fill next.
+  MailboxFrame *Publish(MailboxFrame *f) {
+    f->fresh = true;
+    MailboxFrame *old = slot_.exchange(f, std::memory_order_acq_rel);
+    if (old->fresh) dropped_.fetch_add(1, std::memory_order_relaxed);
+    old->fresh = false;
+    uint64_t one = 1;
+    ssize_t r = write(efd_, &one, sizeof(one));
+    (void)r;
+    return old;
+  }
+
+  // Consumer: wait up to timeout_ms for a frame. On success `*mine` is
+  // replaced by the new frame (its previous buffer goes back into
+  // circulation) and true is returned.
+  bool Wait(MailboxFrame **mine, int timeout_ms) {
+    pollfd p = {efd_, POLLIN, 0};
+    if (poll(&p, 1, timeout_ms) <= 0) return false;
+    uint64_t n;
+    ssize_t r = read(efd_, &n, sizeof(n));
+    (void)r;
+    (*mine)->fresh = false;
+    MailboxFrame *got = slot_.exchange(*mine, std::memory_order_acq_rel);
+    *mine = got;
+    return got->fresh;
+  }
+
+  // Readable when a frame was published, for consumers that poll several
+  // mailboxes at once (then Wait(..., 0) takes it).
+  int fd() const { return efd_; }
+
+  // Frames a producer overwrote before the consumer got to them.
+  uint64_t dropped() const { return dropped_.load(std::memory_order_relaxed); }
+
+ private:
+  int efd_;
+  std::vector<std::unique_ptr<MailboxFrame>> frames_;
+  std::atomic<MailboxFrame *> slot_{nullptr};
+  int next_spare_ = 0;
+  std::atomic<uint64_t> dropped_{0};
+};
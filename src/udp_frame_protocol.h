@@ -0,0 +1,289 @@
+// udp_frame_protocol.h
+// Wire formats for streaming frames over UDP. All header fields are
+// big-endian.
+//
+// Compact (6 bytes, default port 5005), 256x192 rgb24 frames:
+//   u16 frame_id, u16 packet_index, u16 total_packets
+//   payload lands at packet_index * chunk size.
+//
+// Geometry (12 bytes, default port 9999) - what udp_led_receiver.py speaks:
+//   u16 width, u16 height, u16 chunk_idx, u16 num_chunks, u32 offset
+//   payload lands at the explicit byte offset. There is no frame id. The
+//   C++ receivers take any size up to MAX_FRAME_WIDTH x MAX_FRAME_HEIGHT
+//   and scale it to the wall (frame_resampler.h). The top 4 bits of width
+//   carry the PixelFormat (pixel_format.h), 0 being rgb24; only rgb24 is
+//   understood by udp_led_receiver.py.
+//
+// NACK (receiver -> sender, compact format only):
+//   u32 magic "NACK", u16 frame_id, u16 first_index, u16 bitmap_len,
+//   then bitmap_len bytes. Bit b (LSB first) of byte k set means packet
+//   first_index + 8 * k + b is missing.
+//
+// Synchronized presentation (sync port, default 5006; times are the
+// sender's CLOCK_MONOTONIC in microseconds):
+//   PTS    sender -> receivers: u32 magic "PTS ", u16 frame_id, u64 pts
+//   CLKQ   receiver -> sender:  u32 magic "CLKQ", u32 seq, u64 t1
+//   CLKR   sender -> receiver:  u32 magic "CLKR", u32 seq, u64 t1, t2, t3
+//   t1 = receiver send, t2 = sender receive, t3 = sender send (NTP style).
+//
+// matrix_daemon borrows two records for its TCP stream:
+//   PTS    before every frame with --jitter-buffer (same layout as above)
+//   ACK    daemon -> client after every swap with --ack: u32 magic "ACK ",
+//          u32 seq (frames of this client shown or skipped so far),
+//          u64 display time (daemon CLOCK_MONOTONIC us), u32 refresh (mHz)
+
+#pragma once
+
+#include "pixel_format.h"
+
+#include <arpa/inet.h>
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+
+static const size_t COMPACT_HEADER_SIZE  = 6;
+static const size_t GEOMETRY_HEADER_SIZE = 12;
+
+static const int MAX_FRAME_WIDTH  = 1024;   // geometry frames
+static const int MAX_FRAME_HEIGHT = 768;
+static const int GEOMETRY_FORMAT_SHIFT = 12;  // of the width field
+
+static const uint32_t NACK_MAGIC = 0x4E41434B;  // "NACK"
+static const size_t NACK_HEADER_SIZE = 10;
+static const size_t MAX_NACK_BITMAP = 1024;     // covers 8192 packets
+
+static const uint32_t PTS_MAGIC  = 0x50545320;  // "PTS "
+static const uint32_t CLKQ_MAGIC = 0x434C4B51;  // "CLKQ"
+static const uint32_t CLKR_MAGIC = 0x434C4B52;  // "CLKR"
+static const size_t PTS_SIZE  = 14;
+static const size_t CLKQ_SIZE = 16;
+static const size_t CLKR_SIZE = 32;
+static const uint32_t ACK_MAGIC = 0x41434B20;   // "ACK "
+static const size_t ACK_SIZE = 20;
+
+enum WireFormat {
+  WIRE_COMPACT,
+  WIRE_GEOMETRY,
+};
+
+// One parsed packet, in host byte order. `payload` points into the packet.
+struct FramePacket {
+  bool     has_frame_id = false;
+  uint16_t frame_id = 0;
+  uint16_t index = 0;        // packet_index / chunk_idx
+  uint16_t count = 0;        // total_packets / num_chunks
+  uint16_t width = 0;        // geometry format only
+  uint16_t height = 0;
+  PixelFormat format = PIXEL_RGB24;
+  uint32_t offset = 0;       // byte offset of the payload within the frame
+  const uint8_t *payload = nullptr;
+  size_t payload_len = 0;
+};
+
+static inline uint16_t ReadBE16(const uint8_t *p) {
+  uint16_t v;
+  std::memcpy(&v, p, 2);
+  return ntohs(v);
+}
+
+static inline uint32_t ReadBE32(const uint8_t *p) {
+  uint32_t v;
+  std::memcpy(&v, p, 4);
+  return ntohl(v);
+}
+
+static inline void WriteBE16(uint8_t *p, uint16_t v) {
+  v = htons(v);
+  std::memcpy(p, &v, 2);
+}
+
+static inline void WriteBE32(uint8_t *p, uint32_t v) {
+  v = htonl(v);
+  std::memcpy(p, &v, 4);
+}
+
+static inline uint64_t ReadBE64(const uint8_t *p) {
+  return (uint64_t)ReadBE32(p) << 32 | ReadBE32(p + 4);
+}
+
+static inline void WriteBE64(uint8_t *p, uint64_t v) {
+  WriteBE32(p, (uint32_t)(v >> 32));
+  WriteBE32(p + 4, (uint32_t)v);
+}
+
+static inline size_t HeaderSize(WireFormat fmt) {
+  return fmt == WIRE_COMPACT ? COMPACT_HEADER_SIZE : GEOMETRY_HEADER_SIZE;
+}
+
+// Parse a packet. `chunk_size` is the fixed payload stride of the compact
+// format (ignored for geometry). Returns false if the header is malformed.
+static inline bool ParseFramePacket(WireFormat fmt, const uint8_t *buf,
+                                    size_t len, size_t chunk_size,
+                                    FramePacket *pkt) {
+  const size_t hdr = HeaderSize(fmt);
+  if (len < hdr)
+    return false;
+
+  if (fmt == WIRE_COMPACT) {
+    pkt->has_frame_id = true;
+    pkt->frame_id = ReadBE16(buf + 0);
+    pkt->index    = ReadBE16(buf + 2);
+    pkt->count    = ReadBE16(buf + 4);
+    pkt->offset   = (uint32_t)(pkt->index * chunk_size);
+    if (len - hdr > chunk_size)
+      return false;
+  } else {
+    pkt->has_frame_id = false;
+    const uint16_t width = ReadBE16(buf + 0);
+    pkt->width  = width & ((1 << GEOMETRY_FORMAT_SHIFT) - 1);
+    pkt->format = (PixelFormat)(width >> GEOMETRY_FORMAT_SHIFT);
+    pkt->height = ReadBE16(buf + 2);
+    pkt->index  = ReadBE16(buf + 4);
+    pkt->count  = ReadBE16(buf + 6);
+    pkt->offset = ReadBE32(buf + 8);
+  }
+
+  if (pkt->count == 0)
+    return false;
+  pkt->payload = buf + hdr;
+  pkt->payload_len = len - hdr;
+  return true;
+}
+
+// Whether a geometry packet's frame size and pixel format are ones the
+// receivers can show. delta frames come in whole 16x16 blocks.
+static inline bool GeometrySizeOk(const FramePacket &pkt) {
+  return pkt.width > 0 && pkt.height > 0 && pkt.width <= MAX_FRAME_WIDTH &&
+         pkt.height <= MAX_FRAME_HEIGHT && pkt.format < PIXEL_FORMAT_COUNT &&
+         (pkt.format != PIXEL_DELTA ||
+          (pkt.width % 16 == 0 && pkt.height % 16 == 0));
+}
+
+static inline void WriteCompactHeader(uint8_t *buf, uint16_t frame_id,
+                                      uint16_t index, uint16_t count) {
+  WriteBE16(buf + 0, frame_id);
+  WriteBE16(buf + 2, index);
+  WriteBE16(buf + 4, count);
+}
+
+static inline void WriteGeometryHeader(uint8_t *buf, uint16_t width,
+                                       uint16_t height, uint16_t index,
+                                       uint16_t count, uint32_t offset,
+                                       PixelFormat format = PIXEL_RGB24) {
+  WriteBE16(buf + 0, (uint16_t)(format << GEOMETRY_FORMAT_SHIFT | width));
+  WriteBE16(buf + 2, height);
+  WriteBE16(buf + 4, index);
+  WriteBE16(buf + 6, count);
+  WriteBE32(buf + 8, offset);
+}
+
+// Build a NACK for frame_id from a missing-packet predicate over
+// [first, last]. Returns the datagram length.
+template <typename IsMissing>
+static inline size_t BuildNack(uint8_t *buf, uint16_t frame_id,
+                               uint16_t first, uint16_t last,
+                               IsMissing is_missing) {
+  size_t bitmap_len = ((size_t)last - first) / 8 + 1;
+  if (bitmap_len > MAX_NACK_BITMAP)
+    bitmap_len = MAX_NACK_BITMAP;
+  WriteBE32(buf + 0, NACK_MAGIC);
+  WriteBE16(buf + 4, frame_id);
+  WriteBE16(buf + 6, first);
+  WriteBE16(buf + 8, (uint16_t)bitmap_len);
+  uint8_t *bitmap = buf + NACK_HEADER_SIZE;
+  std::memset(bitmap, 0, bitmap_len);
+  for (size_t i = first; i <= last && i - first < bitmap_len * 8; ++i) {
+    if (is_missing(i))
+      bitmap[(i - first) / 8] |= 1 << ((i - first) % 8);
+  }
+  return NACK_HEADER_SIZE + bitmap_len;
+}
+
+// Parse a NACK; `bitmap` points into buf.
+static inline bool ParseNack(const uint8_t *buf, size_t len,
+                             uint16_t *frame_id, uint16_t *first,
+                             const uint8_t **bitmap, size_t *bitmap_len) {
+  if (len < NACK_HEADER_SIZE || ReadBE32(buf) != NACK_MAGIC)
+    return false;
+  *frame_id = ReadBE16(buf + 4);
+  *first = ReadBE16(buf + 6);
+  *bitmap_len = ReadBE16(buf + 8);
+  if (len < NACK_HEADER_SIZE + *bitmap_len)
+    return false;
+  *bitmap = buf + NACK_HEADER_SIZE;
+  return true;
+}
+
+static inline size_t BuildPts(uint8_t *buf, uint16_t frame_id, uint64_t pts) {
+  WriteBE32(buf + 0, PTS_MAGIC);
+  WriteBE16(buf + 4, frame_id);
+  WriteBE64(buf + 6, pts);
+  return PTS_SIZE;
+}
+
+static inline bool ParsePts(const uint8_t *buf, size_t len,
+                            uint16_t *frame_id, uint64_t *pts) {
+  if (len < PTS_SIZE || ReadBE32(buf) != PTS_MAGIC)
+    return false;
+  *frame_id = ReadBE16(buf + 4);
+  *pts = ReadBE64(buf + 6);
+  return true;
+}
+
+// Clock probe (CLKQ) and reply (CLKR); a query leaves t2/t3 at zero.
+struct ClockProbe {
+  uint32_t seq = 0;
+  uint64_t t1 = 0, t2 = 0, t3 = 0;
+};
+
+static inline size_t BuildClockProbe(uint8_t *buf, bool reply,
+                                     const ClockProbe &p) {
+  WriteBE32(buf + 0, reply ? CLKR_MAGIC : CLKQ_MAGIC);
+  WriteBE32(buf + 4, p.seq);
+  WriteBE64(buf + 8, p.t1);
+  if (!reply)
+    return CLKQ_SIZE;
+  WriteBE64(buf + 16, p.t2);
+  WriteBE64(buf + 24, p.t3);
+  return CLKR_SIZE;
+}
+
+static inline bool ParseClockProbe(const uint8_t *buf, size_t len, bool reply,
+                                   ClockProbe *p) {
+  if (len < (reply ? CLKR_SIZE : CLKQ_SIZE) ||
+      ReadBE32(buf) != (reply ? CLKR_MAGIC : CLKQ_MAGIC)) {
+    return false;
+  }
+  p->seq = ReadBE32(buf + 4);
+  p->t1 = ReadBE64(buf + 8);
+  if (reply) {
+    p->t2 = ReadBE64(buf + 16);
+    p->t3 = ReadBE64(buf + 24);
+  }
+  return true;
+}
+
+// Display acknowledgement (matrix_daemon --ack).
+struct DisplayAck {
+  uint32_t seq = 0;
+  uint64_t display_us = 0;
+  uint32_t refresh_mhz = 0;   // rate frames reach the wall, 0 = unknown
+};
+
+static inline size_t BuildAck(uint8_t *buf, const DisplayAck &a) {
+  WriteBE32(buf + 0, ACK_MAGIC);
+  WriteBE32(buf + 4, a.seq);
+  WriteBE64(buf + 8, a.display_us);
+  WriteBE32(buf + 16, a.refresh_mhz);
+  return ACK_SIZE;
+}
+
+static inline bool ParseAck(const uint8_t *buf, size_t len, DisplayAck *a) {
+  if (len < ACK_SIZE || ReadBE32(buf) != ACK_MAGIC)
+    return false;
+  a->seq = ReadBE32(buf + 4);
+  a->display_us = ReadBE64(buf + 8);
+  a->refresh_mhz = ReadBE32(buf + 16);
+  return true;
+}
@@ -2,16 +2,35 @@
 // Receive RGB frames via UDP and display on a 4x3 64x64 HUB75 array (256x192).
 
 #include "led-matrix.h"
+#include "adaptive_pwm.h"
+#include "cli_flags.h"
+#include "color_lut.h"
+#include "frame_resampler.h"
+#include "io_loop.h"
+#include "jitter_buffer.h"
+#include "panel_calibration.h"
+#include "power_limit.h"
+#include "udp_clock_sync.h"
+#include "udp_frame_assembly.h"
+#include "udp_frame_mailbox.h"
 
 #include <arpa/inet.h>
+#include <linux/filter.h>
 #include <netinet/in.h>
+#include <netinet/udp.h>
+#include <sys/resource.h>
 #include <sys/socket.h>
 #include <unistd.h>
 
+#include <algorithm>
+#include <cerrno>
 #include <csignal>
 #include <cstdio>
 #include <cstdlib>
 #include <cstring>
+#include <ctime>
+#include <memory>
+#include <thread>
 #include <vector>
 
 using rgb_matrix::RGBMatrix;
@@ -24,21 +43,633 @@ static const int WIDTH  = 256;  // 4 * 64
 static const int HEIGHT = 192;  // 3 * 64
 static const size_t FRAME_BYTES = WIDTH * HEIGHT * 3;
 
-static const int UDP_PORT = 5005;           // choose your port
-static const size_t CHUNK_SIZE = 1024;      // payload bytes per packet
-static const size_t HEADER_SIZE = 6;        // frame_id, packet_idx, total_pkts
+static const int UDP_PORT = 5005;           // compact 6-byte header
+static const int UDP_GEOMETRY_PORT = 9999;  // 12-byte udp_led_receiver.py header
+static const size_t CHUNK_SIZE = 1024;      // default payload bytes per packet (compact)
+// Largest UDP payload over IPv4, minus our header. Only usable over loopback
+// or with IP fragmentation; on a LAN stay at or below path MTU - 28 - 6.
+static const size_t MAX_CHUNK_SIZE = 65507 - COMPACT_HEADER_SIZE;
+static const int MAX_RX_THREADS = 16;
+static const size_t SCATTER_SCRATCH = 65536;  // > any UDP payload
+
+// rcvbuf > 0 asks for that socket receive buffer (SO_RCVBUFFORCE when we
+// run as root, so net.core.rmem_max does not cap it). gro enables UDP_GRO so
+// the kernel can hand us several coalesced datagrams per read. reuseport
+// lets several sockets (one per receive thread) share the port.
+static int OpenUdpSocket(int port, int rcvbuf, bool gro, bool reuseport) {
+  int sock = socket(AF_INET, SOCK_DGRAM, 0);
+  if (sock < 0) {
+    perror("socket");
+    return -1;
+  }
+
+  int reuse = 1;
+  setsockopt(sock, SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof(reuse));
+  if (reuseport &&
+      setsockopt(sock, SOL_SOCKET, SO_REUSEPORT, &reuse, sizeof(reuse)) < 0) {
+    perror("setsockopt(SO_REUSEPORT)");
+    close(sock);
+    return -1;
+  }
+
+  if (rcvbuf > 0) {
+    if (setsockopt(sock, SOL_SOCKET, SO_RCVBUFFORCE, &rcvbuf,
+                   sizeof(rcvbuf)) < 0) {
+      setsockopt(sock, SOL_SOCKET, SO_RCVBUF, &rcvbuf, sizeof(rcvbuf));
+    }
+    int actual = 0;
+    socklen_t len = sizeof(actual);
+    getsockopt(sock, SOL_SOCKET, SO_RCVBUF, &actual, &len);
+    std::fprintf(stderr, "UDP %d: SO_RCVBUF requested %d, got %d\n",
+                 port, rcvbuf, actual);
+  }
+
+  if (gro) {
+    int on = 1;
+    if (setsockopt(sock, SOL_UDP, UDP_GRO, &on, sizeof(on)) < 0)
+      perror("setsockopt(UDP_GRO), continuing without GRO");
+  }
+
+  sockaddr_in addr;
+  std::memset(&addr, 0, sizeof(addr));
+  addr.sin_family = AF_INET;
+  addr.sin_port = htons(port);
+  addr.sin_addr.s_addr = htonl(INADDR_ANY);
+
+  if (bind(sock, (struct sockaddr *)&addr, sizeof(addr)) < 0) {
+    perror("bind");
+    close(sock);
+    return -1;
+  }
+  return sock;
+}
+
+// Join `group` on `sock` (iface: local address of the interface to use,
+// nullptr for the kernel's choice).
+static bool JoinMulticast(int sock, const char *group, const char *iface) {
+  ip_mreq mreq;
+  std::memset(&mreq, 0, sizeof(mreq));
+  if (inet_pton(AF_INET, group, &mreq.imr_multiaddr) != 1 ||
+      !IN_MULTICAST(ntohl(mreq.imr_multiaddr.s_addr))) {
+    std::fprintf(stderr, "Bad multicast group %s\n", group);
+    return false;
+  }
+  mreq.imr_interface.s_addr = htonl(INADDR_ANY);
+  if (iface && inet_pton(AF_INET, iface, &mreq.imr_interface) != 1) {
+    std::fprintf(stderr, "Bad --mcast-if %s\n", iface);
+    return false;
+  }
+  if (setsockopt(sock, IPPROTO_IP, IP_ADD_MEMBERSHIP, &mreq,
+                 sizeof(mreq)) < 0) {
+    perror("setsockopt(IP_ADD_MEMBERSHIP)");
+    return false;
+  }
+  return true;
+}
+
+// Steer 6-byte-header packets across the SO_REUSEPORT group by frame id, so
+// every packet of a frame reaches the same socket (socket frame_id % n, in
+// bind order). Reuseport CBPF programs see the UDP payload at offset 0.
+static bool AttachFrameSteering(int sock, int n) {
+  sock_filter code[] = {
+    BPF_STMT(BPF_LD | BPF_H | BPF_ABS, 0),    // A = frame_id
+    BPF_STMT(BPF_ALU | BPF_MOD | BPF_K, (uint32_t)n),
+    BPF_STMT(BPF_RET | BPF_A, 0),
+  };
+  sock_fprog prog = {(unsigned short)(sizeof(code) / sizeof(code[0])), code};
+  if (setsockopt(sock, SOL_SOCKET, SO_ATTACH_REUSEPORT_CBPF, &prog,
+                 sizeof(prog)) < 0) {
+    perror("setsockopt(SO_ATTACH_REUSEPORT_CBPF)");
+    return false;
+  }
+  return true;
+}
+
+// Count and parse one datagram of `len` bytes starting with its header.
+static bool ParseDatagram(FrameAssembly *a, const uint8_t *buf, size_t len,
+                          UdpSourceStats *src, FramePacket *pkt) {
+  StatAdd(src->packets);
+  StatAdd(src->bytes, len);
 
-struct UdpPacketHeader {
-  uint16_t frame_id;
-  uint16_t packet_index;
-  uint16_t total_packets;
+  if (!ParseFramePacket(a->fmt, buf, len, a->chunk_size, pkt)) {
+    StatAdd(src->malformed);
+    return false;
+  }
+  if (a->fmt == WIRE_GEOMETRY && !GeometrySizeOk(*pkt)) {
+    StatAdd(src->malformed);  // no or oversized dimensions
+    return false;
+  }
+  return true;
+}
+
+// Validate and assemble one datagram. Returns the frame it completed, if any.
+static FrameSlot *HandleDatagram(FrameAssembly *a, const uint8_t *buf,
+                                 size_t len, UdpSourceStats *src,
+                                 const sockaddr_in &from, uint64_t now_us) {
+  FramePacket pkt;
+  if (!ParseDatagram(a, buf, len, src, &pkt))
+    return nullptr;
+  return AddPacket(a, pkt, src, from, now_us);
+}
+
+// Handle one read, which with GRO may hold several same-sized datagrams
+// glued together (gso_size is the segment size). on_frame(FrameSlot *) runs
+// for every frame this completes.
+template <typename OnFrame>
+static void HandleRead(FrameAssembly *a, UdpStreamStats *stats,
+                       const uint8_t *data, size_t n, const sockaddr_in &from,
+                       int gso_size, bool truncated, OnFrame on_frame) {
+  const uint64_t now_us = MonoMicros();
+  UdpSourceStats *src = stats->Lookup(from);
+  StatAdd(src->reads);
+
+  if (truncated) {
+    StatAdd(src->packets);
+    StatAdd(src->malformed);  // larger than any frame packet
+    return;
+  }
+
+  size_t segment = gso_size > 0 ? gso_size : n;
+  for (size_t off = 0; off < n; off += segment) {
+    size_t len = std::min(segment, n - off);
+    FrameSlot *done = HandleDatagram(a, data + off, len, src, from, now_us);
+    if (done) on_frame(done);
+  }
+}
+
+// --scatter: read the header into its own iovec and the payload straight
+// into the frame at the predicted offset, so a correctly predicted packet
+// is never copied in user space. Whatever does not match the prediction
+// spills into scratch and takes the normal copy. Drains the socket.
+template <typename OnFrame>
+static void ScatterRead(FrameAssembly *a, UdpStreamStats *stats,
+                        uint8_t *scratch, OnFrame on_frame) {
+  const size_t hdr_len = HeaderSize(a->fmt);
+  for (;;) {
+    uint8_t hdr[GEOMETRY_HEADER_SIZE];
+    PacketPrediction pred;
+    const bool predicted = PredictPacket(a, &pred);
+    const size_t in_frame =
+        predicted ? std::min(pred.max_len, SCATTER_SCRATCH / 2) : 0;
+
+    iovec iov[3];
+    int niov = 0;
+    iov[niov++] = {hdr, hdr_len};
+    if (predicted) iov[niov++] = {&pred.slot->buf[pred.offset], in_frame};
+    // Leave room in front of the spill so a split payload can be made
+    // contiguous in scratch.
+    iov[niov++] = {scratch + in_frame, SCATTER_SCRATCH - in_frame};
+
+    sockaddr_in from;
+    msghdr msg;
+    std::memset(&msg, 0, sizeof(msg));
+    msg.msg_name = &from;
+    msg.msg_namelen = sizeof(from);
+    msg.msg_iov = iov;
+    msg.msg_iovlen = niov;
+    ssize_t r = recvmsg(a->sock, &msg, MSG_DONTWAIT);
+    if (r < 0)
+      return;
+
+    const uint64_t now_us = MonoMicros();
+    UdpSourceStats *src = stats->Lookup(from);
+    StatAdd(src->reads);
+
+    // Only the header is in `hdr`; the payload pointer is fixed up below.
+    FramePacket pkt;
+    if (!ParseDatagram(a, hdr, r, src, &pkt)) {
+      // Not a frame packet: whatever it left in the hole has to go.
+      if (predicted)
+        RefillHole(*a, pred,
+                   std::min((size_t)r > hdr_len ? r - hdr_len : 0, in_frame));
+      continue;
+    }
+    const size_t payload_len = r - hdr_len;
+    if (predicted && payload_len <= in_frame &&
+        PredictionHolds(a, pred, pkt)) {
+      pkt.payload = &pred.slot->buf[pred.offset];
+    } else {
+      if (predicted) {
+        // Wrong guess: rescue what landed in the frame (PredictPacket only
+        // offers a hole, so nothing was lost) before the frame can be
+        // reset, and refill the hole.
+        size_t n = std::min(payload_len, in_frame);
+        std::memcpy(scratch, &pred.slot->buf[pred.offset], n);
+        RefillHole(*a, pred, n);
+        StatAdd(src->payload_copied, n);
+      }
+      pkt.payload = scratch;
+    }
+    FrameSlot *done = AddPacket(a, pkt, src, from, now_us);
+    if (done) on_frame(done);
+  }
+}
+
+// Register an assembly's socket with the loop, either as plain datagrams
+// or (scatter) as a readable fd we read ourselves.
+template <typename OnFrame>
+static void AddFrameSocket(IoLoop *loop, FrameAssembly *a,
+                           UdpStreamStats *stats, bool scatter,
+                           OnFrame on_frame) {
+  if (scatter) {
+    std::shared_ptr<std::vector<uint8_t>> scratch(
+        new std::vector<uint8_t>(SCATTER_SCRATCH));
+    loop->AddReadable(a->sock, [=]() {
+      ScatterRead(a, stats, scratch->data(), on_frame);
+    });
+    return;
+  }
+  loop->AddDatagramSocket(a->sock, [=](const uint8_t *data, size_t n,
+                                       const sockaddr_in &from, int gso_size,
+                                       bool truncated) {
+    HandleRead(a, stats, data, n, from, gso_size, truncated, on_frame);
+  });
+}
+
+// --rx-threads=N: one receive thread per socket, each with its own loop,
+// assembly and stats. Completed frames go through a FrameMailbox to the
+// main thread, which owns the matrix.
+struct RxThread {
+  FrameAssembly a;
+  UdpStreamStats stats;
+  MailboxFrame *spare = nullptr;
+  std::thread thread;
+  char label[16];
 };
 
-// Simple helper to get time
-static uint64_t NowMicros() {
-  struct timeval tv;
-  gettimeofday(&tv, nullptr);
-  return (uint64_t)tv.tv_sec * 1000000ull + tv.tv_usec;
+static void RxThreadMain(RxThread *t, const char *io_backend, bool scatter,
+                         ClockSync *sync, FrameMailbox *mailbox) {
+  std::unique_ptr<IoLoop> loop = IoLoop::Create(io_backend);
+  FrameAssembly *a = &t->a;
+  AddFrameSocket(loop.get(), a, &t->stats, scatter, [=](FrameSlot *done) {
+    // Trade buffers instead of copying; the slot is reset on reuse.
+    done->buf.swap(t->spare->pixels);
+    t->spare->width = done->width;
+    t->spare->height = done->height;
+    t->spare->format = done->format;
+    t->spare->has_frame_id = a->fmt == WIRE_COMPACT;
+    t->spare->frame_id = done->frame_id;
+    t->spare->present_us = 0;
+    t->spare->has_pts = false;
+    t->spare->arrival_us = MonoMicros();
+    if (sync && t->spare->has_frame_id) {
+      sync->PresentTime(done->frame_id, &t->spare->present_us);
+      t->spare->has_pts = sync->Pts(done->frame_id, &t->spare->pts);
+    }
+    t->spare = mailbox->Publish(t->spare);
+  });
+  loop->SetTick(a->nack ? 1 : 200, [&]() {
+    if (a->nack) ServiceNacks(a, MonoMicros());
+  });
+  loop->Run(&interrupt_received);
+}
+
+static ColorLut color_lut;  // --lut
+static PanelCalibration calibration;  // --calibration
+static PowerLimiter power;  // --current-limit and --panel-current-limit
+static AdaptivePwm adaptive_pwm;  // --adaptive-pwm
+static FrameResampler resampler;  // geometry frames of other sizes
+
+// The LUT and the calibration for row y. Returns `in` if neither is on,
+// else `out`.
+static const uint8_t *GradeRow(const uint8_t *in, uint8_t *out, int y) {
+  const uint8_t *p = in;
+  if (color_lut.enabled()) {
+    color_lut.Apply(p, out, WIDTH);
+    p = out;
+  }
+  if (calibration.enabled()) {
+    calibration.Apply(p, out, y, WIDTH);
+    p = out;
+  }
+  return p;
+}
+
+// Row y of the wall from a frame that is `resample`d or already wall-sized.
+// A resampled row goes to `scratch`, where grading can carry on in place.
+static const uint8_t *SourceRow(const uint8_t *frame, bool resample, int y,
+                                uint8_t *scratch) {
+  if (!resample) return frame + (size_t)y * WIDTH * 3;
+  resampler.Row(frame, y, scratch);
+  return scratch;
+}
+
+// frame: width x height pixels in `format`, converted to rgb24 first if it
+// is another, and scaled to the wall if it is another size.
+static void DrawFrame(FrameCanvas *canvas, const uint8_t *frame, int width,
+                      int height, PixelFormat format) {
+  // The power limit has to see the whole graded frame before any of it is
+  // drawn, so then the rows are graded into `staged` first.
+  static uint8_t staged[WIDTH * HEIGHT * 3];
+  static std::vector<uint8_t> converted;
+  const uint8_t *rows[HEIGHT];
+  uint8_t graded[WIDTH * 3];
+  if (format != PIXEL_RGB24) {
+    converted.resize((size_t)width * height * 3);
+    ConvertToRgb24(format, frame, width, height, converted.data());
+    frame = converted.data();
+  }
+  const bool resample = width != WIDTH || height != HEIGHT;
+  if (resample) resampler.Configure(width, height, WIDTH, HEIGHT);
+  if (adaptive_pwm.enabled()) {
+    const int bits = adaptive_pwm.Update(frame, width, height, 1);
+    if (canvas->pwmbits() != bits) canvas->SetPWMBits(bits);
+  }
+  if (power.enabled()) {
+    for (int y = 0; y < HEIGHT; ++y) {
+      uint8_t *row = staged + (size_t)y * WIDTH * 3;
+      rows[y] = GradeRow(SourceRow(frame, resample, y, row), row, y);
+      power.Measure(rows[y], y, WIDTH);
+    }
+    power.Finish();
+  }
+  for (int y = 0; y < HEIGHT; ++y) {
+    const uint8_t *p = power.enabled()
+        ? rows[y]
+        : GradeRow(SourceRow(frame, resample, y, graded), graded, y);
+    if (power.active()) {
+      power.Apply(p, graded, y, WIDTH);
+      p = graded;
+    }
+    for (int x = 0; x < WIDTH; ++x) {
+      uint8_t r = *p++;
+      uint8_t g = *p++;
+      uint8_t b = *p++;
+      canvas->SetPixel(x, y, r, g, b);
+    }
+  }
+}
+
+struct UdpOptions {
+  int rcvbuf = 0;
+  bool gro = false;
+  const char *io_backend = "epoll";
+  int stats_interval_s = 5;
+  int rx_threads = 1;
+  bool scatter = false;
+  const char *mcast = nullptr;     // multicast group to join
+  const char *mcast_if = nullptr;
+  ClockSync *sync = nullptr;       // present frames at their timestamps
+  JitterOptions jitter;            // ...or at timestamp + adaptive delay
+};
+
+// How closely frames hit their presentation time (main thread only).
+struct PresentStats {
+  uint64_t timed = 0;
+  uint64_t untimed = 0;   // no timestamp or no clock offset yet
+  uint64_t late = 0;      // target already passed when the frame was ready
+  int64_t sum_abs_err = 0;
+  int64_t max_abs_err = 0;
+
+  void Print(FILE *out, const ClockSync &sync) {
+    std::fprintf(out,
+                 "[sync] offset=%+lldus rtt=%lldus timed=%llu untimed=%llu "
+                 "late=%llu err avg=%.0fus max=%lldus\n",
+                 (long long)sync.offset_us(), (long long)sync.rtt_us(),
+                 (unsigned long long)timed, (unsigned long long)untimed,
+                 (unsigned long long)late,
+                 timed ? (double)sum_abs_err / timed : 0.0,
+                 (long long)max_abs_err);
+    *this = PresentStats();
+  }
+};
+
+// --jitter-buffer: queue frames from the receive threads and present each at
+// its sender timestamp plus the buffer's adaptive delay. Frames are taken
+// from the mailbox as soon as they complete (the buffer reorders them by
+// timestamp), so the wait for the next due frame is a mailbox wait too.
+static void PresentFromJitterBuffer(FrameMailbox *mailbox, MailboxFrame *mine,
+                                    const UdpOptions &opt, RGBMatrix *matrix,
+                                    FrameCanvas **offscreen,
+                                    uint64_t *frames_shown) {
+  // Draw this long before a frame is due, then sleep for the exact swap.
+  const int64_t DRAW_LEAD_US = 2000;
+  JitterBuffer jitter(opt.jitter, FRAME_BYTES);
+  std::vector<uint8_t> show(FRAME_BYTES);
+  uint64_t untimed = 0;
+  int64_t report_us = MonoMicros() + opt.stats_interval_s * 1000000ll;
+  while (!interrupt_received) {
+    int64_t now = MonoMicros();
+    if (opt.stats_interval_s > 0 && now >= report_us) {
+      jitter.Print(stderr);
+      if (untimed) {
+        std::fprintf(stderr, "[jitter] %llu frames without a timestamp\n",
+                     (unsigned long long)untimed);
+        untimed = 0;
+      }
+      report_us += opt.stats_interval_s * 1000000ll;
+    }
+
+    int64_t due;
+    int timeout_ms = 200;
+    if (jitter.Next(&due))
+      timeout_ms = (int)std::max<int64_t>(
+          0, std::min<int64_t>(200, (due - DRAW_LEAD_US - now) / 1000));
+    if (mailbox->Wait(&mine, timeout_ms)) {
+      if (mine->has_pts) {
+        // The tag carries the frame's format and size.
+        jitter.Push(&mine->pixels, mine->pts, mine->arrival_us,
+                    (uint64_t)mine->format << 32 |
+                        (uint64_t)mine->width << 16 | mine->height);
+      } else {
+        // No timestamp (lost, or the sender sends none): show it now.
+        untimed++;
+        DrawFrame(*offscreen, mine->pixels.data(), mine->width,
+                  mine->height, mine->format);
+        *offscreen = matrix->SwapOnVSync(*offscreen);
+        (*frames_shown)++;
+      }
+    }
+
+    if (!jitter.Next(&due) || due > MonoMicros() + DRAW_LEAD_US)
+      continue;
+    uint64_t tag;
+    jitter.Pop(&show, &tag);
+    DrawFrame(*offscreen, show.data(), (int)(tag >> 16 & 0xffff),
+              (int)(tag & 0xffff), (PixelFormat)(tag >> 32));
+    if (due > 0) SleepUntilMicros(due);
+    *offscreen = matrix->SwapOnVSync(*offscreen);
+    if (due > 0) jitter.RecordError(MonoMicros() - due);
+    (*frames_shown)++;
+  }
+  jitter.Print(stderr);
+}
+
+// Open a's socket (a->port > 0) and size its frame buffers.
+static bool OpenAssembly(FrameAssembly *a, const UdpOptions &opt,
+                         bool reuseport) {
+  a->sock = OpenUdpSocket(a->port, opt.rcvbuf, opt.gro, reuseport);
+  if (a->sock < 0)
+    return false;
+  if (opt.mcast && !JoinMulticast(a->sock, opt.mcast, opt.mcast_if))
+    return false;
+  a->Init(WIDTH, HEIGHT);
+  return true;
+}
+
+// Default: receive, assemble and draw on the main thread.
+static bool RunInline(FrameAssembly assemblies[2], const UdpOptions &opt,
+                      RGBMatrix *matrix, FrameCanvas **offscreen,
+                      uint64_t *frames_shown) {
+  for (int k = 0; k < 2; ++k) {
+    FrameAssembly &a = assemblies[k];
+    if (a.port <= 0)
+      continue;
+    if (!OpenAssembly(&a, opt, false))
+      return false;
+    std::fprintf(stderr, "Listening for frames on UDP port %d (%s header)\n",
+                 a.port, a.fmt == WIRE_COMPACT ? "6-byte" : "12-byte");
+  }
+
+  UdpStreamStats stats;
+  stats.StartReporter(opt.stats_interval_s);
+
+  std::unique_ptr<IoLoop> loop = IoLoop::Create(opt.io_backend);
+  std::fprintf(stderr, "Ingest loop: %s\n", loop->name());
+
+  bool nack = false;
+  for (int k = 0; k < 2; ++k) {
+    FrameAssembly *a = &assemblies[k];
+    if (a->sock < 0)
+      continue;
+    nack |= a->nack;
+    AddFrameSocket(loop.get(), a, &stats, opt.scatter, [=](FrameSlot *done) {
+      DrawFrame(*offscreen, done->buf.data(), done->width, done->height,
+                done->format);
+      *offscreen = matrix->SwapOnVSync(*offscreen);
+      (*frames_shown)++;
+    });
+  }
+
+  // The tick notices Ctrl-C when idle; NACK timers need a finer one.
+  loop->SetTick(nack ? 1 : 200, [&]() {
+    if (!nack)
+      return;
+    const uint64_t now_us = MonoMicros();
+    for (int k = 0; k < 2; ++k) {
+      if (assemblies[k].sock >= 0) ServiceNacks(&assemblies[k], now_us);
+    }
+  });
+
+  loop->Run(&interrupt_received);
+
+  stats.StopReporter();
+  stats.Print(stderr);
+  for (int k = 0; k < 2; ++k) {
+    if (assemblies[k].sock >= 0)
+      close(assemblies[k].sock);
+  }
+  return true;
+}
+
+// --rx-threads=N: N SO_REUSEPORT sockets and threads for the 6-byte port,
+// steered by frame id, plus one thread for the 12-byte port (it has no
+// frame id to steer on). The main thread only draws.
+static bool RunThreaded(FrameAssembly assemblies[2], const UdpOptions &opt,
+                        RGBMatrix *matrix, FrameCanvas **offscreen,
+                        uint64_t *frames_shown) {
+  std::vector<std::unique_ptr<RxThread>> threads;
+  bool ok = true;
+  for (int k = 0; k < 2 && ok; ++k) {
+    const FrameAssembly &tmpl = assemblies[k];
+    if (tmpl.port <= 0)
+      continue;
+    const int n = tmpl.fmt == WIRE_COMPACT ? opt.rx_threads : 1;
+    const size_t first = threads.size();
+    for (int i = 0; i < n && ok; ++i) {
+      threads.emplace_back(new RxThread());
+      RxThread *t = threads.back().get();
+      t->a = tmpl;
+      t->a.id_stride = n;
+      ok = OpenAssembly(&t->a, opt, n > 1);
+      std::snprintf(t->label, sizeof(t->label), "%d/%d", t->a.port, i);
+      t->stats.SetLabel(t->label);
+    }
+    if (ok && n > 1)
+      ok = AttachFrameSteering(threads[first]->a.sock, n);
+    if (ok) {
+      std::fprintf(stderr,
+                   "Listening for frames on UDP port %d (%s header), "
+                   "%d thread(s)\n", tmpl.port,
+                   tmpl.fmt == WIRE_COMPACT ? "6-byte" : "12-byte", n);
+    }
+  }
+
+  if (ok) {
+    FrameMailbox mailbox((int)threads.size(), WIDTH, HEIGHT);
+    MailboxFrame *mine = mailbox.TakeSpare();
+    for (auto &t : threads) {
+      t->spare = mailbox.TakeSpare();
+      t->stats.StartReporter(opt.stats_interval_s);
+      t->thread = std::thread(RxThreadMain, t.get(), opt.io_backend,
+                              opt.scatter, opt.sync, &mailbox);
+    }
+
+    bool have_last = false;
+    uint16_t last_id = 0;
+    PresentStats present;
+    int64_t report_us = MonoMicros() + opt.stats_interval_s * 1000000ll;
+    if (opt.jitter.enabled) {
+      PresentFromJitterBuffer(&mailbox, mine, opt, matrix, offscreen,
+                              frames_shown);
+    }
+    while (!interrupt_received) {
+      if (opt.sync && opt.stats_interval_s > 0 && MonoMicros() >= report_us) {
+        present.Print(stderr, *opt.sync);
+        report_us += opt.stats_interval_s * 1000000ll;
+      }
+      if (!mailbox.Wait(&mine, 200))
+        continue;
+      if (mine->has_frame_id) {
+        // Threads finish frames independently; never step backwards
+        // (a jump further back is a sender restart).
+        int16_t ahead = (int16_t)(mine->frame_id - last_id);
+        if (have_last && ahead <= 0 &&
+            ahead >= -STALE_FRAME_WINDOW * opt.rx_threads) {
+          continue;
+        }
+        have_last = true;
+        last_id = mine->frame_id;
+      }
+      DrawFrame(*offscreen, mine->pixels.data(), mine->width, mine->height,
+                mine->format);
+      if (mine->present_us == 0) {
+        present.untimed += opt.sync != nullptr;
+        *offscreen = matrix->SwapOnVSync(*offscreen);
+      } else {
+        // Draw first, then wait, so only the swap is left at the target.
+        // Far-off targets mean a bad offset; do not stall on them.
+        const int64_t now = MonoMicros();
+        if (mine->present_us <= now)
+          present.late++;
+        else if (mine->present_us - now < 1000000)
+          SleepUntilMicros(mine->present_us);
+        *offscreen = matrix->SwapOnVSync(*offscreen);
+        int64_t err = MonoMicros() - mine->present_us;
+        if (err < 0) err = -err;
+        present.timed++;
+        present.sum_abs_err += err;
+        present.max_abs_err = std::max(present.max_abs_err, err);
+      }
+      (*frames_shown)++;
+    }
+    if (opt.sync && !opt.jitter.enabled)
+      present.Print(stderr, *opt.sync);
+
+    for (auto &t : threads) {
+      t->thread.join();
+      t->stats.StopReporter();
+      t->stats.Print(stderr);
+    }
+    std::fprintf(stderr, "%llu frames replaced before display\n",
+                 (unsigned long long)mailbox.dropped());
+  }
+
+  for (auto &t : threads) {
+    if (t->a.sock >= 0)
+      close(t->a.sock);
+  }
+  return ok;
 }
 
 int main(int argc, char *argv[]) {
@@ -51,123 +682,218 @@ int main(int argc, char *argv[]) {
   defaults.parallel     = 3;   // 3 chains in parallel
   defaults.show_refresh_rate = true;
 
-  rgb_matrix::RuntimeOptions rt;
-  // If you use any special runtime options (e.g., gpio_slowdown), set them here.
-  // rt.gpio_slowdown = 2;  // example, if you used that before.
-
-  RGBMatrix *matrix = RGBMatrix::CreateFromOptions(defaults, rt);
+  // --led-* flags (e.g. --led-slowdown-gpio=2) are consumed here.
+  RGBMatrix *matrix = RGBMatrix::CreateFromFlags(&argc, &argv, &defaults);
   if (!matrix) {
     std::fprintf(stderr, "Could not create RGBMatrix\n");
     return 1;
   }
 
-  if (matrix->width() != WIDTH || matrix->height() != HEIGHT) {
-    std::fprintf(stderr, "Matrix size is %dx%d (expected %dx%d)\n",
-                 matrix->width(), matrix->height(), WIDTH, HEIGHT);
+  int stats_interval_s = 5;  // 0 disables the periodic stats report
+  int compact_port = UDP_PORT;            // 0 disables
+  int geometry_port = UDP_GEOMETRY_PORT;  // 0 disables
+  size_t chunk_size = CHUNK_SIZE;
+  int rcvbuf = 0;    // 0 keeps the kernel default
+  bool gro = false;
+  bool nack = false;
+  const char *io_backend = "epoll";
+  int nack_delay_ms = 3;
+  int nack_deadline_ms = 50;
+  int rx_threads = 1;
+  bool scatter = false;
+  const char *mcast = nullptr;
+  const char *mcast_if = nullptr;
+  int sync_port = 0;  // 0 disables synchronized presentation
+  JitterOptions jitter;
+  PowerOptions power_opt;
+  AdaptivePwmOptions pwm_opt;
+  for (int i = 1; i < argc; ++i) {
+    if (int r = ParseJitterFlag(argv[i], &jitter)) {
+      if (r < 0) {
+        delete matrix;
+        return 1;
+      }
+    } else if (int r = ParsePowerFlag(argv[i], &power_opt)) {
+      if (r < 0) {
+        delete matrix;
+        return 1;
+      }
+    } else if (int r = ParseAdaptivePwmFlag(argv[i], &pwm_opt)) {
+      if (r < 0) {
+        delete matrix;
+        return 1;
+      }
+    } else if (const char *v = FlagValue(argv[i], "--stats-interval")) {
+      stats_interval_s = std::atoi(v);
+    } else if (const char *v = FlagValue(argv[i], "--udp-port")) {
+      compact_port = std::atoi(v);
+    } else if (const char *v = FlagValue(argv[i], "--udp12-port")) {
+      geometry_port = std::atoi(v);
+    } else if (const char *v = FlagValue(argv[i], "--chunk-size")) {
+      chunk_size = std::strtoul(v, nullptr, 10);
+    } else if (const char *v = FlagValue(argv[i], "--rcvbuf")) {
+      rcvbuf = std::atoi(v);
+    } else if (const char *v = FlagValue(argv[i], "--mcast")) {
+      mcast = v;
+    } else if (const char *v = FlagValue(argv[i], "--mcast-if")) {
+      mcast_if = v;
+    } else if (const char *v = FlagValue(argv[i], "--sync-port")) {
+      sync_port = std::atoi(v);
+    } else if (FlagSet(argv[i], "--scatter")) {
+      scatter = true;
+    } else if (FlagSet(argv[i], "--gro")) {
+      gro = true;
+    } else if (const char *v = FlagValue(argv[i], "--rx-threads")) {
+      rx_threads = std::atoi(v);
+    } else if (const char *v = FlagValue(argv[i], "--io")) {
+      io_backend = v;
+    } else if (FlagSet(argv[i], "--nack")) {
+      nack = true;
+    } else if (const char *v = FlagValue(argv[i], "--nack-delay-ms")) {
+      nack_delay_ms = std::atoi(v);
+    } else if (const char *v = FlagValue(argv[i], "--nack-deadline-ms")) {
+      nack_deadline_ms = std::atoi(v);
+    } else if (const char *v = FlagValue(argv[i], "--lut")) {
+      if (!LoadColorLut(v, &color_lut, WIDTH, HEIGHT)) {
+        delete matrix;
+        return 1;
+      }
+    } else if (const char *v = FlagValue(argv[i], "--calibration")) {
+      if (!calibration.Load(v)) {
+        delete matrix;
+        return 1;
+      }
+    } else {
+      std::fprintf(stderr, "Unknown option: %s\n", argv[i]);
+      delete matrix;
+      return 1;
+    }
   }
 
-  FrameCanvas *offscreen = matrix->CreateFrameCanvas();
-
-  signal(SIGTERM, InterruptHandler);
-  signal(SIGINT,  InterruptHandler);
+  if (power_opt.enabled) {
+    power_opt.stats_interval_s = stats_interval_s;
+    power.Configure(power_opt, matrix->brightness(),
+                    matrix->luminance_correct());
+  }
+  if (pwm_opt.enabled) {
+    pwm_opt.stats_interval_s = stats_interval_s;
+    adaptive_pwm.Configure(pwm_opt, matrix->pwmbits());
+  }
 
-  // --- UDP socket setup ---
-  int sock = socket(AF_INET, SOCK_DGRAM, 0);
-  if (sock < 0) {
-    perror("socket");
+  if (chunk_size == 0 || chunk_size > MAX_CHUNK_SIZE) {
+    std::fprintf(stderr, "--chunk-size must be 1..%zu\n", MAX_CHUNK_SIZE);
+    delete matrix;
     return 1;
   }
 
-  int reuse = 1;
-  setsockopt(sock, SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof(reuse));
-
-  sockaddr_in addr;
-  std::memset(&addr, 0, sizeof(addr));
-  addr.sin_family = AF_INET;
-  addr.sin_port = htons(UDP_PORT);
-  addr.sin_addr.s_addr = htonl(INADDR_ANY);
-
-  if (bind(sock, (struct sockaddr *)&addr, sizeof(addr)) < 0) {
-    perror("bind");
-    close(sock);
+  if (rx_threads < 1 || rx_threads > MAX_RX_THREADS) {
+    std::fprintf(stderr, "--rx-threads must be 1..%d\n", MAX_RX_THREADS);
+    delete matrix;
     return 1;
   }
 
-  std::fprintf(stderr, "Listening for frames on UDP port %d\n", UDP_PORT);
+  if (scatter && gro) {
+    // A GRO read holds several datagrams; scatter lands exactly one.
+    std::fprintf(stderr, "--scatter and --gro are mutually exclusive\n");
+    delete matrix;
+    return 1;
+  }
 
-  // --- Frame reassembly buffers ---
-  std::vector<uint8_t> frame_buf(FRAME_BYTES, 0);
-  uint16_t current_frame_id = 0;
-  uint16_t expected_packets = 0;
-  std::vector<bool> got_packet;
-  size_t received_packets = 0;
+  if (jitter.enabled && sync_port <= 0) {
+    // The timestamps arrive on the sync port.
+    std::fprintf(stderr, "--jitter-buffer needs --sync-port\n");
+    delete matrix;
+    return 1;
+  }
 
-  std::vector<uint8_t> recv_buf(HEADER_SIZE + CHUNK_SIZE);
+  if (matrix->width() != WIDTH || matrix->height() != HEIGHT) {
+    std::fprintf(stderr, "Matrix size is %dx%d (expected %dx%d)\n",
+                 matrix->width(), matrix->height(), WIDTH, HEIGHT);
+  }
 
-  while (!interrupt_received) {
-    ssize_t n = recv(sock, recv_buf.data(), recv_buf.size(), 0);
-    if (n < (ssize_t)HEADER_SIZE)
-      continue;
+  FrameCanvas *offscreen = matrix->CreateFrameCanvas();
 
-    UdpPacketHeader hdr;
-    std::memcpy(&hdr.frame_id,   &recv_buf[0], 2);
-    std::memcpy(&hdr.packet_index, &recv_buf[2], 2);
-    std::memcpy(&hdr.total_packets, &recv_buf[4], 2);
+  signal(SIGTERM, InterruptHandler);
+  signal(SIGINT,  InterruptHandler);
 
-    // Network byte order to host
-    hdr.frame_id = ntohs(hdr.frame_id);
-    hdr.packet_index = ntohs(hdr.packet_index);
-    hdr.total_packets = ntohs(hdr.total_packets);
+  // --- UDP setup: one assembly per wire format ---
+  FrameAssembly assemblies[2];
+  assemblies[0].fmt = WIRE_COMPACT;
+  assemblies[0].port = compact_port;
+  assemblies[1].fmt = WIRE_GEOMETRY;
+  assemblies[1].port = geometry_port;
 
-    size_t payload_len = n - HEADER_SIZE;
-    if (payload_len > CHUNK_SIZE)
+  int nports = 0;
+  for (FrameAssembly &a : assemblies) {
+    if (a.port <= 0)
       continue;
+    a.chunk_size = chunk_size;
+    a.nack = nack && a.fmt == WIRE_COMPACT;
+    a.nack_delay_us = (uint64_t)nack_delay_ms * 1000;
+    a.nack_deadline_us = (uint64_t)nack_deadline_ms * 1000;
+    nports++;
+  }
+  if (nports == 0) {
+    std::fprintf(stderr, "No UDP ports enabled\n");
+    delete matrix;
+    return 1;
+  }
 
-    // New frame?
-    if (hdr.frame_id != current_frame_id) {
-      current_frame_id = hdr.frame_id;
-      expected_packets = hdr.total_packets;
-      got_packet.assign(expected_packets, false);
-      received_packets = 0;
-      std::fill(frame_buf.begin(), frame_buf.end(), 0);
+  UdpOptions opt;
+  opt.rcvbuf = rcvbuf;
+  opt.gro = gro;
+  opt.io_backend = io_backend;
+  opt.stats_interval_s = stats_interval_s;
+  opt.rx_threads = rx_threads;
+  opt.scatter = scatter;
+  opt.mcast = mcast;
+  opt.mcast_if = mcast_if;
+  opt.jitter = jitter;
+
+  ClockSync sync;
+  if (sync_port > 0) {
+    int sock = OpenUdpSocket(sync_port, 0, false, false);
+    if (sock < 0 || (mcast && !JoinMulticast(sock, mcast, mcast_if))) {
+      delete matrix;
+      return 1;
     }
-
-    if (hdr.packet_index >= expected_packets)
-      continue;
-
-    size_t offset = (size_t)hdr.packet_index * CHUNK_SIZE;
-    if (offset >= FRAME_BYTES)
-      continue;
-
-    size_t copy_len = payload_len;
-    if (offset + copy_len > FRAME_BYTES) {
-      copy_len = FRAME_BYTES - offset;
+    if (!sync.Start(sock, io_backend)) {
+      delete matrix;
+      return 1;
     }
-
-    std::memcpy(&frame_buf[offset], &recv_buf[HEADER_SIZE], copy_len);
-
-    if (!got_packet[hdr.packet_index]) {
-      got_packet[hdr.packet_index] = true;
-      received_packets++;
+    opt.sync = &sync;
+    if (jitter.enabled) {
+      std::fprintf(stderr, "Jitter buffer on sender timestamps (sync port %d, "
+                   "delay %lld..%lld ms, late frames: %s)\n", sync_port,
+                   (long long)jitter.min_delay_us / 1000,
+                   (long long)jitter.max_delay_us / 1000,
+                   jitter.late == LATE_DROP ? "drop" : "show");
+    } else {
+      std::fprintf(stderr, "Presenting at sender timestamps (sync port %d)\n",
+                   sync_port);
     }
+  }
 
-    // If we have all packets for this frame, draw it.
-    if (received_packets == expected_packets) {
-      // Render to matrix
-      const uint8_t *p = frame_buf.data();
-      for (int y = 0; y < HEIGHT; ++y) {
-        for (int x = 0; x < WIDTH; ++x) {
-          uint8_t r = *p++;
-          uint8_t g = *p++;
-          uint8_t b = *p++;
-          offscreen->SetPixel(x, y, r, g, b);
-        }
-      }
-      offscreen = matrix->SwapOnVSync(offscreen);
-    }
+  uint64_t frames_shown = 0;
+  // Timed presentation needs the draw loop off the receive thread.
+  bool ok = rx_threads > 1 || opt.sync
+      ? RunThreaded(assemblies, opt, matrix, &offscreen, &frames_shown)
+      : RunInline(assemblies, opt, matrix, &offscreen, &frames_shown);
+  if (!ok) {
+    delete matrix;
+    return 1;
   }
 
-  close(sock);
+  rusage ru;
+  getrusage(RUSAGE_SELF, &ru);
+  double cpu_ms = ru.ru_utime.tv_sec * 1e3 + ru.ru_utime.tv_usec / 1e3 +
+                  ru.ru_stime.tv_sec * 1e3 + ru.ru_stime.tv_usec / 1e3;
+  std::fprintf(stderr, "%llu frames shown, %.0f ms CPU (%.3f ms/frame)\n",
+               (unsigned long long)frames_shown, cpu_ms,
+               frames_shown ? cpu_ms / frames_shown : 0.0);
+  if (power.enabled()) power.Print(stderr);
+  if (adaptive_pwm.enabled()) adaptive_pwm.Print(stderr);
+
   matrix->Clear();
   delete matrix;
   return 0;
@@ -0,0 +1,951 @@
+// udp_matrix_sender.cc
+// Stream raw 256x192 RGB24 frames to udp_matrix_receiver (or
+// udp_led_receiver.py). Frames come from a file, a pipe (stdin) or a
+// generated test pattern. Packets are spread evenly across the frame
+// interval and handed to the kernel in batches, either with sendmmsg or as
+// one UDP GSO super-datagram per batch. Also serves as a load generator for
+// benchmarking receivers on loopback.
+//
+// With --retransmit=N the last N frames are kept and packets the receiver
+// NACKs (udp_matrix_receiver --nack, 6-byte format) are sent again.
+//
+// With --region (or --map) the input is a larger --canvas cut into
+// 256x192 regions, each streamed to its own receiver by a pool of threads
+// that share one frame clock, e.g. two walls side by side:
+//
+//   udp_matrix_sender --canvas=512x192 --region=0,0=10.0.0.11:5005
+//                     --region=256,0=10.0.0.12:5005
+//
+// With --wire-size=WxH (12-byte format) every frame is scaled to WxH before
+// it is sent, e.g. 128x96 for a quarter of the bandwidth; the receiver
+// scales it back to the wall. --pixel-format=F (12-byte format) sends
+// frames in another layout of pixel_format.h, e.g. yuv420 for half the
+// bytes of rgb24 or bc1 for a sixth; the input is still rgb24 and
+// converted per frame. bc1 packets carry whole 8-byte blocks. delta sends
+// each frame as motion vectors and corrections on the one before
+// (delta_codec.h), a scroll or pan in a few KB, with a key frame every
+// --keyframe-interval frames to recover from loss.
+//
+// With --pts-delay-ms=D every frame is announced on the sync port with a
+// presentation time D ms ahead, and receiver clock probes are answered, so
+// several walls (e.g. one multicast --dest) swap each frame together.
+//
+//   udp_matrix_sender --dest=192.168.1.48:9999 --format=12 --input=pattern:plasma
+//   ffmpeg ... -f rawvideo -pix_fmt rgb24 -s 256x192 - | udp_matrix_sender --input=-
+
+#include "cli_flags.h"
+#include "delta_codec.h"
+#include "frame_resampler.h"
+#include "udp_frame_protocol.h"
+
+#include <arpa/inet.h>
+#include <fcntl.h>
+#include <netinet/in.h>
+#include <netinet/udp.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <cmath>
+#include <csignal>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <ctime>
+#include <condition_variable>
+#include <fstream>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#ifndef UDP_SEGMENT
+#define UDP_SEGMENT 103  // linux/udp.h, kernel >= 4.18
+#endif
+
+static volatile bool interrupt_received = false;
+static void InterruptHandler(int) { interrupt_received = true; }
+
+static const int WIDTH  = 256;  // 4 * 64
+static const int HEIGHT = 192;  // 3 * 64
+
+static const size_t CHUNK_SIZE = 1024;  // matches the receiver default
+static const size_t MAX_BATCH = 64;     // kernel limit for GSO segments
+static const size_t MAX_GSO_BYTES = 65507;
+
+enum InputKind {
+  INPUT_FILE,
+  INPUT_PATTERN,
+};
+
+enum SendMode {
+  SEND_MMSG,
+  SEND_GSO,
+};
+
+struct SenderOptions {
+  std::string dest = "127.0.0.1:5005";
+  WireFormat format = WIRE_COMPACT;
+  size_t chunk_size = CHUNK_SIZE;
+  std::string input = "pattern:plasma";
+  double fps = 60.0;      // 0 = as fast as possible
+  size_t batch = 8;       // packets per kernel call
+  SendMode mode = SEND_MMSG;
+  bool pace = true;       // spread batches across the frame interval
+  bool loop = false;      // restart a file input at EOF
+  long frames = 0;        // stop after this many frames; 0 = forever
+  int sndbuf = 0;
+  size_t retransmit = 0;  // frames kept for NACK retransmission; 0 = off
+  int pts_delay_ms = 0;   // presentation delay; 0 = no timestamps
+  int sync_port = 5006;
+  int ttl = 1;            // multicast hops
+  int canvas_w = WIDTH;   // input frame size; regions are cut from it
+  int canvas_h = HEIGHT;
+  int wire_w = WIDTH;     // frame size on the wire (12-byte format)
+  int wire_h = HEIGHT;
+  PixelFormat pixel_format = PIXEL_RGB24;  // on the wire (12-byte format)
+  int keyframe_interval = 60;  // delta frames from one key frame to the next
+  std::vector<std::string> regions;  // "X,Y=IP:PORT"
+  int threads = 0;        // sharding threads; 0 = one per region, up to cores
+};
+
+static uint64_t NowNanos() {
+  timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+static void SleepUntil(uint64_t deadline_ns) {
+  timespec ts;
+  ts.tv_sec = deadline_ns / 1000000000ull;
+  ts.tv_nsec = deadline_ns % 1000000000ull;
+  while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, nullptr) == EINTR
+         && !interrupt_received) {
+  }
+}
+
+static bool ReadNBytes(int fd, uint8_t *buf, size_t n) {
+  size_t total = 0;
+  while (total < n) {
+    ssize_t got = read(fd, buf + total, n - total);
+    if (got < 0 && errno == EINTR)
+      continue;
+    if (got <= 0) {
+      return false;  // error or EOF
+    }
+    total += got;
+  }
+  return true;
+}
+
+// --- Test patterns -------------------------------------------------------
+
+static void PlasmaPattern(uint8_t *frame, int w, int h, float t) {
+  uint8_t *p = frame;
+  for (int y = 0; y < h; ++y) {
+    float py = ((float)y / (h - 1) - 0.5f) * 2.0f;
+    for (int x = 0; x < w; ++x) {
+      float px = ((float)x / (w - 1) - 0.5f) * 2.0f;
+      float val = (std::sin(px * 3.0f + t * 0.7f) +
+                   std::sin(py * 4.0f - t * 1.3f) +
+                   std::sin((px + py) * 5.0f + t * 0.5f)) / 3.0f;
+      float angle = 6.28318f * val;
+      *p++ = (uint8_t)(127.5f + 127.5f * std::cos(angle));
+      *p++ = (uint8_t)(127.5f + 127.5f * std::cos(angle + 2.094f));
+      *p++ = (uint8_t)(127.5f + 127.5f * std::cos(angle + 4.188f));
+    }
+  }
+}
+
+// Vertical color bars scrolling one pixel per frame; cheap enough that the
+// sender itself never limits a loopback benchmark.
+static void BarsPattern(uint8_t *frame, int w, int h, long frame_no) {
+  static const uint8_t kBars[8][3] = {
+    {255, 255, 255}, {255, 255, 0}, {0, 255, 255}, {0, 255, 0},
+    {255, 0, 255},   {255, 0, 0},   {0, 0, 255},   {0, 0, 0},
+  };
+  uint8_t *row = frame;
+  for (int x = 0; x < w; ++x) {
+    const uint8_t *c = kBars[((x + frame_no) / (WIDTH / 8)) % 8];
+    row[3 * x + 0] = c[0];
+    row[3 * x + 1] = c[1];
+    row[3 * x + 2] = c[2];
+  }
+  for (int y = 1; y < h; ++y)
+    std::memcpy(frame + (size_t)y * w * 3, row, (size_t)w * 3);
+}
+
+// --- Packetizing ---------------------------------------------------------
+
+// All packets of a frame live back to back in one buffer with a fixed
+// stride, so a run of them is directly a valid GSO super-datagram.
+struct PacketizedFrame {
+  std::vector<uint8_t> buf;
+  size_t stride = 0;      // header + chunk
+  size_t count = 0;
+  size_t last_len = 0;    // the final packet may be short
+
+  size_t Len(size_t i) const { return i + 1 == count ? last_len : stride; }
+  uint8_t *At(size_t i) { return buf.data() + i * stride; }
+};
+
+// Copy bytes [offset, offset + len) of a frame with `row_bytes` bytes per
+// row whose rows are `pitch` bytes apart (a region of a larger canvas) to
+// dst.
+static void CopyFrameBytes(uint8_t *dst, const uint8_t *frame, size_t pitch,
+                           size_t row_bytes, size_t offset, size_t len) {
+  if (pitch == row_bytes) {
+    std::memcpy(dst, frame + offset, len);
+    return;
+  }
+  while (len > 0) {
+    const size_t y = offset / row_bytes, x = offset % row_bytes;
+    const size_t n = std::min(len, row_bytes - x);
+    std::memcpy(dst, frame + y * pitch + x, n);
+    dst += n;
+    offset += n;
+    len -= n;
+  }
+}
+
+// Cut and packetize in one pass: `frame` is the top-left pixel of a
+// width x height region and `pitch` the canvas row size, so regions need no
+// separate crop copy. Frames in other pixel formats than rgb24 are whole,
+// `frame_bytes` long (delta frames vary), and `pitch` is ignored for them.
+static void Packetize(const uint8_t *frame, size_t pitch, int width,
+                      int height, PixelFormat format, size_t frame_bytes,
+                      uint16_t frame_id, const SenderOptions &opt,
+                      PacketizedFrame *out) {
+  const size_t hdr = HeaderSize(opt.format);
+  const size_t row_bytes =
+      format == PIXEL_RGB24 ? (size_t)width * 3 : frame_bytes;
+  if (format != PIXEL_RGB24) pitch = row_bytes;
+  const size_t count = (frame_bytes + opt.chunk_size - 1) / opt.chunk_size;
+  out->stride = hdr + opt.chunk_size;
+  out->count = count;
+  out->buf.resize(out->stride * count);
+
+  for (size_t i = 0; i < count; ++i) {
+    const size_t offset = i * opt.chunk_size;
+    const size_t len = std::min(opt.chunk_size, frame_bytes - offset);
+    uint8_t *p = out->At(i);
+    if (opt.format == WIRE_COMPACT) {
+      WriteCompactHeader(p, frame_id, i, count);
+    } else {
+      WriteGeometryHeader(p, width, height, i, count, offset, format);
+    }
+    CopyFrameBytes(p + hdr, frame, pitch, row_bytes, offset, len);
+    out->last_len = hdr + len;
+  }
+}
+
+// Send packets [first, first + n). Returns the number the kernel accepted.
+static size_t SendBatch(int sock, const sockaddr_in &dest, PacketizedFrame *f,
+                        size_t first, size_t n, SendMode mode) {
+  if (mode == SEND_GSO) {
+    size_t bytes = 0;
+    for (size_t i = first; i < first + n; ++i) bytes += f->Len(i);
+    iovec iov = {f->At(first), bytes};
+    char cbuf[CMSG_SPACE(sizeof(uint16_t))];
+    msghdr msg;
+    std::memset(&msg, 0, sizeof(msg));
+    msg.msg_name = (void *)&dest;
+    msg.msg_namelen = sizeof(dest);
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    if (n > 1) {
+      msg.msg_control = cbuf;
+      msg.msg_controllen = sizeof(cbuf);
+      cmsghdr *c = CMSG_FIRSTHDR(&msg);
+      c->cmsg_level = SOL_UDP;
+      c->cmsg_type = UDP_SEGMENT;
+      c->cmsg_len = CMSG_LEN(sizeof(uint16_t));
+      uint16_t seg = f->stride;
+      std::memcpy(CMSG_DATA(c), &seg, sizeof(seg));
+    }
+    return sendmsg(sock, &msg, 0) < 0 ? 0 : n;
+  }
+
+  mmsghdr msgs[MAX_BATCH];
+  iovec iovs[MAX_BATCH];
+  std::memset(msgs, 0, sizeof(mmsghdr) * n);
+  for (size_t k = 0; k < n; ++k) {
+    iovs[k].iov_base = f->At(first + k);
+    iovs[k].iov_len = f->Len(first + k);
+    msgs[k].msg_hdr.msg_name = (void *)&dest;
+    msgs[k].msg_hdr.msg_namelen = sizeof(dest);
+    msgs[k].msg_hdr.msg_iov = &iovs[k];
+    msgs[k].msg_hdr.msg_iovlen = 1;
+  }
+  size_t sent = 0;
+  while (sent < n) {
+    int r = sendmmsg(sock, msgs + sent, n - sent, 0);
+    if (r <= 0) break;
+    sent += r;
+  }
+  return sent;
+}
+
+// Keeps the last few packetized frames and answers NACKs from the receiver,
+// and (with --pts-delay-ms) clock probes from synchronized receivers.
+struct Retransmitter {
+  int sock = -1;
+  sockaddr_in dest;
+  std::vector<PacketizedFrame> ring;
+  std::vector<int> ids;  // frame id held in each ring slot, -1 if none
+  bool clock_server = false;
+
+  // Written by the stream's thread, read by the reporter.
+  std::atomic<uint64_t> nacks{0};
+  std::atomic<uint64_t> resent{0};
+  std::atomic<uint64_t> expired{0};  // NACKs for frames already dropped
+  std::atomic<uint64_t> probes{0};
+
+  bool enabled() const { return !ring.empty(); }
+  // Whether the socket has to be read while we wait between batches.
+  bool listening() const { return enabled() || clock_server; }
+
+  void Init(int s, const sockaddr_in &d, size_t frames) {
+    sock = s;
+    dest = d;
+    ring.resize(frames);
+    ids.assign(frames, -1);
+  }
+
+  // Slot the next frame is packetized into, so no copy is needed.
+  PacketizedFrame *SlotFor(uint16_t frame_id) {
+    size_t k = frame_id % ring.size();
+    ids[k] = frame_id;
+    return &ring[k];
+  }
+
+  // Drain pending NACKs and clock probes without blocking.
+  void Service() {
+    uint8_t buf[NACK_HEADER_SIZE + MAX_NACK_BITMAP];
+    const bool multicast = IN_MULTICAST(ntohl(dest.sin_addr.s_addr));
+    for (;;) {
+      sockaddr_in from;
+      socklen_t from_len = sizeof(from);
+      ssize_t n = recvfrom(sock, buf, sizeof(buf), MSG_DONTWAIT,
+                           (sockaddr *)&from, &from_len);
+      if (n < 0)
+        return;
+      const uint64_t t2 = NowNanos() / 1000;
+      ClockProbe probe;
+      if (clock_server && ParseClockProbe(buf, n, false, &probe)) {
+        probe.t2 = t2;
+        probe.t3 = NowNanos() / 1000;
+        size_t len = BuildClockProbe(buf, true, probe);
+        sendto(sock, buf, len, 0, (const sockaddr *)&from, sizeof(from));
+        probes++;
+        continue;
+      }
+      uint16_t frame_id, first;
+      const uint8_t *bitmap;
+      size_t bitmap_len;
+      // With a multicast dest the NACKs come from each wall's own address.
+      if (!enabled() ||
+          (!multicast && from.sin_addr.s_addr != dest.sin_addr.s_addr) ||
+          !ParseNack(buf, n, &frame_id, &first, &bitmap, &bitmap_len)) {
+        continue;
+      }
+      nacks++;
+      size_t k = frame_id % ring.size();
+      if (ids[k] != frame_id) {
+        expired++;
+        continue;
+      }
+      PacketizedFrame *f = &ring[k];
+      for (size_t bit = 0; bit < bitmap_len * 8; ++bit) {
+        if (!(bitmap[bit / 8] & (1 << (bit % 8))))
+          continue;
+        size_t i = first + bit;
+        if (i >= f->count)
+          break;
+        if (sendto(sock, f->At(i), f->Len(i), 0, (const sockaddr *)&dest,
+                   sizeof(dest)) > 0) {
+          resent++;
+        }
+      }
+    }
+  }
+};
+
+static bool ParseDest(const std::string &s, sockaddr_in *addr) {
+  size_t colon = s.rfind(':');
+  if (colon == std::string::npos)
+    return false;
+  std::memset(addr, 0, sizeof(*addr));
+  addr->sin_family = AF_INET;
+  addr->sin_port = htons(std::atoi(s.c_str() + colon + 1));
+  return inet_pton(AF_INET, s.substr(0, colon).c_str(), &addr->sin_addr) == 1;
+}
+
+// --- Streams ---------------------------------------------------------------
+
+// One destination and the canvas region it shows (the whole frame unless
+// sharding). Each stream has its own socket, so threads never share one.
+struct Stream {
+  std::string name;       // "IP:PORT" for messages
+  sockaddr_in dest;
+  sockaddr_in sync_dest;
+  int x = 0, y = 0;       // region origin on the canvas
+  int sock = -1;
+  Retransmitter rtx;
+  PacketizedFrame single;
+  PacketizedFrame *cur = nullptr;
+  FrameResampler resampler;     // --wire-size
+  std::vector<uint8_t> scaled;
+  std::vector<uint8_t> encoded;  // --pixel-format
+  DeltaEncoder delta;            // --pixel-format=delta
+};
+
+// Totals across all streams, for the once-a-second report.
+struct SendCounters {
+  std::atomic<uint64_t> pkts{0};
+  std::atomic<uint64_t> bytes{0};
+  std::atomic<uint64_t> dropped{0};
+  std::atomic<uint64_t> calls{0};
+};
+
+// "X,Y=IP:PORT"
+static bool ParseRegion(const std::string &s, Stream *st) {
+  size_t eq = s.find('=');
+  if (eq == std::string::npos ||
+      std::sscanf(s.c_str(), "%d,%d", &st->x, &st->y) != 2) {
+    return false;
+  }
+  st->name = s.substr(eq + 1);
+  return ParseDest(st->name, &st->dest);
+}
+
+static bool OpenStream(Stream *st, const SenderOptions &opt) {
+  st->sock = socket(AF_INET, SOCK_DGRAM, 0);
+  if (st->sock < 0) {
+    perror("socket");
+    return false;
+  }
+  if (opt.sndbuf > 0 &&
+      setsockopt(st->sock, SOL_SOCKET, SO_SNDBUFFORCE, &opt.sndbuf,
+                 sizeof(opt.sndbuf)) < 0) {
+    setsockopt(st->sock, SOL_SOCKET, SO_SNDBUF, &opt.sndbuf,
+               sizeof(opt.sndbuf));
+  }
+  if (IN_MULTICAST(ntohl(st->dest.sin_addr.s_addr)) &&
+      setsockopt(st->sock, IPPROTO_IP, IP_MULTICAST_TTL, &opt.ttl,
+                 sizeof(opt.ttl)) < 0) {
+    perror("setsockopt(IP_MULTICAST_TTL)");
+  }
+  st->sync_dest = st->dest;
+  st->sync_dest.sin_port = htons(opt.sync_port);
+  st->rtx.sock = st->sock;
+  st->rtx.dest = st->dest;
+  if (opt.retransmit)
+    st->rtx.Init(st->sock, st->dest, opt.retransmit);
+  st->rtx.clock_server = opt.pts_delay_ms > 0;
+  if (opt.pixel_format == PIXEL_DELTA)
+    st->delta.Configure(opt.wire_w, opt.wire_h, opt.keyframe_interval);
+  return true;
+}
+
+// Sleep until the deadline, answering NACKs and clock probes meanwhile.
+static void WaitStreams(const std::vector<Stream *> &streams,
+                        uint64_t deadline_ns) {
+  pollfd pfds[64];
+  size_t n = 0;
+  for (Stream *st : streams) {
+    if (st->rtx.listening() && n < 64) pfds[n++] = {st->sock, POLLIN, 0};
+  }
+  if (n == 0) {
+    SleepUntil(deadline_ns);
+    return;
+  }
+  for (;;) {
+    for (Stream *st : streams) {
+      if (st->rtx.listening()) st->rtx.Service();
+    }
+    uint64_t now = NowNanos();
+    if (now >= deadline_ns || interrupt_received)
+      return;
+    uint64_t left = deadline_ns - now;
+    timespec ts = {(time_t)(left / 1000000000ull),
+                   (long)(left % 1000000000ull)};
+    ppoll(pfds, n, &ts, nullptr);
+  }
+}
+
+// Send one frame to each of `streams` (all served by the calling thread).
+// Batches of the streams are interleaved and, when pacing, spread over
+// [start_ns, start_ns + frame_ns).
+static void SendFrame(const std::vector<Stream *> &streams,
+                      const uint8_t *canvas, size_t pitch, uint16_t frame_id,
+                      uint64_t start_ns, uint64_t frame_ns,
+                      const SenderOptions &opt, SendCounters *c) {
+  size_t batches = 0;
+  for (Stream *st : streams) {
+    if (opt.pts_delay_ms > 0) {
+      // Announce the frame before its packets; the delay has to cover the
+      // paced send, the network and the receivers' draw.
+      uint8_t msg[PTS_SIZE];
+      size_t len = BuildPts(msg, frame_id,
+                            start_ns / 1000 + opt.pts_delay_ms * 1000ull);
+      sendto(st->sock, msg, len, 0, (const sockaddr *)&st->sync_dest,
+             sizeof(st->sync_dest));
+    }
+    st->cur = st->rtx.enabled() ? st->rtx.SlotFor(frame_id) : &st->single;
+    const uint8_t *frame =
+        canvas + (size_t)st->y * pitch + (size_t)st->x * 3;
+    size_t frame_pitch = pitch;
+    const int w = opt.wire_w, h = opt.wire_h;
+    const size_t row_bytes = (size_t)w * 3;
+    size_t frame_bytes = PixelFrameBytes(opt.pixel_format, w, h);
+    if (w != WIDTH || h != HEIGHT) {
+      st->resampler.Configure(WIDTH, HEIGHT, w, h);
+      st->scaled.resize(row_bytes * h);
+      for (int y = 0; y < h; ++y)
+        st->resampler.Row(frame, y, &st->scaled[y * row_bytes], pitch);
+      frame = st->scaled.data();
+      frame_pitch = row_bytes;
+    }
+    if (opt.pixel_format != PIXEL_RGB24) {
+      if (frame_pitch != row_bytes) {  // a region: crop it first
+        st->scaled.resize(row_bytes * h);
+        for (int y = 0; y < h; ++y)
+          std::memcpy(&st->scaled[y * row_bytes], frame + y * frame_pitch,
+                      row_bytes);
+        frame = st->scaled.data();
+      }
+      st->encoded.resize(frame_bytes);
+      if (opt.pixel_format == PIXEL_DELTA)
+        frame_bytes = st->delta.Encode(frame, st->encoded.data());
+      else
+        ConvertFromRgb24(opt.pixel_format, frame, w, h, st->encoded.data());
+      frame = st->encoded.data();
+    }
+    Packetize(frame, frame_pitch, w, h, opt.pixel_format, frame_bytes,
+              frame_id, opt, st->cur);
+    batches = std::max(batches, (st->cur->count + opt.batch - 1) / opt.batch);
+  }
+
+  for (size_t b = 0; b < batches && !interrupt_received; ++b) {
+    if (frame_ns && opt.pace)
+      WaitStreams(streams, start_ns + frame_ns * b / batches);
+    else
+      WaitStreams(streams, 0);  // just answer NACKs / probes
+    for (Stream *st : streams) {
+      size_t first = b * opt.batch;
+      if (first >= st->cur->count)
+        continue;
+      size_t n = std::min(opt.batch, st->cur->count - first);
+      size_t ok = SendBatch(st->sock, st->dest, st->cur, first, n, opt.mode);
+      uint64_t bytes = 0;
+      for (size_t i = first; i < first + ok; ++i) bytes += st->cur->Len(i);
+      c->calls.fetch_add(1, std::memory_order_relaxed);
+      c->pkts.fetch_add(ok, std::memory_order_relaxed);
+      c->dropped.fetch_add(n - ok, std::memory_order_relaxed);
+      c->bytes.fetch_add(bytes, std::memory_order_relaxed);
+    }
+  }
+}
+
+// Sharding threads: the main thread publishes each canvas frame with its
+// start time (the global frame clock) and every worker sends its regions.
+// The main thread reads the next frame meanwhile and waits for all workers
+// before it publishes again, so canvases can be double buffered.
+class ShardPool {
+ public:
+  ShardPool(std::vector<std::vector<Stream *>> groups, size_t pitch,
+            uint64_t frame_ns, const SenderOptions &opt, SendCounters *c)
+      : groups_(std::move(groups)), pitch_(pitch), frame_ns_(frame_ns),
+        opt_(opt), counters_(c) {
+    for (size_t i = 0; i < groups_.size(); ++i)
+      threads_.emplace_back(&ShardPool::Worker, this, i);
+  }
+
+  ~ShardPool() {
+    {
+      std::lock_guard<std::mutex> l(mu_);
+      quit_ = true;
+    }
+    cv_.notify_all();
+    for (std::thread &t : threads_) t.join();
+  }
+
+  // Wait for the previous frame to go out, then start this one.
+  void Publish(const uint8_t *canvas, uint16_t frame_id, uint64_t start_ns) {
+    std::unique_lock<std::mutex> l(mu_);
+    done_cv_.wait(l, [this] { return busy_ == 0; });
+    canvas_ = canvas;
+    frame_id_ = frame_id;
+    start_ns_ = start_ns;
+    busy_ = threads_.size();
+    generation_++;
+    cv_.notify_all();
+  }
+
+  void Drain() {
+    std::unique_lock<std::mutex> l(mu_);
+    done_cv_.wait(l, [this] { return busy_ == 0; });
+  }
+
+ private:
+  void Worker(size_t index) {
+    uint64_t seen = 0;
+    for (;;) {
+      const uint8_t *canvas;
+      uint16_t frame_id;
+      uint64_t start_ns;
+      {
+        std::unique_lock<std::mutex> l(mu_);
+        cv_.wait(l, [&] { return quit_ || generation_ != seen; });
+        if (quit_)
+          return;
+        seen = generation_;
+        canvas = canvas_;
+        frame_id = frame_id_;
+        start_ns = start_ns_;
+      }
+      SendFrame(groups_[index], canvas, pitch_, frame_id, start_ns, frame_ns_,
+                opt_, counters_);
+      std::lock_guard<std::mutex> l(mu_);
+      if (--busy_ == 0) done_cv_.notify_all();
+    }
+  }
+
+  std::vector<std::vector<Stream *>> groups_;
+  size_t pitch_;
+  uint64_t frame_ns_;
+  const SenderOptions &opt_;
+  SendCounters *counters_;
+  std::vector<std::thread> threads_;
+
+  std::mutex mu_;
+  std::condition_variable cv_, done_cv_;
+  bool quit_ = false;
+  uint64_t generation_ = 0;
+  size_t busy_ = 0;
+  const uint8_t *canvas_ = nullptr;
+  uint16_t frame_id_ = 0;
+  uint64_t start_ns_ = 0;
+};
+
+static int usage(const char *progname) {
+  std::fprintf(stderr,
+      "usage: %s [options]\n"
+      "  --dest=IP:PORT       receiver (default 127.0.0.1:5005)\n"
+      "  --format=6|12        6-byte compact or 12-byte geometry header\n"
+      "  --chunk-size=N       payload bytes per packet (default 1024)\n"
+      "  --input=SRC          FILE, - (stdin), pattern:plasma, pattern:bars\n"
+      "  --loop               restart a file input at EOF\n"
+      "  --fps=N              frame rate; 0 sends as fast as possible\n"
+      "  --frames=N           stop after N frames\n"
+      "  --batch=N            packets per kernel call (max 64)\n"
+      "  --mode=mmsg|gso      sendmmsg batches or UDP GSO super-datagrams\n"
+      "  --burst              send each frame at once instead of pacing\n"
+      "  --sndbuf=BYTES       socket send buffer\n"
+      "  --retransmit=N       keep N frames and answer receiver NACKs\n"
+      "  --pts-delay-ms=N     send presentation timestamps N ms ahead\n"
+      "  --sync-port=N        receivers' sync port (default 5006)\n"
+      "  --ttl=N              multicast TTL (default 1)\n"
+      "  --wire-size=WxH      scale frames to WxH for sending (12-byte format)\n"
+      "  --pixel-format=F     send rgb24, rgba, bgr24, gray, yuv420, nv12,\n"
+      "                       bc1 or delta (12-byte format)\n"
+      "  --keyframe-interval=N  a delta key frame every N frames (default 60)\n"
+      "  --canvas=WxH         input frame size when sharding (default 256x192)\n"
+      "  --region=X,Y=IP:PORT send the 256x192 region at X,Y to IP:PORT\n"
+      "                       (repeatable; replaces --dest)\n"
+      "  --map=FILE           regions from FILE, one X,Y=IP:PORT per line\n"
+      "  --threads=N          sharding threads (default: one per region,\n"
+      "                       at most one per core)\n",
+      progname);
+  return 1;
+}
+
+int main(int argc, char *argv[]) {
+  SenderOptions opt;
+  for (int i = 1; i < argc; ++i) {
+    const char *v;
+    if ((v = FlagValue(argv[i], "--dest"))) {
+      opt.dest = v;
+    } else if ((v = FlagValue(argv[i], "--format"))) {
+      opt.format = std::strcmp(v, "12") == 0 ? WIRE_GEOMETRY : WIRE_COMPACT;
+    } else if ((v = FlagValue(argv[i], "--chunk-size"))) {
+      opt.chunk_size = std::strtoul(v, nullptr, 10);
+    } else if ((v = FlagValue(argv[i], "--input"))) {
+      opt.input = v;
+    } else if ((v = FlagValue(argv[i], "--fps"))) {
+      opt.fps = std::atof(v);
+    } else if ((v = FlagValue(argv[i], "--frames"))) {
+      opt.frames = std::atol(v);
+    } else if ((v = FlagValue(argv[i], "--batch"))) {
+      opt.batch = std::strtoul(v, nullptr, 10);
+    } else if ((v = FlagValue(argv[i], "--mode"))) {
+      opt.mode = std::strcmp(v, "gso") == 0 ? SEND_GSO : SEND_MMSG;
+    } else if ((v = FlagValue(argv[i], "--sndbuf"))) {
+      opt.sndbuf = std::atoi(v);
+    } else if ((v = FlagValue(argv[i], "--retransmit"))) {
+      opt.retransmit = std::strtoul(v, nullptr, 10);
+    } else if ((v = FlagValue(argv[i], "--pts-delay-ms"))) {
+      opt.pts_delay_ms = std::atoi(v);
+    } else if ((v = FlagValue(argv[i], "--sync-port"))) {
+      opt.sync_port = std::atoi(v);
+    } else if ((v = FlagValue(argv[i], "--ttl"))) {
+      opt.ttl = std::atoi(v);
+    } else if ((v = FlagValue(argv[i], "--wire-size"))) {
+      if (std::sscanf(v, "%dx%d", &opt.wire_w, &opt.wire_h) != 2)
+        return usage(argv[0]);
+    } else if ((v = FlagValue(argv[i], "--pixel-format"))) {
+      if (!ParsePixelFormat(v, &opt.pixel_format))
+        return usage(argv[0]);
+    } else if ((v = FlagValue(argv[i], "--keyframe-interval"))) {
+      opt.keyframe_interval = std::atoi(v);
+    } else if ((v = FlagValue(argv[i], "--canvas"))) {
+      if (std::sscanf(v, "%dx%d", &opt.canvas_w, &opt.canvas_h) != 2)
+        return usage(argv[0]);
+    } else if ((v = FlagValue(argv[i], "--region"))) {
+      opt.regions.push_back(v);
+    } else if ((v = FlagValue(argv[i], "--map"))) {
+      std::ifstream map(v);
+      if (!map) {
+        perror(v);
+        return 1;
+      }
+      std::string line;
+      while (std::getline(map, line)) {
+        size_t hash = line.find('#');
+        if (hash != std::string::npos) line.resize(hash);
+        line.erase(0, line.find_first_not_of(" \t"));
+        line.erase(line.find_last_not_of(" \t\r") + 1);
+        if (!line.empty()) opt.regions.push_back(line);
+      }
+    } else if ((v = FlagValue(argv[i], "--threads"))) {
+      opt.threads = std::atoi(v);
+    } else if (FlagSet(argv[i], "--burst")) {
+      opt.pace = false;
+    } else if (FlagSet(argv[i], "--loop")) {
+      opt.loop = true;
+    } else {
+      return usage(argv[0]);
+    }
+  }
+
+  const size_t hdr = HeaderSize(opt.format);
+  if (opt.chunk_size == 0 || opt.chunk_size + hdr > MAX_GSO_BYTES) {
+    std::fprintf(stderr, "--chunk-size must be 1..%zu\n", MAX_GSO_BYTES - hdr);
+    return 1;
+  }
+  opt.batch = std::max<size_t>(1, std::min(opt.batch, MAX_BATCH));
+  if (opt.mode == SEND_GSO) {
+    // The whole super-datagram must still fit in one IP packet.
+    opt.batch = std::max<size_t>(
+        1, std::min(opt.batch, MAX_GSO_BYTES / (opt.chunk_size + hdr)));
+  }
+
+  if (opt.retransmit && opt.format != WIRE_COMPACT) {
+    std::fprintf(stderr, "--retransmit needs the 6-byte format (frame ids)\n");
+    return 1;
+  }
+  if (opt.pts_delay_ms > 0 && opt.format != WIRE_COMPACT) {
+    std::fprintf(stderr, "--pts-delay-ms needs the 6-byte format (frame ids)\n");
+    return 1;
+  }
+  if ((opt.wire_w != WIDTH || opt.wire_h != HEIGHT) &&
+      (opt.format != WIRE_GEOMETRY || opt.wire_w <= 0 || opt.wire_h <= 0 ||
+       opt.wire_w > MAX_FRAME_WIDTH || opt.wire_h > MAX_FRAME_HEIGHT)) {
+    std::fprintf(stderr, "--wire-size needs the 12-byte format and at most "
+                 "%dx%d\n", MAX_FRAME_WIDTH, MAX_FRAME_HEIGHT);
+    return 1;
+  }
+  if (opt.pixel_format != PIXEL_RGB24 && opt.format != WIRE_GEOMETRY) {
+    std::fprintf(stderr, "--pixel-format needs the 12-byte format\n");
+    return 1;
+  }
+  if (opt.pixel_format == PIXEL_BC1) {
+    // Whole blocks per packet, so every packet decodes on its own.
+    opt.chunk_size -= opt.chunk_size % BC1_BLOCK_BYTES;
+    if (opt.chunk_size == 0) {
+      std::fprintf(stderr, "--pixel-format=bc1 needs --chunk-size of at "
+                   "least %d\n", BC1_BLOCK_BYTES);
+      return 1;
+    }
+  }
+  if (opt.pixel_format == PIXEL_DELTA &&
+      (opt.wire_w % 16 != 0 || opt.wire_h % 16 != 0)) {
+    std::fprintf(stderr, "--pixel-format=delta needs a --wire-size of whole "
+                 "16x16 blocks\n");
+    return 1;
+  }
+
+  // Without a region map the whole frame goes to --dest.
+  if (opt.regions.empty())
+    opt.regions.push_back("0,0=" + opt.dest);
+  if (opt.canvas_w < WIDTH || opt.canvas_h < HEIGHT) {
+    std::fprintf(stderr, "--canvas must be at least %dx%d\n", WIDTH, HEIGHT);
+    return 1;
+  }
+  std::vector<std::unique_ptr<Stream>> streams;
+  for (const std::string &r : opt.regions) {
+    streams.emplace_back(new Stream());
+    Stream *st = streams.back().get();
+    if (!ParseRegion(r, st) || st->x < 0 || st->y < 0 ||
+        st->x + WIDTH > opt.canvas_w || st->y + HEIGHT > opt.canvas_h) {
+      std::fprintf(stderr, "Bad region %s (want X,Y=IP:PORT inside the "
+                   "%dx%d canvas)\n", r.c_str(), opt.canvas_w, opt.canvas_h);
+      return 1;
+    }
+    if (!OpenStream(st, opt))
+      return 1;
+  }
+
+  InputKind input_kind = INPUT_FILE;
+  std::string pattern;
+  int in_fd = -1;
+  if (opt.input.compare(0, 8, "pattern:") == 0) {
+    input_kind = INPUT_PATTERN;
+    pattern = opt.input.substr(8);
+    if (pattern != "plasma" && pattern != "bars") {
+      std::fprintf(stderr, "Unknown pattern %s\n", pattern.c_str());
+      return 1;
+    }
+  } else if (opt.input == "-") {
+    in_fd = STDIN_FILENO;
+  } else {
+    in_fd = open(opt.input.c_str(), O_RDONLY);
+    if (in_fd < 0) {
+      perror(opt.input.c_str());
+      return 1;
+    }
+  }
+
+  signal(SIGTERM, InterruptHandler);
+  signal(SIGINT,  InterruptHandler);
+
+  std::fprintf(stderr,
+               "Sending %s to %s: %zu-byte header, %zu-byte chunks, %s x%zu, "
+               "%.1f fps%s\n",
+               opt.input.c_str(),
+               streams.size() == 1 ? streams[0]->name.c_str() : "regions",
+               HeaderSize(opt.format), opt.chunk_size,
+               opt.mode == SEND_GSO ? "gso" : "sendmmsg", opt.batch, opt.fps,
+               opt.pace ? ", paced" : "");
+
+  // Spread the regions over the sharding threads round robin.
+  size_t threads = opt.threads > 0
+                       ? (size_t)opt.threads
+                       : std::max(1u, std::thread::hardware_concurrency());
+  threads = std::min(threads, streams.size());
+  std::vector<std::vector<Stream *>> groups(threads);
+  for (size_t i = 0; i < streams.size(); ++i) {
+    Stream *st = streams[i].get();
+    groups[i % threads].push_back(st);
+    if (streams.size() > 1) {
+      std::fprintf(stderr, "  region %d,%d -> %s (thread %zu)\n", st->x,
+                   st->y, st->name.c_str(), i % threads);
+    }
+  }
+
+  const size_t pitch = (size_t)opt.canvas_w * 3;
+  const size_t canvas_bytes = pitch * opt.canvas_h;
+  // Two canvases: with threads the next frame is read while workers send.
+  std::vector<uint8_t> canvas[2];
+  canvas[0].assign(canvas_bytes, 0);
+  canvas[1].assign(canvas_bytes, 0);
+  const uint64_t frame_ns = opt.fps > 0 ? (uint64_t)(1e9 / opt.fps) : 0;
+  const uint64_t start_ns = NowNanos();
+  uint64_t next_frame_ns = start_ns;
+
+  SendCounters counters;
+  std::unique_ptr<ShardPool> pool;
+  if (threads > 1)
+    pool.reset(new ShardPool(groups, pitch, frame_ns, opt, &counters));
+
+  uint64_t report_ns = start_ns + 1000000000ull;
+  long frames_in_report = 0;
+  uint16_t frame_id = 0;
+
+  for (long frame_no = 0;
+       !interrupt_received && (opt.frames == 0 || frame_no < opt.frames);
+       ++frame_no) {
+    uint8_t *frame = canvas[frame_no & 1].data();
+    if (input_kind == INPUT_PATTERN) {
+      if (pattern == "plasma") {
+        PlasmaPattern(frame, opt.canvas_w, opt.canvas_h,
+                      (NowNanos() - start_ns) / 1e9f);
+      } else {
+        BarsPattern(frame, opt.canvas_w, opt.canvas_h, frame_no);
+      }
+    } else if (!ReadNBytes(in_fd, frame, canvas_bytes)) {
+      if (opt.loop && in_fd != STDIN_FILENO &&
+          lseek(in_fd, 0, SEEK_SET) == 0 &&
+          ReadNBytes(in_fd, frame, canvas_bytes)) {
+        // restarted
+      } else {
+        break;  // EOF
+      }
+    }
+
+    // If the source was slow (pipe) do not try to catch up with a burst.
+    uint64_t now = NowNanos();
+    if (frame_ns && next_frame_ns + frame_ns < now)
+      next_frame_ns = now;
+    const uint64_t send_ns = std::max(now, next_frame_ns);
+
+    if (pool) {
+      pool->Publish(frame, frame_id++, send_ns);
+    } else {
+      SendFrame(groups[0], frame, pitch, frame_id++, send_ns, frame_ns, opt,
+                &counters);
+    }
+    frames_in_report++;
+
+    if (frame_ns) {
+      next_frame_ns += frame_ns;
+      // Workers answer NACKs for their own streams; inline we do it here.
+      if (pool) SleepUntil(next_frame_ns); else WaitStreams(groups[0], next_frame_ns);
+    }
+
+    now = NowNanos();
+    if (now >= report_ns) {
+      double secs = (now - report_ns + 1000000000ull) / 1e9;
+      uint64_t pkts = counters.pkts.exchange(0);
+      uint64_t bytes = counters.bytes.exchange(0);
+      uint64_t dropped = counters.dropped.exchange(0);
+      uint64_t calls = counters.calls.exchange(0);
+      std::fprintf(stderr,
+                   "%.1f fps, %.0f pkt/s, %.1f Mbit/s, %.1f pkt/call, "
+                   "%llu send failures\n",
+                   frames_in_report / secs, pkts / secs, bytes * 8 / secs / 1e6,
+                   calls ? (double)(pkts + dropped) / calls : 0.0,
+                   (unsigned long long)dropped);
+      uint64_t nacks = 0, resent = 0, expired = 0, probes = 0;
+      for (const std::unique_ptr<Stream> &st : streams) {
+        nacks += st->rtx.nacks;
+        resent += st->rtx.resent;
+        expired += st->rtx.expired;
+        probes += st->rtx.probes;
+      }
+      if (opt.retransmit) {
+        std::fprintf(stderr, "  nacks %llu, retransmitted %llu, expired %llu\n",
+                     (unsigned long long)nacks, (unsigned long long)resent,
+                     (unsigned long long)expired);
+      }
+      if (opt.pts_delay_ms > 0) {
+        std::fprintf(stderr, "  clock probes answered %llu\n",
+                     (unsigned long long)probes);
+      }
+      report_ns = now + 1000000000ull;
+      frames_in_report = 0;
+    }
+  }
+
+  if (pool) pool->Drain();
+  pool.reset();
+  if (in_fd > STDIN_FILENO)
+    close(in_fd);
+  for (const std::unique_ptr<Stream> &st : streams) close(st->sock);
+  return 0;
+}
@@ -0,0 +1,176 @@
+// udp_stream_stats.h
+// Per-source counters for the UDP frame receiver.
+//
+// The receive thread is the only writer; with several receive threads each
+// gets its own UdpStreamStats, labelled so the report tells them apart. Counters are plain atomics bumped
+// with relaxed load+store (no locked read-modify-write on the hot path), and
+// a reporter thread reads them periodically and prints one line per source.
+
+#pragma once
+
+#include <arpa/inet.h>
+#include <netinet/in.h>
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <cstdio>
+#include <mutex>
+#include <string>
+#include <thread>
+
+// Sources beyond this many share the last slot ("other").
+static const int MAX_STATS_SOURCES = 16;
+
+struct UdpSourceStats {
+  // Identity; valid once `in_use` reads true (published with release).
+  std::atomic<bool>     in_use{false};
+  std::atomic<uint32_t> addr{0};   // network byte order
+  std::atomic<uint16_t> port{0};   // network byte order
+
+  std::atomic<uint64_t> reads{0};       // recvmsg calls (< packets with GRO)
+  std::atomic<uint64_t> packets{0};
+  std::atomic<uint64_t> bytes{0};
+  std::atomic<uint64_t> malformed{0};    // short, oversized, bad header
+  std::atomic<uint64_t> out_of_range{0}; // index/offset outside the frame
+  std::atomic<uint64_t> duplicate{0};
+  std::atomic<uint64_t> reordered{0};    // arrived after a higher index
+  std::atomic<uint64_t> lost{0};         // missing when a frame was dropped
+  std::atomic<uint64_t> frames_complete{0};
+  std::atomic<uint64_t> frames_incomplete{0};
+  std::atomic<uint64_t> frames_skipped{0};  // frame ids never seen at all
+  std::atomic<uint64_t> nacks_sent{0};
+  std::atomic<uint64_t> recovered{0};        // NACKed packets that arrived
+  std::atomic<uint64_t> frames_recovered{0}; // completed only thanks to NACKs
+  std::atomic<uint64_t> payload_copied{0};   // bytes memcpy'd into frames
+  std::atomic<uint64_t> payload_in_place{0}; // bytes received in place
+
+  // RFC 3550 interarrival jitter estimate, in microseconds * 16 (the same
+  // fixed-point trick as the RFC's sample code).
+  std::atomic<uint32_t> jitter_us16{0};
+
+  // --- Receive-thread private state (never read by the reporter) ---
+  uint64_t last_frame_start_us = 0;
+  int64_t  last_transit_us = 0;
+  bool     have_transit = false;
+};
+
+// Single-writer increment: avoids an atomic RMW because only the receive
+// thread ever modifies the counters.
+static inline void StatAdd(std::atomic<uint64_t> &c, uint64_t n = 1) {
+  c.store(c.load(std::memory_order_relaxed) + n, std::memory_order_relaxed);
+}
+
+class UdpStreamStats {
+ public:
+  // Find (or claim) the slot for a sender. Receive thread only.
+  UdpSourceStats *Lookup(const sockaddr_in &from) {
+    const uint32_t a = from.sin_addr.s_addr;
+    const uint16_t p = from.sin_port;
+    if (last_ && last_->addr.load(std::memory_order_relaxed) == a &&
+        last_->port.load(std::memory_order_relaxed) == p) {
+      return last_;
+    }
+    for (int i = 0; i < MAX_STATS_SOURCES; ++i) {
+      UdpSourceStats &s = sources_[i];
+      if (!s.in_use.load(std::memory_order_relaxed)) {
+        s.addr.store(a, std::memory_order_relaxed);
+        s.port.store(p, std::memory_order_relaxed);
+        s.in_use.store(true, std::memory_order_release);
+        return last_ = &s;
+      }
+      if (s.addr.load(std::memory_order_relaxed) == a &&
+          s.port.load(std::memory_order_relaxed) == p) {
+        return last_ = &s;
+      }
+    }
+    return last_ = &sources_[MAX_STATS_SOURCES - 1];
+  }
+
+  // Feed one jitter sample. `transit` (us) is arrival time minus the sender's
+  // timestamp for the event. When the wire format carries no timestamp, the
+  // caller passes the interval since the previous frame start instead, so D
+  // becomes the change in frame period.
+  static void UpdateJitter(UdpSourceStats *s, int64_t transit) {
+    if (s->have_transit) {
+      int64_t d = transit - s->last_transit_us;
+      if (d < 0) d = -d;
+      uint32_t j = s->jitter_us16.load(std::memory_order_relaxed);
+      // J += (|D| - J) / 16, kept in units of 1/16 us.
+      j += (uint32_t)d - ((j + 8) >> 4);
+      s->jitter_us16.store(j, std::memory_order_relaxed);
+    }
+    s->last_transit_us = transit;
+    s->have_transit = true;
+  }
+
+  void SetLabel(const char *label) { label_ = label; }
+
+  // Start the reporter thread; interval_s <= 0 disables reporting.
+  void StartReporter(int interval_s) {
+    if (interval_s <= 0) return;
+    reporter_ = std::thread([this, interval_s]() {
+      std::unique_lock<std::mutex> l(mu_);
+      while (!stop_) {
+        cv_.wait_for(l, std::chrono::seconds(interval_s));
+        if (!stop_) Print(stderr);
+      }
+    });
+  }
+
+  void StopReporter() {
+    {
+      std::lock_guard<std::mutex> l(mu_);
+      stop_ = true;
+    }
+    cv_.notify_all();
+    if (reporter_.joinable()) reporter_.join();
+  }
+
+  void Print(FILE *out) const {
+    for (int i = 0; i < MAX_STATS_SOURCES; ++i) {
+      const UdpSourceStats &s = sources_[i];
+      if (!s.in_use.load(std::memory_order_acquire)) break;
+      char ip[INET_ADDRSTRLEN];
+      in_addr a;
+      a.s_addr = s.addr.load(std::memory_order_relaxed);
+      inet_ntop(AF_INET, &a, ip, sizeof(ip));
+      std::fprintf(out,
+                   "[stats%s%s] %s:%u reads=%llu pkts=%llu bytes=%llu lost=%llu reord=%llu "
+                   "dup=%llu bad=%llu oor=%llu frames=%llu incomplete=%llu "
+                   "skipped=%llu nacks=%llu recovered=%llu/%llu frames "
+                   "jitter=%.1fus copy/frame=%.1fKB in-place/frame=%.1fKB\n",
+                   label_.empty() ? "" : " ", label_.c_str(),
+                   ip, ntohs(s.port.load(std::memory_order_relaxed)),
+                   Get(s.reads), Get(s.packets), Get(s.bytes), Get(s.lost), Get(s.reordered),
+                   Get(s.duplicate), Get(s.malformed), Get(s.out_of_range),
+                   Get(s.frames_complete), Get(s.frames_incomplete),
+                   Get(s.frames_skipped), Get(s.nacks_sent), Get(s.recovered),
+                   Get(s.frames_recovered),
+                   s.jitter_us16.load(std::memory_order_relaxed) / 16.0,
+                   PerFrameKB(s, s.payload_copied),
+                   PerFrameKB(s, s.payload_in_place));
+    }
+  }
+
+ private:
+  static unsigned long long Get(const std::atomic<uint64_t> &c) {
+    return (unsigned long long)c.load(std::memory_order_relaxed);
+  }
+
+  static double PerFrameKB(const UdpSourceStats &s,
+                           const std::atomic<uint64_t> &c) {
+    unsigned long long frames = Get(s.frames_complete);
+    return frames ? Get(c) / 1024.0 / frames : 0.0;
+  }
+
+  UdpSourceStats sources_[MAX_STATS_SOURCES];
+  UdpSourceStats *last_ = nullptr;
+  std::string label_;
+
+  std::thread reporter_;
+  std::mutex mu_;
+  std::condition_variable cv_;
+  bool stop_ = false;
+};